@@ -0,0 +1,700 @@
+/*
+    Benchmark for the encryption kernels, the in-memory library and the file paths - built as cryptoBench ("make benchmark64" or "make benchmark").
+
+    Generates random data and keys of several sizes, then times:
+        crypt           encryptionAlgorithm - the original kernel, looping a raw key (one case per key size)
+        stream          keyStreamAlgorithm - the kernel the file paths use, applying a prebuilt key schedule
+        streamHash      keyStreamHashAlgorithm - the same, fused with the checksum
+        hash            hashingAlgorithm
+        schedule        building a KeySchedule from a key (bytes = key stream built - the key rounded up to whole chunks)
+        buffer          encryptBuffer from the library
+        context         CryptoContext encrypting and decrypting the full file format in memory
+        crc32c          The chunk CRC that --crc & scrub use (ws-chunkCrc.h), with the SSE4.2 instruction (sse42) and with tables (table)
+        file            encryption()/decryption() through real files, in each processing mode (only with --files)
+    The kernel cases run once for every version of the kernels the processor supports (64bit build), so they can be compared directly.
+
+    Every case is run once to warm up, then timed --reps times. Small sizes are looped within each timed sample until at least
+    SAMPLE_BYTES have been processed, so timer resolution doesn't dominate. Reported per case:
+        GB/s            10^9 bytes per second, at the median (p50) and the fastest sample
+        cycles/byte     From the processor's time stamp counter at the median - reference cycles, which differ from core cycles under turbo.
+                        null on processors without one.
+        percentiles     Seconds per pass, min/p50/p90/p99/max/mean.
+
+    --json writes the results as JSON, one case per line, so runs can be diffed or kept as a baseline.
+    --baseline compares this run's median GB/s against an earlier --json file, and exits with 1 if any case got slower than --tolerance.
+
+    File cases read and write through the page cache, so they measure the code path rather than the disk.
+
+    Written by William Showalter. williamshowalter@gmail.com.
+
+    Released under Creative Commons - creativecommons.org/licenses/by-nc-sa/3.0/
+    Attribution-NonCommercial-ShareAlike 3.0 Unported (CC BY-NC-SA 3.0)
+*/
+
+#include <algorithm>    // std::sort, std::min
+#include <chrono>       // std::chrono::steady_clock - monotonic, unlike gettimeofday
+#include <cstdio>       // std::remove, for the temporary files
+#include <cstdlib>      // atoi, atof
+#include <fstream>      // Writing temporary files, JSON, reading a baseline
+#include <iomanip>      // Table formatting
+#include <iostream>     // Results table
+#include <map>          // Baseline results by name
+#include <random>       // Synthetic data & keys
+#include <sstream>      // Case names, list parsing
+#include <stdexcept>    // Errors from the file paths
+#include <string>       // std::string
+#include <vector>       // STL Container std::vector
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <x86intrin.h> // __rdtsc
+#  define WS_BENCH_TSC 1
+#endif
+
+#include "binaryEncryption.h" // File encryption entry points
+#include "ws-chunkCrc.h"
+#include "ws-cryptoBuffer.h"
+#include "ws-cryptoLib.h"
+#include "ws-keySchedule.h"
+
+const unsigned long long SAMPLE_BYTES = 4 * 1024 * 1024;  // Minimum data processed per timed sample
+const unsigned int DEFAULT_REPS = 15;
+
+// Options from the command line.
+struct BenchOptions
+{
+    std::vector<unsigned long long> sizes;
+    std::vector<unsigned long long> keySizes;
+    std::vector<std::string> kernels;
+    unsigned int reps;
+    std::string fileDirectory;          // Empty - skip the file cases
+    std::string jsonname;
+    std::string baselinename;
+    double tolerance;                   // Fraction slower than the baseline that counts as a regression
+};
+
+// Timing of one case.
+struct BenchResult
+{
+    std::string name;
+    unsigned long long bytes;           // Per pass
+    std::vector<double> seconds;        // Per pass, one per sample
+    std::vector<double> cycles;         // Per pass, one per sample. Empty without a time stamp counter.
+};
+
+// One timed operation - processes bytes per call.
+struct BenchCase
+{
+    virtual ~BenchCase () {}
+    virtual void run () = 0;
+};
+
+// Prototypes
+int                             printUsage (const char * program);
+bool                            parseList (std::string text, std::vector<unsigned long long> & sizes);
+std::string                     sizeName (unsigned long long size);
+void                            randomFill (std::vector<unsigned int> & data, unsigned int seed);
+BenchResult                     timeCase (std::string name, unsigned long long bytes, BenchCase & benchCase, unsigned int reps);
+double                          percentile (std::vector<double> values, double fraction);
+double                          gigabytesPerSecond (unsigned long long bytes, double seconds);
+void                            printResult (const BenchResult & result, std::ostream & out);
+void                            writeJson (const std::vector<BenchResult> & results, std::ostream & out);
+int                             compareBaseline (const std::vector<BenchResult> & results, std::string baselinename, double tolerance, std::ostream & out);
+void                            runKernelCases (const BenchOptions & options, std::string kernels, std::vector<BenchResult> & results, std::ostream & out);
+void                            runCrcCases (const BenchOptions & options, std::vector<BenchResult> & results, std::ostream & out);
+void                            runFileCases (const BenchOptions & options, std::vector<BenchResult> & results, std::ostream & out);
+
+/********************* Cases *********************/
+
+struct CryptCase : BenchCase
+{
+    std::vector<unsigned int> & data;
+    std::vector<unsigned int> & key;
+    CryptCase (std::vector<unsigned int> & data, std::vector<unsigned int> & key) : data(data), key(key) {}
+    void run ()
+    {
+        encryptionAlgorithm (&data[0], &data[0] + data.size(), &key[0], &key[0] + key.size(), ENCRYPT);
+    }
+};
+
+struct StreamCase : BenchCase
+{
+    std::vector<unsigned int> & data;
+    const KeySchedule & schedule;
+    bool hashed;
+    unsigned int hash;
+    StreamCase (std::vector<unsigned int> & data, const KeySchedule & schedule, bool hashed) : data(data), schedule(schedule), hashed(hashed), hash(0) {}
+    void run ()
+    {
+        // Same walk over the schedule as the file paths - one chunk's stream per chunk of data.
+        unsigned long long chunkWords = schedule.chunkSize() / 4;
+        for (unsigned long long i = 0; i < data.size(); i += chunkWords)
+        {
+            unsigned long long run = std::min (chunkWords, (unsigned long long)data.size() - i);
+            if (hashed)
+                hash ^= keyStreamHashAlgorithm (&data[i], &data[i] + run, &data[i], schedule.stream(i / chunkWords), ENCRYPT);
+            else
+                keyStreamAlgorithm (&data[i], &data[i] + run, &data[i], schedule.stream(i / chunkWords), ENCRYPT);
+        }
+    }
+};
+
+struct HashCase : BenchCase
+{
+    std::vector<unsigned int> & data;
+    unsigned int hash;
+    HashCase (std::vector<unsigned int> & data) : data(data), hash(0) {}
+    void run ()
+    {
+        hash ^= hashingAlgorithm (&data[0], &data[0] + data.size());
+    }
+};
+
+struct CrcCase : BenchCase
+{
+    std::vector<unsigned int> & data;
+    bool hardware;
+    unsigned int crc;
+    CrcCase (std::vector<unsigned int> & data, bool hardware) : data(data), hardware(hardware), crc(0) {}
+    void run ()
+    {
+        crc = crc32c (crc, &data[0], data.size() * 4, hardware);
+    }
+};
+
+struct ScheduleCase : BenchCase
+{
+    std::vector<unsigned int> & key;
+    ScheduleCase (std::vector<unsigned int> & key) : key(key) {}
+    void run ()
+    {
+        KeySchedule schedule (key, MAX_FILE_SIZE);
+    }
+};
+
+struct BufferCase : BenchCase
+{
+    std::vector<unsigned int> & data;
+    const KeySchedule & schedule;
+    BufferCase (std::vector<unsigned int> & data, const KeySchedule & schedule) : data(data), schedule(schedule) {}
+    void run ()
+    {
+        encryptBuffer ((const unsigned char *)&data[0], data.size() * 4, (unsigned char *)&data[0], schedule);
+    }
+};
+
+struct ContextCase : BenchCase
+{
+    KeyScheduleCache & keys;
+    OPERATION operation;
+    const std::vector<unsigned char> & input;
+    std::vector<unsigned char> output;
+    ContextCase (KeyScheduleCache & keys, OPERATION operation, const std::vector<unsigned char> & input) : keys(keys), operation(operation), input(input) {}
+    void run ()
+    {
+        output.clear();
+        CryptoContext context (keys, operation, MAX_FILE_SIZE, (operation == ENCRYPT) ? input.size() : UNKNOWN_LENGTH);
+        context.update (&input[0], input.size(), output);
+        if (!context.finish (output))
+            throw (std::runtime_error("Benchmark decryption failed its checksum."));
+    }
+};
+
+struct FileCase : BenchCase
+{
+    KeyScheduleCache & keys;
+    OPERATION operation;
+    std::string input;
+    std::string output;
+    CryptoOptions options;
+    FileCase (KeyScheduleCache & keys, OPERATION operation, std::string input, std::string output, const CryptoOptions & options)
+    : keys(keys), operation(operation), input(input), output(output), options(options) {}
+    void run ()
+    {
+        if (operation == ENCRYPT)
+            encryption (input, keys, output, options);
+        else if (!decryption (input, keys, output, options).second)
+            throw (std::runtime_error("Benchmark decryption failed its checksum."));
+    }
+};
+
+/********************* Driver *********************/
+
+int main (int argc, const char * argv[])
+{
+    BenchOptions options;
+    options.reps = DEFAULT_REPS;
+    options.tolerance = 0.10;
+    parseList ("4K,64K,1M,16M,64M", options.sizes);
+    parseList ("4,4K,1M", options.keySizes);
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        if (i + 1 == argc)
+            return printUsage(argv[0]);
+        std::string value = argv[++i];
+
+        if (argument == "--sizes" && parseList(value, options.sizes))
+            continue;
+        else if (argument == "--keys" && parseList(value, options.keySizes))
+            continue;
+        else if (argument == "--reps" && atoi(value.c_str()) > 0)
+            options.reps = atoi(value.c_str());
+        else if (argument == "--kernels")
+        {
+            std::istringstream list (value);
+            std::string name;
+            while (std::getline(list, name, ','))
+                options.kernels.push_back(name);
+        }
+        else if (argument == "--files")
+            options.fileDirectory = value;
+        else if (argument == "--json")
+            options.jsonname = value;
+        else if (argument == "--baseline")
+            options.baselinename = value;
+        else if (argument == "--tolerance" && atof(value.c_str()) >= 0)
+            options.tolerance = atof(value.c_str()) / 100;
+        else
+            return printUsage(argv[0]);
+    }
+
+#ifdef WS_CRYPTO_64
+    if (options.kernels.empty())
+    {
+        const char * versions[] = {"scalar", "sse2", "avx2"};
+        for (unsigned int i = 0; i < 3; i++)
+            if (useKernels(versions[i]))
+                options.kernels.push_back(versions[i]);
+    }
+#else
+    // 32bit build - only the assembly kernels exist.
+    options.kernels.assign(1, "asm");
+#endif
+
+    // Table goes to standard error when the JSON goes to standard output.
+    std::ostream & out = (options.jsonname == "-") ? std::cerr : std::cout;
+    std::vector<BenchResult> results;
+
+    try {
+        for (unsigned int i = 0; i < options.kernels.size(); i++)
+        {
+#ifdef WS_CRYPTO_64
+            if (!useKernels(options.kernels[i].c_str()))
+            {
+                std::cerr << "Kernel version " << options.kernels[i] << " isn't supported on this processor - skipped.\n";
+                continue;
+            }
+#endif
+            runKernelCases (options, options.kernels[i], results, out);
+        }
+
+#ifdef WS_CRYPTO_64
+        useKernels("auto");
+#endif
+        runCrcCases (options, results, out);
+        if (!options.fileDirectory.empty())
+            runFileCases (options, results, out);
+    }
+
+    catch (std::exception & e) {
+        std::cerr << "Benchmark failed: " << e.what() << "\n";
+        return 2;
+    }
+
+    if (!options.jsonname.empty())
+    {
+        if (options.jsonname == "-")
+            writeJson (results, std::cout);
+        else
+        {
+            std::ofstream json (options.jsonname.c_str());
+            writeJson (results, json);
+            if (!json)
+            {
+                std::cerr << "Could not write " << options.jsonname << "\n";
+                return 2;
+            }
+        }
+    }
+
+    if (!options.baselinename.empty())
+        return compareBaseline (results, options.baselinename, options.tolerance, out);
+
+    return 0;
+}
+
+int printUsage (const char * program)
+{
+    std::cerr   << "Usage: " << program << " [options]\n"
+                << "  --sizes LIST      data sizes, comma separated, K/M/G suffixes allowed (default 4K,64K,1M,16M,64M)\n"
+                << "  --keys LIST       key sizes for the crypt & schedule cases (default 4,4K,1M)\n"
+                << "  --reps N          timed samples per case (default " << DEFAULT_REPS << ")\n"
+                << "  --kernels LIST    kernel versions to time - scalar, sse2, avx2 (default every one this processor supports)\n"
+                << "  --files DIR       also time encryption()/decryption() through temporary files in DIR\n"
+                << "  --json FILE       write results as JSON (- for standard output)\n"
+                << "  --baseline FILE   compare median GB/s against an earlier --json, exit 1 on a regression\n"
+                << "  --tolerance PCT   slowdown allowed against the baseline (default 10)\n";
+    return 2;
+}
+
+bool parseList (std::string text, std::vector<unsigned long long> & sizes)
+{
+    // Comma separated sizes, each read by parseSize. Returns false, leaving sizes alone, if any isn't a size.
+    std::vector<unsigned long long> parsed;
+    std::istringstream list (text);
+    std::string item;
+    while (std::getline(list, item, ','))
+    {
+        unsigned long long size;
+        if (!parseSize(item, size) || size < 4)
+            return false;
+        parsed.push_back(size - size % 4);
+    }
+
+    if (parsed.empty())
+        return false;
+
+    sizes = parsed;
+    return true;
+}
+
+std::string sizeName (unsigned long long size)
+{
+    std::ostringstream name;
+    if (size % (1024 * 1024) == 0)
+        name << size / (1024 * 1024) << "M";
+    else if (size % 1024 == 0)
+        name << size / 1024 << "K";
+    else
+        name << size;
+    return name.str();
+}
+
+void randomFill (std::vector<unsigned int> & data, unsigned int seed)
+{
+    // Fixed seeds, so every run times the same data.
+    std::mt19937 generator (seed);
+    for (unsigned long long i = 0; i < data.size(); i++)
+        data[i] = generator();
+}
+
+BenchResult timeCase (std::string name, unsigned long long bytes, BenchCase & benchCase, unsigned int reps)
+{
+    BenchResult result;
+    result.name = name;
+    result.bytes = bytes;
+
+    unsigned long long loops = (bytes < SAMPLE_BYTES) ? SAMPLE_BYTES / bytes : 1;
+
+    benchCase.run();        // Warm up - caches, page faults, lazily built schedules
+
+    for (unsigned int rep = 0; rep < reps; rep++)
+    {
+#ifdef WS_BENCH_TSC
+        unsigned long long cycles1 = __rdtsc();
+#endif
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+
+        for (unsigned long long i = 0; i < loops; i++)
+            benchCase.run();
+
+        std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+#ifdef WS_BENCH_TSC
+        unsigned long long cycles2 = __rdtsc();
+        result.cycles.push_back((double)(cycles2 - cycles1) / loops);
+#endif
+        result.seconds.push_back(std::chrono::duration<double>(t2 - t1).count() / loops);
+    }
+
+    return result;
+}
+
+double percentile (std::vector<double> values, double fraction)
+{
+    // Nearest rank.
+    std::sort (values.begin(), values.end());
+    return values[(unsigned long long)(fraction * (values.size() - 1) + 0.5)];
+}
+
+double gigabytesPerSecond (unsigned long long bytes, double seconds)
+{
+    return (seconds > 0) ? bytes / seconds / 1e9 : 0;
+}
+
+void printResult (const BenchResult & result, std::ostream & out)
+{
+    out << std::left << std::setw(44) << result.name << std::right << std::fixed
+        << std::setw(9) << std::setprecision(3) << gigabytesPerSecond(result.bytes, percentile(result.seconds, 0.5)) << " GB/s"
+        << std::setw(9) << std::setprecision(3) << gigabytesPerSecond(result.bytes, percentile(result.seconds, 0)) << " best";
+
+    if (!result.cycles.empty())
+        out << std::setw(9) << std::setprecision(3) << percentile(result.cycles, 0.5) / result.bytes << " cycles/byte";
+
+    out << std::endl;
+}
+
+void writeJson (const std::vector<BenchResult> & results, std::ostream & out)
+{
+    // One case per line - compareBaseline() reads it back line by line.
+    out << "{\n";
+#ifdef WS_CRYPTO_64
+    out << "  \"build\": \"64bit\",\n";
+#else
+    out << "  \"build\": \"32bit\",\n";
+#endif
+    out << "  \"defaultKernels\": \"";
+#ifdef WS_CRYPTO_64
+    out << kernelsInUse();
+#else
+    out << "asm";
+#endif
+    out << "\",\n  \"results\": [\n";
+
+    for (unsigned int i = 0; i < results.size(); i++)
+    {
+        const BenchResult & result = results[i];
+        double sum = 0;
+        for (unsigned int j = 0; j < result.seconds.size(); j++)
+            sum += result.seconds[j];
+
+        out << std::setprecision(9) << std::defaultfloat
+            << "    {\"name\": \"" << result.name << "\", \"bytes\": " << result.bytes << ", \"reps\": " << result.seconds.size()
+            << ", \"gbps_p50\": " << gigabytesPerSecond(result.bytes, percentile(result.seconds, 0.5))
+            << ", \"gbps_best\": " << gigabytesPerSecond(result.bytes, percentile(result.seconds, 0))
+            << ", \"cycles_per_byte_p50\": ";
+
+        if (result.cycles.empty())
+            out << "null";
+        else
+            out << percentile(result.cycles, 0.5) / result.bytes;
+
+        out << ", \"seconds\": {\"min\": " << percentile(result.seconds, 0) << ", \"p50\": " << percentile(result.seconds, 0.5)
+            << ", \"p90\": " << percentile(result.seconds, 0.9) << ", \"p99\": " << percentile(result.seconds, 0.99)
+            << ", \"max\": " << percentile(result.seconds, 1) << ", \"mean\": " << sum / result.seconds.size() << "}}"
+            << ((i + 1 < results.size()) ? ",\n" : "\n");
+    }
+
+    out << "  ]\n}\n";
+}
+
+int compareBaseline (const std::vector<BenchResult> & results, std::string baselinename, double tolerance, std::ostream & out)
+{
+    /*
+     Compares median GB/s against a file written by --json. Cases missing from either run are listed but don't fail.
+     Returns 1 if any case is slower than the baseline by more than tolerance, 2 if the baseline can't be read.
+     */
+
+    std::ifstream baselinefile (baselinename.c_str());
+    if (!baselinefile.is_open())
+    {
+        std::cerr << "Could not open baseline " << baselinename << "\n";
+        return 2;
+    }
+
+    std::map<std::string, double> baseline;
+    std::string line;
+    const std::string nameKey = "\"name\": \"";
+    const std::string rateKey = "\"gbps_p50\": ";
+    while (std::getline(baselinefile, line))
+    {
+        std::string::size_type name = line.find(nameKey);
+        std::string::size_type rate = line.find(rateKey);
+        if (name == std::string::npos || rate == std::string::npos)
+            continue;
+
+        name += nameKey.size();
+        baseline[line.substr(name, line.find('"', name) - name)] = atof(line.c_str() + rate + rateKey.size());
+    }
+
+    int status = 0;
+    out << std::defaultfloat << "\nAgainst baseline " << baselinename << " (median GB/s, " << tolerance * 100 << "% tolerance):\n";
+    for (unsigned int i = 0; i < results.size(); i++)
+    {
+        std::map<std::string, double>::iterator base = baseline.find(results[i].name);
+        out << std::left << std::setw(44) << results[i].name << std::right;
+        if (base == baseline.end())
+        {
+            out << "  not in baseline\n";
+            continue;
+        }
+
+        double current = gigabytesPerSecond(results[i].bytes, percentile(results[i].seconds, 0.5));
+        double change = (base->second > 0) ? current / base->second - 1 : 0;
+        bool regressed = change < -tolerance;
+        out << std::fixed << std::setprecision(3) << std::setw(9) << base->second << " ->" << std::setw(9) << current
+            << std::showpos << std::setprecision(1) << std::setw(8) << change * 100 << "%" << std::noshowpos
+            << (regressed ? "  REGRESSION" : "") << "\n";
+
+        if (regressed)
+            status = 1;
+        baseline.erase(base);
+    }
+
+    for (std::map<std::string, double>::iterator i = baseline.begin(); i != baseline.end(); i++)
+        out << std::left << std::setw(44) << i->first << std::right << "  not run\n";
+
+    return status;
+}
+
+void runKernelCases (const BenchOptions & options, std::string kernels, std::vector<BenchResult> & results, std::ostream & out)
+{
+    out << "\n" << kernels << " kernels:\n";
+
+    std::vector<std::vector<unsigned int> > keys (options.keySizes.size());
+    for (unsigned int k = 0; k < keys.size(); k++)
+    {
+        keys[k].resize(options.keySizes[k] / 4);
+        randomFill (keys[k], 1000 + k);
+
+        ScheduleCase scheduleCase (keys[k]);
+        unsigned long long streamBytes = (options.keySizes[k] + MAX_FILE_SIZE - 1) / MAX_FILE_SIZE * MAX_FILE_SIZE;
+        results.push_back(timeCase("schedule/" + kernels + "/key=" + sizeName(options.keySizes[k]), streamBytes, scheduleCase, options.reps));
+        printResult (results.back(), out);
+    }
+
+    std::vector<unsigned char> keyBytes ((unsigned char *)&keys.back()[0], (unsigned char *)&keys.back()[0] + keys.back().size() * 4);
+    KeyScheduleCache keyCache (&keyBytes[0], keyBytes.size());
+    const KeySchedule & schedule = keyCache.schedule(MAX_FILE_SIZE);
+
+    for (unsigned int s = 0; s < options.sizes.size(); s++)
+    {
+        unsigned long long bytes = options.sizes[s];
+        std::string size = "/size=" + sizeName(bytes);
+        std::vector<unsigned int> data (bytes / 4);
+        randomFill (data, s);
+
+        for (unsigned int k = 0; k < keys.size(); k++)
+        {
+            CryptCase cryptCase (data, keys[k]);
+            results.push_back(timeCase("crypt/" + kernels + "/key=" + sizeName(options.keySizes[k]) + size, bytes, cryptCase, options.reps));
+            printResult (results.back(), out);
+        }
+
+        StreamCase streamCase (data, schedule, false);
+        results.push_back(timeCase("stream/" + kernels + size, bytes, streamCase, options.reps));
+        printResult (results.back(), out);
+
+        StreamCase streamHashCase (data, schedule, true);
+        results.push_back(timeCase("streamHash/" + kernels + size, bytes, streamHashCase, options.reps));
+        printResult (results.back(), out);
+
+        HashCase hashCase (data);
+        results.push_back(timeCase("hash/" + kernels + size, bytes, hashCase, options.reps));
+        printResult (results.back(), out);
+
+        BufferCase bufferCase (data, schedule);
+        results.push_back(timeCase("buffer/" + kernels + size, bytes, bufferCase, options.reps));
+        printResult (results.back(), out);
+
+        std::vector<unsigned char> plain ((unsigned char *)&data[0], (unsigned char *)&data[0] + bytes);
+        ContextCase encryptCase (keyCache, ENCRYPT, plain);
+        results.push_back(timeCase("context/encrypt/" + kernels + size, bytes, encryptCase, options.reps));
+        printResult (results.back(), out);
+
+        ContextCase decryptCase (keyCache, DECRYPT, encryptCase.output);
+        results.push_back(timeCase("context/decrypt/" + kernels + size, bytes, decryptCase, options.reps));
+        printResult (results.back(), out);
+    }
+}
+
+void runCrcCases (const BenchOptions & options, std::vector<BenchResult> & results, std::ostream & out)
+{
+    // The CRC doesn't depend on the cipher kernels, so it's timed once - with the instruction where the processor has it, and always with tables.
+    out << "\nChunk CRC:\n";
+
+    for (unsigned int s = 0; s < options.sizes.size(); s++)
+    {
+        unsigned long long bytes = options.sizes[s];
+        std::string size = "/size=" + sizeName(bytes);
+        std::vector<unsigned int> data (bytes / 4);
+        randomFill (data, s);
+
+        if (crc32cHardware())
+        {
+            CrcCase hardwareCase (data, true);
+            results.push_back(timeCase("crc32c/sse42" + size, bytes, hardwareCase, options.reps));
+            printResult (results.back(), out);
+        }
+
+        CrcCase tableCase (data, false);
+        results.push_back(timeCase("crc32c/table" + size, bytes, tableCase, options.reps));
+        printResult (results.back(), out);
+    }
+}
+
+void runFileCases (const BenchOptions & options, std::vector<BenchResult> & results, std::ostream & out)
+{
+    /*
+     Times encryption()/decryption() of a file of each size, in each processing mode, with the kernels chosen at startup.
+     The temporary files are removed afterwards.
+     */
+
+    out << "\nFiles, " << options.fileDirectory << ":\n";
+
+    std::string keyname = options.fileDirectory + "/cryptoBench.key";
+    std::string plainname = options.fileDirectory + "/cryptoBench.data";
+    std::string encryptedname = options.fileDirectory + "/cryptoBench.enc";
+    std::string decryptedname = options.fileDirectory + "/cryptoBench.dec";
+
+    std::vector<unsigned int> key (options.keySizes.back() / 4);
+    randomFill (key, 1000);
+    std::ofstream keyfile (keyname.c_str(), std::ios::binary);
+    keyfile.write((const char *)&key[0], key.size() * 4);
+    keyfile.close();
+    KeyScheduleCache keys (keyname);
+
+    const char * modeNames[] = {"serial", "threads", "pipelined", "mapped", "direct"};
+    std::vector<CryptoOptions> modes (5);
+    modes[1].threadCount = 0;
+    modes[2].threadCount = 0;
+    modes[2].pipelined = true;
+    modes[3].threadCount = 0;
+    modes[3].mapped = true;
+    modes[4].threadCount = 0;
+    modes[4].pipelined = true;
+    modes[4].directIO = true;
+#ifdef _WIN32
+    modes.resize (3);       // No memory mapped or direct modes on Windows
+#endif
+
+    try {
+        for (unsigned int s = 0; s < options.sizes.size(); s++)
+        {
+            unsigned long long bytes = options.sizes[s];
+            std::vector<unsigned int> data (bytes / 4);
+            randomFill (data, s);
+            std::ofstream plainfile (plainname.c_str(), std::ios::binary);
+            plainfile.write((const char *)&data[0], bytes);
+            plainfile.close();
+            if (!plainfile)
+                throw (std::runtime_error("Could not write benchmark data to " + plainname));
+
+            for (unsigned int m = 0; m < modes.size(); m++)
+            {
+                std::string name = std::string("/") + modeNames[m] + "/size=" + sizeName(bytes);
+
+                FileCase encryptCase (keys, ENCRYPT, plainname, encryptedname, modes[m]);
+                results.push_back(timeCase("file/encrypt" + name, bytes, encryptCase, options.reps));
+                printResult (results.back(), out);
+
+                FileCase decryptCase (keys, DECRYPT, encryptedname, decryptedname, modes[m]);
+                results.push_back(timeCase("file/decrypt" + name, bytes, decryptCase, options.reps));
+                printResult (results.back(), out);
+            }
+        }
+    }
+
+    catch (...) {
+        std::remove (keyname.c_str());
+        std::remove (plainname.c_str());
+        std::remove (encryptedname.c_str());
+        std::remove (decryptedname.c_str());
+        throw;
+    }
+
+    std::remove (keyname.c_str());
+    std::remove (plainname.c_str());
+    std::remove (encryptedname.c_str());
+    std::remove (decryptedname.c_str());
+}
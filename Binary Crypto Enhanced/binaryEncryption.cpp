@@ -2,6 +2,7 @@
     This is a 32bit program to perform encryption on data read in from a file.
 
     Users are prompted for their selection of encryption or decryption, and then for the paths to the files that contain the data, the key to be used, and the location of the output file.
+    Run with arguments instead, the same operations are done without prompting - on one file, or on every file listed in a batch manifest (see commandLine()).
     
     A series of assembly xor's and circular bit shifts are performed on 32bit (4byte) sections of the data to perform the encryption/decryption.
  
@@ -9,7 +10,8 @@
                       Calculates how fast data is processed being encrypted or decrypted. Read time for key creates overhead, key chunks are potentially the same size of data for each read.
                       This is the speed at which it took to load the data, key, run the encryption/decryption function, and write out to file the result.
  
-    One 4 byte checksum is inserted into encrypted data for every MAX_FILE_SIZE piece of the file. MAX_FILE_SIZE is currently 1MB.
+    One 4 byte checksum is inserted into encrypted data for every chunk of the file. Chunks are MAX_FILE_SIZE (1MB) unless another size is chosen,
+    and the chunk size is recorded in a header at the front of the encrypted file (ws-fileHeader.h).
 
  
     Written by William Showalter. williamshowalter@gmail.com.
@@ -31,44 +33,265 @@
 
 */
 
+#include <algorithm>    // std::min, std::sort, std::set_difference
+#include <cstdio>       // EOF, fileno
 #include <cstdlib>		// Exit, misc.
+#include <exception>    // std::exception_ptr, passes errors from pipeline threads back to the caller
 #include <fstream>      // File IO operations
 #include <iostream>     // Reading input, prompt user
+#include <iterator>     // std::back_inserter
+#include <atomic>       // Mapped mode's stop flag, shared by the worker threads
+#include <memory>       // std::unique_ptr for the optional thread pool, std::shared_ptr for tree mode's split files
+#include <mutex>        // Batch mode result counters
+#include <sstream>      // Parsing numeric command line arguments
 #include <stdexcept>    // May throw during encyption or decryption, if files can't be opened
 #include <string>       // std::string and std::getline for user input.
+#include <thread>       // std::thread::hardware_concurrency
 #include <vector>       // STL Container std::vector
 
+#ifndef _WIN32
+#include <dirent.h>     // opendir, readdir - directory tree mode
+#include <fcntl.h>      // open() & posix_fallocate for memory mapped mode
+#include <sys/mman.h>   // mmap, madvise, msync
+#include <sys/stat.h>   // fstat, for mapped file sizes
+#include <unistd.h>     // close, ftruncate
+#else
+#include <fcntl.h>      // _O_BINARY
+#include <io.h>         // _setmode, for binary standard input/output
+#endif
+
 #include "NetRunlib.h"  // time_in_seconds function
+#include "binaryEncryption.h" // File encryption entry points, shared with the benchmark
+#include "ws-chunkCrc.h" // Per-chunk CRC32C sidecar, for scrubbing an encrypted file
+#include "ws-chunkDigest.h" // Per-chunk digests, for updating an encrypted file
+#include "ws-cryptoBuffer.h" // Per-chunk processing, shared with the in-memory library
+#include "ws-cryptoDaemon.h" // Daemon mode, serving requests over a Unix socket
+#include "ws-cryptoLib.h" // Encryption & hashing kernels
+#include "ws-directIO.h" // O_DIRECT & io_uring file streams, for --direct
+#include "ws-fileHeader.h" // Settings recorded in front of the encrypted data
+#include "ws-inPlaceJournal.h" // Recovery journal for in-place mode
+#include "ws-keySchedule.h" // Key file loaded once, as the combined key stream
+#include "ws-lzCodec.h" // Compression ahead of the cipher, for --compress
+#include "ws-threadPool.h" // Worker threads for parallel mode
 
 // GLOBAL CONSTANTS
-const unsigned int BIT_SHIFT_COUNT = 16;              // Multiple of 8 (full byte increments)
-const unsigned int MAX_FILE_SIZE = 1024 * 1024;       // 1MB. Maximum vector size, to avoid reading entire file (which could bad_alloc and has non-optimal performance).
-enum OPERATION {ENCRYPT = 0, DECRYPT = 1};
 enum BYTES {BYTES = 0, KILOBYTES = 1, MEGABYTES = 2, GIGABYTES = 3};
+enum EXIT_STATUS {EXIT_OK = 0, EXIT_CHECKSUM_FAILED = 1, EXIT_ERROR = 2};  // Command line exit codes. An error on any file outranks a checksum failure.
+const unsigned long long TREE_SEGMENT_BYTES = 64 * 1024 * 1024;   // Tree mode - files bigger than this are split into tasks of about this much
+const unsigned long long TREE_BATCH_BYTES = 16 * 1024 * 1024;     // Tree mode - smaller files are grouped into tasks of up to this much,
+const unsigned int TREE_BATCH_FILES = 256;                        // or this many files
+
+
+// Open files & lengths shared by the read/process/write loop.
+struct CryptoFiles
+{
+    std::fstream datafilestream;
+    std::fstream outfilestream;
+#ifndef _WIN32
+    DirectFileStream directData;        // options.directIO - used instead of datafilestream & outfilestream
+    DirectFileStream directOut;
+#endif
+    std::istream * input;               // datafilestream, or std::cin
+    std::ostream * output;              // outfilestream, std::cout, or NULL when only verifying
+    const KeySchedule * schedule;       // Built for header.chunkSize
+    const KeySchedule * rekeySchedule;  // Rekeying only - the new key's schedule, for the same chunk size. NULL otherwise.
+    FileHeader header;                  // Written by encryption, read by decryption
+    unsigned long long dataLength;      // Bytes read in so far, not counting the header - the length of the data once the last chunk is read
+    unsigned long long outputLength;    // Bytes written out so far, not counting the header
+    unsigned long long chunksRead;
+    bool stopOnBadChunk;                // Decryption only - from CryptoOptions
+    CryptoStats * stats;                // From CryptoOptions - NULL when not instrumented
+    bool stopped;                       // Set once a bad chunk has stopped the loop
+    std::vector<unsigned long long> * digests;  // Encryption only - collects every chunk's digest, in file order, when options.writeDigests. NULL otherwise.
+    bool writeFrames;                   // Encryption only - options.compress. Each chunk goes out as a frame, behind its frame word.
+    std::vector<ChunkCrc> * crcs;       // Collects the CRC of every chunk as it's written out, when options.writeCrcs. NULL otherwise.
+    
+    // Bytes read while looking for a header that turned out to be data (from a file without a header). Read again before the rest of the input.
+    std::vector<char> pending;
+    unsigned long long pendingRead;
+    
+    CryptoFiles () : rekeySchedule(NULL), digests(NULL), writeFrames(false), crcs(NULL) {}
+};
+
+// One line of a batch manifest.
+struct BatchEntry
+{
+    std::string input;
+    std::string output;                 // Empty when only verifying
+};
+
+// Status lines & counts of a batch or tree run, added to by every thread working on it.
+struct BatchResults
+{
+    std::ostream * report;
+    std::mutex mutex;
+    unsigned long long failed;
+    unsigned long long errors;
+    
+    explicit BatchResults (std::ostream & out) : report(&out), failed(0), errors(0) {}
+    
+    // Prints "result<TAB>input", and "<TAB>reason" if there is one. FAILED & ERROR are counted - anything else (OK, SKIPPED) isn't.
+    void add (std::string input, std::string result, std::string reason)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (result == "FAILED")
+            failed++;
+        else if (result == "ERROR")
+            errors++;
+        
+        *report << result << "\t" << input;
+        if (!reason.empty())
+            *report << "\t" << reason;
+        *report << std::endl;
+    }
+    
+    int exitStatus ()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (errors)
+            return EXIT_ERROR;
+        if (failed)
+            return EXIT_CHECKSUM_FAILED;
+        return EXIT_OK;
+    }
+};
+
+#ifndef _WIN32
+// A memory mapped file. Unmaps & closes itself when it goes out of scope.
+struct MappedFile
+{
+    int fd;
+    void * base;
+    unsigned long long length;
+    
+    MappedFile ();
+    ~MappedFile ();
+};
+
+// Everything processMappedChunk needs to find one chunk in the mappings.
+struct MappedJob
+{
+    OPERATION operation;
+    const void * input;
+    unsigned long long inputLength;
+    void * output;
+    const KeySchedule * schedule;
+    unsigned int chunkSize;
+    unsigned long long chunkCount;
+    unsigned int * hashesBefore;        // Decryption only - one per chunk
+    unsigned int * hashesAfter;
+    unsigned long long * digests;       // Encryption only - one per chunk, or NULL for none
+    bool stopOnBadChunk;
+    std::atomic<bool> * stopped;        // Set by the first bad chunk when stopOnBadChunk - chunks not yet started are skipped
+    CryptoStats * stats;
+};
+
+// Where every chunk of an in-place run is read from and written to. Chunk N's input is at inputStart + N*inputStride, its output at outputStart + N*outputStride.
+struct InPlaceLayout
+{
+    OPERATION operation;
+    unsigned int chunkSize;
+    unsigned long long inputStride;     // chunkSize-4 bytes of plain data per chunk, or chunkSize bytes of encrypted data
+    unsigned long long outputStride;
+    unsigned long long inputStart;      // After the header, when decrypting a file that has one
+    unsigned long long outputStart;     // After the header, when encrypting
+    unsigned long long inputLength;     // Bytes of data from inputStart on
+    unsigned long long chunkCount;
+    unsigned long long outputLength;    // Length of the whole file once the run is done
+};
+
+// A big file in a tree run, split into segments of chunks that are separate tasks (see splitTreeFile()).
+struct TreeFile
+{
+    std::string input;                  // Path, as reported
+    MappedFile inputFile;               // Never mapped - these only own the descriptors
+    MappedFile outputFile;              // fd is -1 when only verifying
+    InPlaceLayout layout;               // Where each chunk is read from and written to - the same as in place
+    FileHeader header;
+    const KeySchedule * schedule;
+    std::atomic<unsigned long long> segmentsLeft;   // The segment that takes this to 0 reports the file
+    std::mutex mutex;                   // Guards badChunks & error
+    std::vector<unsigned long long> badChunks;
+    std::string error;                  // First error any segment hit
+};
 
-// Assembly functions for performing encryption & hashing. In source files "ws-cryptoLibEnc.nasm" and "ws-cryptoLibHash.nasm".
-extern "C" int encryptionAlgorithm(unsigned int *, unsigned int *, unsigned int *, unsigned int *, OPERATION);
-extern "C" int hashingAlgorithm (unsigned int *, unsigned int *);
+// A directory tree run, shared by all of its tasks.
+struct TreeJob
+{
+    OPERATION operation;
+    KeyScheduleCache * keys;
+    CryptoOptions options;              // One thread per file - the pool spreads the work over files & segments instead
+    std::string inputRoot;
+    std::string outputRoot;             // Empty when only verifying
+    dev_t outputDevice;                 // The output tree, skipped if it's inside the input tree
+    ino_t outputInode;
+    WorkStealingPool * pool;
+    BatchResults * results;
+};
+#endif
 
 // Function Prototypes
 void                            menu ();
-unsigned int                    encryption(std::string datafilename, std::string keyfilename, std::string outputname);
-std::pair<unsigned int,bool>    decryption(std::string datafilename, std::string keyfilename, std::string outputname);
-void                            timePrint (double time1, double time2, int dataSize);
-void                            testDriver (std::string datafilename, std::string outputfilename, std::string keyfilename, std::string tempOutputname);
+int                             commandLine (int argc, const char * argv[]);
+int                             serveCommand (int argc, const char * argv[]);
+int                             scrubCommand (int argc, const char * argv[]);
+void                            printUsage ();
+std::vector<BatchEntry>         readManifest (std::string manifestname, bool inputOnly);
+std::string                     describeFailure (const ChecksumReport & report);
+int                             runBatch (const std::vector<BatchEntry> & entries, KeyScheduleCache & keys, OPERATION operation, const CryptoOptions & options, unsigned int jobCount, std::ostream & report);
+void                            runEntry (const BatchEntry & entry, KeyScheduleCache & keys, OPERATION operation, const CryptoOptions & options, BatchResults & results);
+std::string                     treePath (std::string root, std::string relative);
+int                             runTree (std::string inputRoot, std::string outputRoot, KeyScheduleCache & keys, OPERATION operation, const CryptoOptions & options, unsigned int workerCount, std::ostream & report);
+bool                            chunkMatches (std::istream & file, const ChunkCrc & chunk, std::vector<char> & buffer);
+void                            scrubChunks (std::string filename, const CrcFile & sidecar, unsigned long long first, unsigned long long end, std::vector<unsigned long long> & damaged);
+ChecksumReport                  decryptRange(std::string datafilename, KeyScheduleCache & keys, std::string outputname, const CryptoOptions & options);
+void                            openFiles (std::string datafilename, std::string outputname, OPERATION operation, const CryptoOptions & options, CryptoFiles & files);
+void                            closeFiles (CryptoFiles & files, OPERATION operation);
+bool                            isStandardStream (std::string filename);
+void                            readHeader (CryptoFiles & files);
+unsigned long long              readInput (CryptoFiles & files, char * buffer, unsigned long long size);
+bool                            inputFinished (CryptoFiles & files);
+void                            readChunk (CryptoFiles & files, OPERATION operation, Chunk & chunk);
+void                            readFrame (CryptoFiles & files, Chunk & chunk);
+void                            processChunkTimed (Chunk & chunk, OPERATION operation, CryptoStats * stats, bool takeDigest, bool framed, bool rekey);
+SecureArena &                   frameScratch (unsigned long long bytes);
+void                            compressChunk (Chunk & chunk);
+void                            decompressChunk (Chunk & chunk);
+void                            writeChunk (CryptoFiles & files, const Chunk & chunk);
+void                            writeCrcSidecar (std::string outputname, unsigned int chunkSize, std::vector<ChunkCrc> & crcs, CryptoStats * stats);
+const KeySchedule *             loadSchedule (KeyScheduleCache & keys, unsigned int chunkSize, CryptoStats * stats);
+void                            runChunks (CryptoFiles & files, OPERATION operation, const CryptoOptions & options, std::vector<unsigned int> & hashesBefore, std::vector<unsigned int> & hashesAfter);
+void                            runChunksBatched (CryptoFiles & files, OPERATION operation, unsigned int threadCount, std::vector<unsigned int> & hashesBefore, std::vector<unsigned int> & hashesAfter);
+void                            runChunksPipelined (CryptoFiles & files, OPERATION operation, unsigned int threadCount, std::vector<unsigned int> & hashesBefore, std::vector<unsigned int> & hashesAfter);
+void                            runMapped (std::string datafilename, KeyScheduleCache & keys, std::string outputname, OPERATION operation, const CryptoOptions & options, CryptoFiles & files, std::vector<unsigned int> & hashesBefore, std::vector<unsigned int> & hashesAfter);
+#ifndef _WIN32
+void                            mapInput (std::string filename, MappedFile & file, std::string description);
+void                            mapOutput (std::string filename, unsigned long long length, MappedFile & file);
+void                            processMappedChunk (const MappedJob & job, unsigned long long chunkIndex);
+InPlaceLayout                   inPlaceLayout (const JournalRecord & record);
+void                            readInPlaceBatch (int fd, unsigned long long offset, const InPlaceLayout & layout, const KeySchedule * schedule, unsigned long long first, unsigned long long count, std::vector<Chunk> & batch, CryptoStats * stats);
+void                            writeInPlaceBatch (int fd, const InPlaceLayout & layout, const JournalRecord & record, std::vector<Chunk> & batch, CryptoStats * stats);
+void                            walkTreeDirectory (TreeJob & job, std::string relative);
+void                            splitTreeFile (TreeJob & job, std::string relative, unsigned long long length);
+void                            runTreeSegment (TreeJob & job, std::shared_ptr<TreeFile> file, unsigned long long first, unsigned long long count);
+#endif
+void                            timePrint (double time1, double time2, unsigned long long dataSize);
 
+#ifndef WS_NO_MAIN      // Defined when binaryEncryption.cpp is built into the benchmark, which has its own main()
 int main(int argc, const char * argv[])
 {
+    // Arguments mean a non-interactive run - from a script or cron, no prompts.
+    if (argc > 1)
+        return commandLine(argc, argv);
+    
     std::cout << "WS Binary Encryption Utility\n\n";
     menu();
     
-    
-    // Example testing driver calls:
-    //testDriver ("/Users/William/Desktop/input.pdf", "/Users/William/Desktop/output.pdf", "/Users/William/Desktop/key.pdf", "/Users/William/Desktop/tempOutput");
-    //testDriver ("/Users/William/Desktop/input.mkv", "/Users/William/Desktop/output.mkv", "/Users/William/Desktop/key.mkv", "/Users/William/Desktop/tempOutput");
+    // Performance is measured with the benchmark build (benchmark.cpp, "make benchmark64"), not from here.
     
     return 0;
 }
+#endif
 
 void menu ()
 {
@@ -79,8 +302,12 @@ void menu ()
      1. Encryption
      2. Decryption
      3. Exit
+     4. Processing Mode
      
      Options 1 & 2 will ask for input, key, and output file paths.
+     Option 4 asks how many worker threads to encrypt/decrypt with, the chunk size to encrypt with, whether to pipeline
+     disk I/O with encryption, and whether to memory map the files.
+     These apply to every later selection.
      
      Will reprompt if file paths are invalid.
      */
@@ -93,14 +320,20 @@ void menu ()
     std::string keyfilepath;
     std::string outputfilepath;
     
+    CryptoOptions options;
+    
     // Menu Code - pretty much self documenting switch statements.
     int menuselection;
     while (true)
     {
         std::cout   << "Please make a selection:\n"
-        << "1. Encryption\n" << "2. Decryption\n" << "3. Exit\n" << "Selection #: ";
+        << "1. Encryption\n" << "2. Decryption\n" << "3. Exit\n" << "4. Processing Mode\n" << "Selection #: ";
         std::cin    >> menuselection;
         
+        // Input closed (piped in, or Ctrl-D) - nothing more will ever be selected.
+        if (std::cin.eof())
+            exit(0);
+        
         std::cin.ignore(); // Getline will read the last line return and not read in any data without an ignore.
         
         switch (menuselection)
@@ -119,17 +352,17 @@ void menu ()
                 std::cout   << std::endl;
                 try {
                     double t1 = time_in_seconds();
-                    int dataSize = encryption(inputfilepath, keyfilepath, outputfilepath);
+                    unsigned long long dataSize = encryption(inputfilepath, keyfilepath, outputfilepath, options);
                     double t2 = time_in_seconds();
                     
                     timePrint (t1, t2, dataSize);
                 }
                 
-                catch (std::runtime_error e) {
+                catch (const std::runtime_error & e) {
                     std::cout << "\n\n******\n" << e.what() << "\n******\n\n";
                 }
                 
-                catch (std::bad_alloc e) {
+                catch (const std::bad_alloc & e) {
                     std::cout << "\n\n******\n" << "Allocation Error - Sufficient memory might not be available.\n" << e.what() << "\n******\n\n";
                 }
                 
@@ -157,7 +390,7 @@ void menu ()
                 try
                 {
                     double t1 = time_in_seconds();
-                    std::pair<unsigned int,bool> decryptionPair = decryption(inputfilepath, keyfilepath, outputfilepath);
+                    std::pair<unsigned long long,bool> decryptionPair = decryption(inputfilepath, keyfilepath, outputfilepath, options);
                     double t2 = time_in_seconds();
                     
                     timePrint (t1, t2, decryptionPair.first);
@@ -168,11 +401,11 @@ void menu ()
                         std::cout << std::endl << "Unsuccessful decryption - checksum failed" << std::endl << std::endl;
                 }
                 
-                catch (std::runtime_error e) {
+                catch (const std::runtime_error & e) {
                     std::cout << "\n\n******\n" << e.what() << "\n******\n\n";
                 }
                 
-                catch (std::bad_alloc e) {
+                catch (const std::bad_alloc & e) {
                     std::cout << "\n\n******\n" << "Allocation Error - Sufficient memory might not be available.\n" << e.what() << "\n******\n\n";
                 }
                 
@@ -186,6 +419,44 @@ void menu ()
             {
                 exit(0);
             }
+                
+            case (4):
+            {
+                std::cout   << std::endl << "Number of worker threads (1 = serial, 0 = one per core). Currently " << options.threadCount << ":\n";
+                std::cin    >> options.threadCount;
+                
+                if (std::cin.fail())
+                {
+                    std::cin.clear();
+                    options.threadCount = 1;
+                }
+                std::cin.ignore();
+                
+                unsigned int chunkKilobytes;
+                std::cout   << std::endl << "Chunk size to encrypt with, in KB (decryption reads it from the file). Currently " << options.chunkSize/1024 << ":\n";
+                std::cin    >> chunkKilobytes;
+                
+                if (std::cin.fail() || chunkKilobytes == 0 || chunkKilobytes > MAX_CHUNK_SIZE/1024)
+                {
+                    std::cin.clear();
+                    chunkKilobytes = MAX_FILE_SIZE/1024;
+                }
+                options.chunkSize = chunkKilobytes * 1024;
+                std::cin.ignore();
+                
+                std::string answer;
+                std::cout   << std::endl << "Overlap disk reads/writes with encryption (pipelined)? (y/n). Currently " << (options.pipelined ? "y" : "n") << ":\n";
+                std::getline (std::cin, answer);
+                options.pipelined = (!answer.empty() && (answer[0] == 'y' || answer[0] == 'Y'));
+                
+                std::cout   << std::endl << "Memory map the files instead of reading/writing them in chunks? (y/n). Currently " << (options.mapped ? "y" : "n") << ":\n";
+                std::getline (std::cin, answer);
+                options.mapped = (!answer.empty() && (answer[0] == 'y' || answer[0] == 'Y'));
+                
+                std::cout   << std::endl;
+                break;
+            }
+                
             default:
             {
                 std::cout << "Please choose from the choices below:\n";
@@ -194,438 +465,3375 @@ void menu ()
     }
 }
 
-
-unsigned int encryption (std::string datafilename, std::string keyfilename, std::string outputname)
+int commandLine (int argc, const char * argv[])
 {
     /*
-     Reads in data and key from file paths passed in. Hashes data into checksum, 
-     Encrypts data+checksum and writes out to output path passed in.
+     Non-interactive interface. Usage:
      
-     Returns the size of the data file encrypted.
+        cryptoUtil enc    -k keyfile [options] input output
+        cryptoUtil dec    -k keyfile [options] input output
+        cryptoUtil verify -k keyfile [options] input
+        cryptoUtil enc|dec -k keyfile [options] --in-place file
+        cryptoUtil enc    -k keyfile [options] --update input encrypted
+        cryptoUtil enc|dec|verify -k keyfile [options] --batch manifest
+        cryptoUtil enc|dec -k keyfile [options] --tree inputdir outputdir
+        cryptoUtil verify -k keyfile [options] --tree inputdir
+        cryptoUtil rekey  oldkeyfile newkeyfile [options] input output
+        cryptoUtil rekey  oldkeyfile newkeyfile [options] --batch manifest
+        cryptoUtil serve --socket path -k [id=]keyfile ... [-c SIZE] [-j N]
      
-     Throws exception if filepaths cannot be opened.
+     Options:
+        -t N        Worker threads per file (same as Processing Mode - 1 = serial, 0 = one per core)
+        -c SIZE     Chunk size to encrypt with, in bytes or with a K, M or G suffix (64K, 64M). Decryption reads it from the file.
+        -p          Pipelined disk I/O
+        -m          Memory map the files
+        -j N        Batch & tree mode only - number of files processed at once (tree mode: worker threads, one per core by default)
+        --stop-on-bad   dec & verify only - stop at the first chunk that fails its checksum
+        --offset N  dec & verify only - start of the byte range of the plain data to decrypt (K, M or G suffix allowed)
+        --length N  dec & verify only - length of the range. Runs to the end of the data if left out.
+        --stats FILE    Write time spent per stage (key read, data read, cipher, write) and byte/chunk/checksum counts
+                        to FILE as JSON once every file is done, - for standard error. See ws-cryptoStats.h.
+        --in-place  enc & dec only - rewrite the file itself instead of writing a second one (see cryptInPlace()).
+                    An interrupted run is finished by running the same command again. A manifest lists just the files.
+        --digests   enc only - also write a digest of every chunk to output.wsdigest, so a later --update can skip reading the output.
+        --update    enc only - the output was encrypted from an older copy of the input. Only the chunks that changed are
+                    encrypted and written again (see updateEncryption()), and output.wsdigest is written for next time.
+        --tree      Every file under inputdir, into the same paths under outputdir, on a work stealing pool (see runTree()).
+        --compress  enc only - compress each chunk before it's encrypted (ws-lzCodec.h). Decryption sees it in the header.
+        --direct    Read & write with O_DIRECT, queued ahead through io_uring (or pread/pwrite threads), bypassing the page cache (ws-directIO.h).
+        --queue-depth N     --direct only - slabs in flight per file (default DEFAULT_QUEUE_DEPTH)
+        --no-uring  --direct only - use the pread/pwrite threads even if the kernel has io_uring
+        --crc       enc & rekey only - also write a CRC32C of every chunk as stored to output.wscrc, for scrub (ws-chunkCrc.h).
+     
+     serve runs the daemon instead (see serveCommand()), and scrub checks files against their chunk CRCs (see scrubCommand()).
+     
+     rekey moves encrypted files from one key to another in a single pass, checking their checksums on the way, without writing
+     the plain data anywhere (see rekeyEncryption()). It takes the options dec does, except -m, --in-place, --offset, --length & --tree,
+     and reports bad chunks the same way.
+     
+     verify decrypts without writing anything out, and only checks the checksums. Each chunk is checked against its own
+     checksum, and a failure lists the chunks that didn't match.
+     With --offset/--length, only the chunks holding that range are read, decrypted and checked (see decryptRange()).
+     
+     An input or output of - streams from standard input or to standard output, e.g.  tar c dir | cryptoUtil enc -k key - - | ssh ...
+     The length isn't needed in advance, and the status line goes to standard error so it can't mix with the data.
+     
+     The batch manifest has one file per line - "input<TAB>output", or just the input for verify. Blank lines
+     and lines starting with # are skipped. A manifest of - is read from standard input.
+     The key is loaded once and used for every file in the batch.
+     
+     Returns EXIT_OK if every file succeeded, EXIT_CHECKSUM_FAILED if any decryption/verification/rekey failed its checksum,
+     and EXIT_ERROR for bad arguments or any file that couldn't be processed.
      */
     
-    std::vector<unsigned int> data;
-    std::vector<unsigned int> key;
-    unsigned long long dataLength = 0;
-    unsigned long long keyLength = 0;
-    unsigned long long dataLeft = 0;
-    unsigned long long keyLeft = 0;
-    
-    // Data is broken into 4 byte chunks (ints, register size), last 4 byte chunk might contain less than 4 bytes of data.
-    // finalByteCount contains the number of bytes that contain data in the last 4 byte chunk
-    unsigned int finalByteCount = 0;
-    
-    std::fstream datafilestream;
-    std::fstream keyfilestream;
-    std::fstream outfilestream;
-    
-    // Input file & output file cannot be equal.
-    if (datafilename == outputname)
-        throw std::runtime_error ("INPUT FILE CANNOT EQUAL OUTPUT FILE");
-    
-    // Open key file
-    keyfilestream.open (keyfilename.c_str(), std::ios::in | std::ios::binary);
-    if (!keyfilestream.is_open())
-        throw (std::runtime_error("Could not open key file. Check that directory path is valid."));
+    std::string command = argv[1];
+    OPERATION operation;
     
-    // Open data file
-    datafilestream.open (datafilename.c_str(), std::ios::in | std::ios::binary);
-    if (!datafilestream.is_open())
-        throw (std::runtime_error("Could not open data file. Check that directory path is valid."));
+    if (command == "serve")
+        return serveCommand (argc, argv);
     
-    // Open output file
-    outfilestream.open (outputname.c_str(), std::ios::out | std::ios::binary);
-    if (!outfilestream.is_open())
-        throw (std::runtime_error("Could not open output file. Check that directory path is valid."));
+    if (command == "scrub")
+        return scrubCommand (argc, argv);
     
-    // Find length of key file
-    keyfilestream.seekg(0,std::ios::end);
-    keyLength = keyfilestream.tellg();
-    keyLength = (keyLength - keyLength%4); // Mod off the extra bits.
-    keyfilestream.clear();
-    keyfilestream.seekg(0, std::ios::beg);
+    bool verifyOnly = false;
+    bool rekeyMode = false;
     
-    keyLeft = keyLength;
-
-    // Find length of data file
-    datafilestream.seekg(0, std::ios::end);
-    dataLength = datafilestream.tellg();
-    datafilestream.clear();
-    datafilestream.seekg(0, std::ios::beg);
+    if (command == "enc")
+        operation = ENCRYPT;
+    else if (command == "dec")
+        operation = DECRYPT;
+    else if (command == "rekey")
+    {
+        operation = DECRYPT;
+        rekeyMode = true;
+    }
+    else if (command == "verify")
+    {
+        operation = DECRYPT;
+        verifyOnly = true;
+    }
+    else
+    {
+        printUsage();
+        return EXIT_ERROR;
+    }
     
-    dataLeft = dataLength;
+    std::string keyfilepath;
+    std::string manifestpath;
+    std::string statspath;
+    std::vector<std::string> files;
+    CryptoOptions options;
+    unsigned int jobCount = 1;
+    bool jobCountGiven = false;
+    bool treeMode = false;
     
-    while (!datafilestream.fail())
+    for (int i = 2; i < argc; i++)
     {
+        std::string argument = argv[i];
         
-        // Read in key - in MAX_FILE_SIZE pieces
+        if (argument == "-p")
+            options.pipelined = true;
         
-        if (keyLeft <= MAX_FILE_SIZE)
-        {
-            key.resize (keyLeft/4);
-            keyfilestream.read((char*)&key[0],keyLeft);
-            
-            // Reset stream for next loop
-            keyfilestream.clear();
-            keyfilestream.seekg(0, std::ios::beg);
-            keyLeft = keyLength;
-        }
+        else if (argument == "-m")
+            options.mapped = true;
         
-        else
-        {
-            key.resize (MAX_FILE_SIZE/4);
-            keyfilestream.read((char*)&key[0],MAX_FILE_SIZE);
-            keyLeft -= MAX_FILE_SIZE;
-        }
+        else if (argument == "--stop-on-bad" && operation == DECRYPT)
+            options.stopOnBadChunk = true;
         
-        // Read in data - in MAX_FILE_SIZE pieces
+        else if (argument == "--in-place" && !verifyOnly)
+            options.inPlace = true;
         
-        if (dataLeft <= MAX_FILE_SIZE-4)
-        {
-            // +1 is for hash, if mod ++ is in case division truncated dataLength
-            unsigned long long resizeAmmount = dataLeft/4 + 1;
-            if (dataLeft%4)
-                resizeAmmount++;
-            
-            data.resize (resizeAmmount);
-            
-            // Max file size read will go off end, setting fail bit, and preventing the loop from running again.
-            datafilestream.read((char*)&data[1], MAX_FILE_SIZE);
-            finalByteCount = dataLength % 4;
-            if (!finalByteCount)
-                finalByteCount = 4;
-        }
+        else if (argument == "--digests" && operation == ENCRYPT)
+            options.writeDigests = true;
         
-        else
-        {
-            data.resize (MAX_FILE_SIZE/4);
-            datafilestream.read((char*)&data[1],MAX_FILE_SIZE-4);
-        }
-                
-        // Compute Hash
-        unsigned int hash = hashingAlgorithm (&data[1], &data[data.size()]);
-        data[0] = hash;
+        else if (argument == "--update" && operation == ENCRYPT)
+            options.update = true;
+        
+        else if (argument == "--compress" && operation == ENCRYPT)
+            options.compress = true;
         
-        // Encrypt
-        // vector.begin() & vector.end() will work on some compilers, but iterators may be implemented as a class, which wouldn't be compatible with the assembly function.
-        encryptionAlgorithm (&data[0], &data[data.size()], &key[0], &key[key.size()], ENCRYPT);
+        else if (argument == "--crc" && (operation == ENCRYPT || rekeyMode))
+            options.writeCrcs = true;
         
-        // Write out to file
+        else if (argument == "--direct")
+            options.directIO = true;
         
-        if (dataLeft <= MAX_FILE_SIZE - 4)
+        else if (argument == "--no-uring")
+            options.directUring = false;
+        
+        else if (argument == "--tree")
+            treeMode = true;
+        
+        else if (argument == "-k" || argument == "-t" || argument == "-j" || argument == "-c" || argument == "--batch" || argument == "--offset" || argument == "--length" || argument == "--stats" || argument == "--queue-depth")
         {
-            data[data.size()-1] = (data[data.size()-1]<<(BIT_SHIFT_COUNT)) + (data[data.size()-1]>>(32 - BIT_SHIFT_COUNT));
-            outfilestream.write((char*)&data[0], dataLeft+4); // Adjust for checksum.
+            if (i + 1 == argc)
+            {
+                std::cerr << "Missing value for " << argument << "\n";
+                return EXIT_ERROR;
+            }
+            std::string value = argv[++i];
+            
+            if (argument == "-k")
+                keyfilepath = value;
+            else if (argument == "--batch")
+                manifestpath = value;
+            else if (argument == "--stats")
+                statspath = value;
+            else if (argument == "-c")
+            {
+                unsigned long long chunkSize;
+                if (!parseSize (value, chunkSize) || chunkSize > MAX_CHUNK_SIZE)
+                {
+                    std::cerr << "Expected a chunk size for -c, got " << value << "\n";
+                    return EXIT_ERROR;
+                }
+                options.chunkSize = chunkSize;
+            }
+            else if (argument == "--offset" || argument == "--length")
+            {
+                unsigned long long size;
+                if (operation != DECRYPT || !parseSize (value, size))
+                {
+                    std::cerr << "Expected a byte count for " << argument << " (decryption only), got " << value << "\n";
+                    return EXIT_ERROR;
+                }
+                
+                if (argument == "--offset")
+                    options.rangeOffset = size;
+                else
+                    options.rangeLength = size;
+            }
+            else
+            {
+                std::istringstream number (value);
+                unsigned int count;
+                if (!(number >> count) || !number.eof())
+                {
+                    std::cerr << "Expected a number for " << argument << ", got " << value << "\n";
+                    return EXIT_ERROR;
+                }
+                
+                if (argument == "-t")
+                    options.threadCount = count;
+                else if (argument == "--queue-depth")
+                {
+                    if (count == 0 || count > MAX_QUEUE_DEPTH)
+                    {
+                        std::cerr << "--queue-depth must be between 1 and " << MAX_QUEUE_DEPTH << "\n";
+                        return EXIT_ERROR;
+                    }
+                    options.queueDepth = count;
+                }
+                else
+                {
+                    jobCount = count;
+                    jobCountGiven = true;
+                }
+            }
         }
         
-        else
+        else if (argument.size() > 1 && argument[0] == '-')
         {
-            outfilestream.write ((char*)&data[0], MAX_FILE_SIZE);
-            dataLeft -= (MAX_FILE_SIZE - 4);
+            std::cerr << "Unknown option " << argument << "\n";
+            printUsage();
+            return EXIT_ERROR;
         }
         
-        // Doesn't clear memory/change capacity, but destructors for all items are called and size = 0. Means that pieces of data don't end up all over memory space, only one array of it.
-        data.clear();
+        else
+            files.push_back(argument);
     }
-
-    keyfilestream.close();
-    datafilestream.close();
-    outfilestream.close();
-
-    // Overwrite key from memory before it is unallocated.
-    for (unsigned int * iter = &(key[0]); iter != &(key[key.size()]); iter+=4)
+    
+    // rekey takes its two keys in front of the files, instead of -k.
+    std::string newkeyfilepath;
+    if (rekeyMode)
     {
-        *iter = 0xFFFFFFFF;
+        if (!keyfilepath.empty() || files.size() < 2)
+        {
+            printUsage();
+            return EXIT_ERROR;
+        }
+        keyfilepath = files[0];
+        newkeyfilepath = files[1];
+        files.erase (files.begin(), files.begin() + 2);
     }
     
-    return dataLength;
-}
-
-std::pair<unsigned int,bool> decryption (std::string datafilename, std::string keyfilename, std::string outputname)
-{
-    /*
-     Reads in encrypted data and key from file paths passed in. Decrypts encrypted data,
-     pulls out pre-encrypted checksum & computes checksum of now decrypted data.
-     Writes out decrypted data to output path.
-     
-     Returns pair of int & bool. Int is the size of the data read in, and the bool is based on the comparison of the checksums, to see if they're equal.
-     
-     Throws std::runtime_error exception if filepaths cannot be opened.
-     */
-    
-    std::vector<unsigned int> data;
-    std::vector<unsigned int> key;
-    std::vector<unsigned int> hashesBefore;
-    std::vector<unsigned int> hashesAfter;
-    unsigned long long dataLength = 0;
-    unsigned long long keyLength = 0;
-    unsigned long long dataLeft = 0;
-    unsigned long long keyLeft = 0;
-    bool checksum;
-    
-    // Data is broken into 4 byte chunks (ints, register size), last 4 byte chunk might contain less than 4 bytes of data.
-    // finalByteCount contains the number of bytes that contain data in the last 4 byte chunk
-    unsigned int finalByteCount = 0;
-    
-    std::fstream datafilestream;
-    std::fstream keyfilestream;
-    std::fstream outfilestream;
-    
-    // Input file cannot equal output file
-    if (datafilename == outputname)
-        throw (std::runtime_error("INPUT FILE CANNOT EQUAL OUTPUT FILE"));
+    unsigned int fileCount = (verifyOnly || options.inPlace) ? 1 : 2;
+    if (keyfilepath.empty() || (manifestpath.empty() ? files.size() != fileCount : !files.empty()))
+    {
+        printUsage();
+        return EXIT_ERROR;
+    }
     
-    // Open key file
-    keyfilestream.open (keyfilename.c_str(), std::ios::in | std::ios::binary);
-    if (!keyfilestream.is_open())
-        throw (std::runtime_error("Could not open key file. Check that directory path is valid."));
+    if (rekeyMode && (options.mapped || options.inPlace || options.rangeOffset != 0 || options.rangeLength != TO_END_OF_FILE || treeMode))
+    {
+        std::cerr << "rekey can't be combined with -m, --in-place, --offset, --length or --tree\n";
+        return EXIT_ERROR;
+    }
     
-    // Open data file
-    datafilestream.open (datafilename.c_str(), std::ios::in | std::ios::binary);
-    if (!datafilestream.is_open())
-        throw (std::runtime_error("Could not open data file. Check that directory path is valid."));
+    if (options.inPlace && (options.rangeOffset != 0 || options.rangeLength != TO_END_OF_FILE || options.mapped || options.pipelined))
+    {
+        std::cerr << "--in-place can't be combined with --offset, --length, -m or -p\n";
+        return EXIT_ERROR;
+    }
     
-    // Open output file
-    outfilestream.open (outputname.c_str(), std::ios::out | std::ios::binary);
-    if (!outfilestream.is_open())
-        throw (std::runtime_error("Could not open output file. Check that directory path is valid."));
+    if ((options.update && (options.inPlace || options.mapped || options.pipelined)) || (options.writeDigests && options.inPlace))
+    {
+        std::cerr << "--update can't be combined with --in-place, -m or -p, nor --digests with --in-place\n";
+        return EXIT_ERROR;
+    }
     
-    // Find length of key file
-    keyfilestream.seekg(0,std::ios::end);
-    keyLength = keyfilestream.tellg();
-    keyLength = (keyLength - keyLength%4); // Mod off the extra bits.
-    keyfilestream.clear();
-    keyfilestream.seekg(0, std::ios::beg);
+    if (options.compress && (options.inPlace || options.update || options.writeDigests || options.mapped))
+    {
+        std::cerr << "--compress can't be combined with --in-place, --update, --digests or -m\n";
+        return EXIT_ERROR;
+    }
     
-    keyLeft = keyLength;
+    if (options.writeCrcs && (options.inPlace || options.update || options.mapped || treeMode))
+    {
+        std::cerr << "--crc can't be combined with --in-place, --update, -m or --tree\n";
+        return EXIT_ERROR;
+    }
     
-    // Find length of data file
-    datafilestream.seekg(0, std::ios::end);
-    dataLength = datafilestream.tellg();
-    datafilestream.clear();
-    datafilestream.seekg(0, std::ios::beg);
+    if (options.directIO && (options.inPlace || options.update || options.mapped || options.rangeOffset != 0 || options.rangeLength != TO_END_OF_FILE || treeMode))
+    {
+        std::cerr << "--direct can't be combined with --in-place, --update, -m, --offset, --length or --tree\n";
+        return EXIT_ERROR;
+    }
     
-    dataLeft = dataLength;
+    if (treeMode && (!manifestpath.empty() || options.inPlace || options.update || options.writeDigests || options.mapped || options.pipelined
+                     || options.stopOnBadChunk || options.rangeOffset != 0 || options.rangeLength != TO_END_OF_FILE
+                     || isStandardStream(files[0]) || (fileCount == 2 && isStandardStream(files[1]))))
+    {
+        std::cerr << "--tree takes directories, and can't be combined with --batch, --in-place, --update, --digests, -m, -p, --stop-on-bad, --offset or --length\n";
+        return EXIT_ERROR;
+    }
     
-    while (!datafilestream.fail())
+    try
     {
+        checkChunkSize (options.chunkSize);
         
-        // Read in key - in MAX_FILE_SIZE pieces
-        
-        if (keyLeft <= MAX_FILE_SIZE)
-        {
-            key.resize (keyLeft/4);
-            keyfilestream.read((char*)&key[0],keyLeft);
-            
-            // Reset stream for next loop
-            keyfilestream.clear();
-            keyfilestream.seekg(0, std::ios::beg);
-            keyLeft = keyLength;
-        }
-        else
-        {
-            key.resize (MAX_FILE_SIZE/4);
-            keyfilestream.read((char*)&key[0],MAX_FILE_SIZE);
-            keyLeft -= MAX_FILE_SIZE;
-        }
-        
-        // Read in data - in MAX_FILE_SIZE pieces
-        if (dataLeft <= MAX_FILE_SIZE)
+        std::vector<BatchEntry> entries;
+        if (manifestpath.empty())
         {
-            // if mod ++ is in case division truncated dataLength
-            unsigned long long resizeAmmount = dataLeft/4;
-            if (dataLeft%4)
-                resizeAmmount++;
-            
-            data.resize (resizeAmmount);
-            
-            // Max file size + 1 read will go off end, setting fail bit, and preventing the loop from running again.
-            datafilestream.read((char*)&data[0], MAX_FILE_SIZE+1);
-            finalByteCount = dataLength % 4;
-            if (!finalByteCount)
-                finalByteCount = 4;
-            
-            // Shift last section back into original placement.
-            data[data.size()-1] = ((data[data.size()-1]>>(BIT_SHIFT_COUNT))+(data[data.size()-1]<<(32 - BIT_SHIFT_COUNT)));
-            
+            BatchEntry entry;
+            entry.input = files[0];
+            if (fileCount == 2)
+                entry.output = files[1];
+            entries.push_back(entry);
         }
-        
         else
-        {
-            data.resize (MAX_FILE_SIZE/4);
-            datafilestream.read((char*)&data[0],MAX_FILE_SIZE);
-        }
-    
-        // Decrypt
-        encryptionAlgorithm (&data[0], &data[data.size()], &key[0], &key[key.size()], DECRYPT);
+            entries = readManifest (manifestpath, verifyOnly || options.inPlace);
         
-        // Check hashes
-        hashesBefore.push_back(*(data.begin()));
+        // Streaming through standard input/output - the C stdio sync would slow every read & write, and stdout is taken by the data.
+        bool streaming = manifestpath.empty() && (isStandardStream(entries[0].input) || isStandardStream(entries[0].output));
+        if (streaming)
+            std::ios::sync_with_stdio(false);
         
-        data.erase(data.begin());
+        CryptoStats stats;
+        if (!statspath.empty())
+            options.stats = &stats;
         
-        // Removes unsignificant bits that were originally 0, but only if we hit end of file this round.
-        if (finalByteCount != 0)
-            (*(data.end()-1))=((*(data.end()-1))&(~(0xFFFFFFFF<<(8*finalByteCount))));
-        
-        hashesAfter.push_back(hashingAlgorithm (&data[0], &data[data.size()]));
-        
-        // Write out to file
-        
-        if (dataLeft <= MAX_FILE_SIZE)
+        std::unique_ptr<KeyScheduleCache> keys;
+        std::unique_ptr<KeyScheduleCache> newKeys;
         {
-            data[data.size()-1] = (data[data.size()-1]<<(BIT_SHIFT_COUNT)) + (data[data.size()-1]>>(32 - BIT_SHIFT_COUNT));
-            outfilestream.write((char*)&data[0], dataLeft - 4); // Adjust for checksum
+            StageTimer timer (options.stats, CryptoStats::KEY_READ);
+            keys.reset(new KeyScheduleCache(keyfilepath));
+            if (rekeyMode)
+                newKeys.reset(new KeyScheduleCache(newkeyfilepath));
         }
+        options.rekeyKeys = newKeys.get();
         
+        int status;
+        if (treeMode)
+            status = runTree (files[0], (fileCount == 2) ? files[1] : "", *keys, operation, options, jobCountGiven ? jobCount : 0, std::cout);
         else
-        {
-            outfilestream.write ((char*)&data[0], MAX_FILE_SIZE-4);
-            dataLeft -= (MAX_FILE_SIZE);
-        }
+            status = runBatch (entries, *keys, operation, options, jobCount, streaming ? std::cerr : std::cout);
         
-        if (datafilestream.fail())
+        if (statspath == "-")
+            stats.writeJson (std::cerr);
+        else if (!statspath.empty())
         {
-            // Overwrite data from memory before it is unallocated after the final loop.
-            for (unsigned int * iter = &(key[0]); iter != &(key[key.size()]); iter+=4)
+            std::ofstream statsfile (statspath.c_str());
+            stats.writeJson (statsfile);
+            if (!statsfile.flush())
             {
-                *iter = 0xFFFFFFFF;
+                std::cerr << "Could not write stats to " << statspath << "\n";
+                return EXIT_ERROR;
             }
         }
         
-        // Doesn't clear memory/change capacity, but destructors for all items are called and size = 0. Means that pieces of data don't end up all over memory space, only one array of it.
-        data.clear();
-        
+        return status;
     }
-
-    keyfilestream.close();
-    datafilestream.close();
-    outfilestream.close();
     
-    // Overwrite key from memory before it is unallocated.
-    for (unsigned int * iter = &(key[0]); iter != &(key[key.size()]); iter+=4)
-    {
-        *iter = 0xFFFFFFFF;
+    catch (const std::runtime_error & e) {
+        std::cerr << e.what() << "\n";
     }
     
-    unsigned int hashBefore = hashingAlgorithm(&hashesBefore[0],&hashesBefore[hashesBefore.size()]);
-    unsigned int hashAfter = hashingAlgorithm(&hashesAfter[0],&hashesAfter[hashesAfter.size()]);
-    
-    checksum = (hashBefore == hashAfter);
+    catch (const std::bad_alloc & e) {
+        std::cerr << "Allocation Error - Sufficient memory might not be available.\n" << e.what() << "\n";
+    }
     
-    return std::pair<unsigned int,bool>(dataLength,checksum);  // Return size of data & Return true if decryption matches the hash.
+    return EXIT_ERROR;
 }
 
-void timePrint (double time1, double time2, int dataSize)
+int serveCommand (int argc, const char * argv[])
 {
     /*
-     Calculates and prints to console the data speed of a given operation.
+     Runs the daemon (ws-cryptoDaemon.h) until it's sent SIGINT or SIGTERM. Usage:
      
-     time1 & time2 are the times before and after the operation.
-     dataSize is the size (in 4 byte chunks) of the data operated on.
+        cryptoUtil serve --socket path -k [id=]keyfile [-k [id=]keyfile ...] [-c SIZE] [-j N]
      
+     Each -k loads a key under its ID - a key given without one is "default".
+     -c is the chunk size encryption uses (decryption reads it from the data), and -j the number of connections served at once
+     (0, the default, for one per core).
+     
+     Returns EXIT_ERROR if the arguments are wrong or a key or the socket can't be set up, EXIT_OK once stopped.
      */
     
-    int byteCounter = 0;
+#ifdef _WIN32
+    std::cerr << "Daemon mode is not available on this platform.\n";
+    return EXIT_ERROR;
+#else
     
-    double bytesPerSecond = (dataSize * 4)/(time2-time1);
+    std::string socketpath;
+    std::vector<std::pair<std::string,std::string> > keyfiles;
+    unsigned long long chunkSize = MAX_FILE_SIZE;
+    unsigned int workerCount = 0;
     
-    if (bytesPerSecond > 1024)
+    for (int i = 2; i < argc; i++)
     {
-        byteCounter = KILOBYTES;
-        bytesPerSecond = bytesPerSecond / 1024;
+        std::string argument = argv[i];
+        if ((argument != "--socket" && argument != "-k" && argument != "-c" && argument != "-j") || i + 1 == argc)
+        {
+            printUsage();
+            return EXIT_ERROR;
+        }
+        std::string value = argv[++i];
+        
+        if (argument == "--socket")
+            socketpath = value;
+        else if (argument == "-k")
+        {
+            std::string::size_type equals = value.find('=');
+            if (equals == std::string::npos)
+                keyfiles.push_back(std::make_pair(std::string("default"), value));
+            else
+                keyfiles.push_back(std::make_pair(value.substr(0, equals), value.substr(equals + 1)));
+        }
+        else if (argument == "-c")
+        {
+            if (!parseSize (value, chunkSize) || chunkSize > MAX_CHUNK_SIZE)
+            {
+                std::cerr << "Expected a chunk size for -c, got " << value << "\n";
+                return EXIT_ERROR;
+            }
+        }
+        else
+        {
+            std::istringstream number (value);
+            if (!(number >> workerCount) || !number.eof())
+            {
+                std::cerr << "Expected a number for -j, got " << value << "\n";
+                return EXIT_ERROR;
+            }
+        }
     }
     
-    if (bytesPerSecond > 1024)
+    if (socketpath.empty() || keyfiles.empty())
     {
-        byteCounter = MEGABYTES;
-        bytesPerSecond = bytesPerSecond / 1024;
+        printUsage();
+        return EXIT_ERROR;
     }
     
-    if (bytesPerSecond > 1024)
+    try
     {
-        byteCounter = GIGABYTES;
-        bytesPerSecond = bytesPerSecond / 1024;
+        CryptoDaemon daemon (socketpath, chunkSize, workerCount);
+        for (unsigned int i = 0; i < keyfiles.size(); i++)
+            daemon.addKey (keyfiles[i].first, keyfiles[i].second);
+        
+        std::cerr << "Serving " << keyfiles.size() << " key" << (keyfiles.size() > 1 ? "s" : "") << " on " << socketpath
+                  << " with " << daemon.workers() << " worker" << (daemon.workers() > 1 ? "s" : "") << "\n";
+        daemon.serve();
+        return EXIT_OK;
     }
     
-    std::string byteUnits;
-    switch (byteCounter)
-    {
-        case (BYTES):
-            byteUnits = "B/s";
-            break;
-        case (KILOBYTES):
-            byteUnits = "KB/s";
-            break;
-        case (MEGABYTES):
-            byteUnits = "MB/s";
-            break;
-        default: 
-            byteUnits = "GB/s";
+    catch (const std::runtime_error & e) {
+        std::cerr << e.what() << "\n";
     }
     
-    std::cout << "\n Processed at an average rate of: " << bytesPerSecond << " " << byteUnits << std::endl << std::endl;
+    catch (const std::bad_alloc & e) {
+        std::cerr << "Allocation Error - Sufficient memory might not be available.\n" << e.what() << "\n";
+    }
     
+    return EXIT_ERROR;
+#endif
 }
 
-void testDriver (std::string datafilename, std::string outputfilename, std::string keyfilename, std::string tempOutputname)
+int scrubCommand (int argc, const char * argv[])
 {
     /*
-         Test Function for use when application features/implementation is being worked on.
-         Uses much of the menu code for performance measuring and error handling.
-         Performs encryption and subsequent decryption of specified input.
-         
+     Checks encrypted files against the chunk CRCs written with --crc (see scrubFile()), and optionally repairs them. Usage:
+     
+        cryptoUtil scrub [-j N] [--repair copy] file ...
+     
+     No key is needed. -j is the number of threads each file is checked on (0, the default, for one per core).
+     --repair takes another copy of the one file being scrubbed - an older backup, a replica - and copies every damaged chunk
+     back in from it, if the copy's chunk still matches the CRC.
+     
+     Prints a line per file like a batch run - "OK", "REPAIRED" (every damaged chunk was copied back in), "FAILED" with the
+     chunks that are still damaged, or "ERROR" if the file couldn't be scrubbed at all, e.g. its sidecar is missing or out of date.
+     
+     Returns EXIT_OK if every file is intact or was repaired, EXIT_CHECKSUM_FAILED if any is still damaged, and EXIT_ERROR for
+     bad arguments or any file that couldn't be scrubbed.
      */
-
-    // Encryption
-    std::cout   << std::endl;
-    try {
-        double t1 = time_in_seconds();
-        int dataSize = encryption(datafilename, keyfilename, tempOutputname);
-        double t2 = time_in_seconds();
-        std::cout << "\nEncryption: ";
-        timePrint (t1, t2, dataSize);
-    }
-    
-    catch (std::runtime_error e) {
-        std::cout << "\n\n******\n" << e.what() << "\n******\n\n";
-    }
     
-    catch (std::bad_alloc e) {
-        std::cout << "\n\n******\n" << "Allocation Error - Sufficient memory might not be available.\n" << e.what() << "\n******\n\n";
-    }
+    std::string copyname;
+    std::vector<std::string> files;
+    unsigned int workerCount = 0;
     
-    catch (...) {
-        std::cout << "\n\n******\n" << "Unspecified Exception Caught: Restarting Menu" << "\n******\n\n";
-    }
-
-
-    // Decryption
-    try
+    for (int i = 2; i < argc; i++)
     {
-        double t1 = time_in_seconds();
-        std::pair<unsigned int,bool> decryptionPair = decryption(tempOutputname, keyfilename, outputfilename);
-        double t2 = time_in_seconds();
-        std::cout << "\nDecryption: ";
-        timePrint (t1, t2, decryptionPair.first);
-        
-        if (decryptionPair.second)
-            std::cout << std::endl << "Successfully decrypted - checksum matched" << std::endl << std::endl;
-        else
-            std::cout << std::endl << "Unsuccessful decryption - checksum failed" << std::endl << std::endl;
+        std::string argument = argv[i];
+        if (argument == "-j" || argument == "--repair")
+        {
+            if (i + 1 == argc)
+            {
+                std::cerr << "Missing value for " << argument << "\n";
+                return EXIT_ERROR;
+            }
+            std::string value = argv[++i];
+            
+            if (argument == "--repair")
+                copyname = value;
+            else
+            {
+                std::istringstream number (value);
+                if (!(number >> workerCount) || !number.eof())
+                {
+                    std::cerr << "Expected a number for -j, got " << value << "\n";
+                    return EXIT_ERROR;
+                }
+            }
+        }
+        else if (argument.size() > 1 && argument[0] == '-')
+        {
+            std::cerr << "Unknown option " << argument << "\n";
+            printUsage();
+            return EXIT_ERROR;
+        }
+        else
+            files.push_back(argument);
+    }
+    
+    if (files.empty() || (!copyname.empty() && files.size() != 1))
+    {
+        printUsage();
+        return EXIT_ERROR;
+    }
+    
+    BatchResults results (std::cout);
+    for (unsigned long long i = 0; i < files.size(); i++)
+    {
+        std::string result = "OK";
+        std::string reason;
+        try
+        {
+            ScrubReport scrub = scrubFile (files[i], copyname, workerCount);
+            
+            // What's still damaged is reported the way a failed verify is, so the chunk numbers read the same.
+            ChecksumReport remaining;
+            std::set_difference (scrub.badChunks.begin(), scrub.badChunks.end(), scrub.repairedChunks.begin(), scrub.repairedChunks.end(),
+                                 std::back_inserter(remaining.badChunks));
+            bool headerBad = scrub.headerDamaged && !scrub.headerRepaired;
+            
+            std::ostringstream summary;
+            if (!remaining.badChunks.empty() || headerBad)
+            {
+                result = "FAILED";
+                summary << describeFailure (remaining);
+                if (headerBad)
+                    summary << (remaining.badChunks.empty() ? "" : ", ") << "header damaged";
+                if (!scrub.repairedChunks.empty() || scrub.headerRepaired)
+                    summary << " (" << scrub.repairedChunks.size() + scrub.headerRepaired << " repaired from the copy)";
+            }
+            else if (!scrub.badChunks.empty() || scrub.headerDamaged)
+            {
+                result = "REPAIRED";
+                summary << scrub.repairedChunks.size() << " of " << scrub.chunkCount << " chunks" << (scrub.headerRepaired ? " & the header" : "")
+                        << " copied back in from " << copyname;
+            }
+            reason = summary.str();
+        }
+        
+        catch (const std::runtime_error & e) {
+            result = "ERROR";
+            reason = e.what();
+        }
+        
+        catch (const std::bad_alloc & e) {
+            result = "ERROR";
+            reason = "Allocation Error - Sufficient memory might not be available.";
+        }
+        
+        results.add (files[i], result, reason);
+    }
+    
+    return results.exitStatus();
+}
+
+void printUsage ()
+{
+    std::cerr   << "Usage:\n"
+                << "  cryptoUtil enc    -k keyfile [options] input output\n"
+                << "  cryptoUtil dec    -k keyfile [options] input output\n"
+                << "  cryptoUtil verify -k keyfile [options] input\n"
+                << "  cryptoUtil enc|dec -k keyfile [options] --in-place file\n"
+                << "  cryptoUtil enc    -k keyfile [options] --update input encrypted\n"
+                << "  cryptoUtil enc|dec|verify -k keyfile [options] --batch manifest\n"
+                << "  cryptoUtil enc|dec -k keyfile [options] --tree inputdir outputdir\n"
+                << "  cryptoUtil verify -k keyfile [options] --tree inputdir\n"
+                << "  cryptoUtil rekey  oldkeyfile newkeyfile [options] input output\n"
+                << "  cryptoUtil rekey  oldkeyfile newkeyfile [options] --batch manifest\n"
+                << "  cryptoUtil serve --socket path -k [id=]keyfile ... [-c N] [-j N]\n"
+                << "  cryptoUtil scrub  [-j N] [--repair copy] file ...\n"
+                << "Options:\n"
+                << "  -t N   worker threads per file (1 = serial, 0 = one per core)\n"
+                << "  -c N   chunk size to encrypt with - bytes, or with a K, M or G suffix\n"
+                << "  -p     pipelined disk I/O\n"
+                << "  -m     memory map the files\n"
+                << "  -j N   files processed at once in batch mode, worker threads in tree mode\n"
+                << "  --offset N --length N   dec/verify only that byte range of the plain data\n"
+                << "  --stop-on-bad           dec/verify stop at the first chunk that fails its checksum\n"
+                << "  --stats FILE            write per-stage timings & counts as JSON (- for standard error)\n"
+                << "  --in-place              enc/dec rewrite the file itself - run again to finish an interrupted run\n"
+                << "  --digests               enc also write chunk digests to output.wsdigest, for --update\n"
+                << "  --update                enc re-encrypt only the chunks of input that changed since output was written\n"
+                << "  --compress              enc compress each chunk before encrypting it\n"
+                << "  --direct                O_DIRECT I/O queued through io_uring, bypassing the page cache\n"
+                << "  --queue-depth N         slabs in flight per file with --direct (default 8)\n"
+                << "  --no-uring              --direct with pread/pwrite threads instead of io_uring\n"
+                << "  --crc                   enc/rekey also write chunk CRCs to output.wscrc, for scrub\n"
+                << "Run with no arguments for the interactive menu.\n";
+}
+
+bool parseSize (std::string text, unsigned long long & size)
+{
+    // Reads a byte count like 65536, 64K, 64M or 1G. Returns false if text isn't one, or it's too big for 64 bits.
+    // It has to start with a digit - the stream would read "-5" into an unsigned number as 2^64 - 5.
+    if (text.empty() || text[0] < '0' || text[0] > '9')
+        return false;
+    
+    std::istringstream number (text);
+    char suffix = 0;
+    if (!(number >> size))
+        return false;
+    
+    if (number >> suffix)
+    {
+        unsigned long long multiplier;
+        if (suffix == 'k' || suffix == 'K')
+            multiplier = 1024;
+        else if (suffix == 'm' || suffix == 'M')
+            multiplier = 1024 * 1024;
+        else if (suffix == 'g' || suffix == 'G')
+            multiplier = 1024 * 1024 * 1024;
+        else
+            return false;
+        
+        if (size > 0xFFFFFFFFFFFFFFFFULL / multiplier)
+            return false;
+        size *= multiplier;
+    }
+    
+    return number.peek() == EOF;
+}
+
+std::string describeFailure (const ChecksumReport & report)
+{
+    // Reason a decryption failed, for the status line - which chunks, and whether the length was wrong.
+    const unsigned int LISTED_CHUNKS = 20;
+    std::ostringstream reason;
+    
+    if (!report.badChunks.empty())
+    {
+        reason << "bad chunk" << (report.badChunks.size() > 1 ? "s" : "");
+        for (unsigned long long i = 0; i < report.badChunks.size() && i < LISTED_CHUNKS; i++)
+            reason << " " << report.badChunks[i];
+        if (report.badChunks.size() > LISTED_CHUNKS)
+            reason << " and " << report.badChunks.size() - LISTED_CHUNKS << " more";
+        if (report.stoppedEarly)
+            reason << " (stopped at the first)";
+    }
+    
+    if (!report.lengthMatches)
+        reason << (report.badChunks.empty() ? "" : ", ") << "length doesn't match header - chunks missing from the end";
+    
+    return reason.str();
+}
+
+std::vector<BatchEntry> readManifest (std::string manifestname, bool inputOnly)
+{
+    /*
+     Reads the list of files for batch mode. Each line is "input<TAB>output", or just the input when verifying or working in place (inputOnly).
+     
+     Throws std::runtime_error if the manifest can't be opened, a line is missing its output, or it lists no files at all.
+     */
+    
+    std::ifstream manifestfile;
+    if (manifestname != "-")
+    {
+        manifestfile.open (manifestname.c_str());
+        if (!manifestfile.is_open())
+            throw (std::runtime_error("Could not open batch manifest. Check that directory path is valid."));
+    }
+    std::istream & manifest = (manifestname == "-") ? std::cin : manifestfile;
+    
+    std::vector<BatchEntry> entries;
+    std::string line;
+    unsigned long long lineNumber = 0;
+    while (std::getline (manifest, line))
+    {
+        lineNumber++;
+        
+        // Tolerate manifests written on Windows.
+        if (!line.empty() && line[line.size()-1] == '\r')
+            line.erase(line.size()-1);
+        
+        if (line.empty() || line[0] == '#')
+            continue;
+        
+        BatchEntry entry;
+        std::string::size_type tab = line.find('\t');
+        entry.input = line.substr(0, tab);
+        if (tab != std::string::npos)
+            entry.output = line.substr(tab + 1);
+        
+        if (!inputOnly && entry.output.empty())
+        {
+            std::ostringstream message;
+            message << "Batch manifest line " << lineNumber << " has no output file - expected input<TAB>output.";
+            throw (std::runtime_error(message.str()));
+        }
+        if (inputOnly)
+            entry.output.clear();
+        
+        if (isStandardStream(entry.input) || isStandardStream(entry.output))
+        {
+            std::ostringstream message;
+            message << "Batch manifest line " << lineNumber << " uses - - standard input/output can only be used for a single file.";
+            throw (std::runtime_error(message.str()));
+        }
+        
+        entries.push_back(entry);
+    }
+    
+    if (entries.empty())
+        throw (std::runtime_error("Batch manifest lists no files."));
+    
+    return entries;
+}
+
+int runBatch (const std::vector<BatchEntry> & entries, KeyScheduleCache & keys, OPERATION operation, const CryptoOptions & options, unsigned int jobCount, std::ostream & report)
+{
+    /*
+     Encrypts, decrypts or verifies every entry with the one key, jobCount files at a time.
+     Prints one line per file to report as it finishes (see runEntry()).
+     
+     Returns the EXIT_STATUS for the whole batch.
+     */
+    
+    BatchResults results (report);
+    
+    if (jobCount == 0)
+        jobCount = std::thread::hardware_concurrency();
+    
+    if (jobCount > 1 && entries.size() > 1)
+    {
+        ThreadPool pool(jobCount);
+        for (unsigned long long i = 0; i < entries.size(); i++)
+        {
+            const BatchEntry * entry = &entries[i];
+            pool.submit([entry, &keys, operation, &options, &results] { runEntry(*entry, keys, operation, options, results); });
+        }
+        pool.wait();
+    }
+    else
+    {
+        for (unsigned long long i = 0; i < entries.size(); i++)
+            runEntry (entries[i], keys, operation, options, results);
+    }
+    
+    return results.exitStatus();
+}
+
+void runEntry (const BatchEntry & entry, KeyScheduleCache & keys, OPERATION operation, const CryptoOptions & options, BatchResults & results)
+{
+    /*
+     Encrypts, decrypts, verifies or rekeys one file of a batch or tree run, and reports it - "OK", "FAILED" (checksum didn't match) or "ERROR",
+     a tab, then the input path, and for failures & errors another tab and the reason. An update's OK line gets another tab and how many
+     chunks it rewrote. Never throws - whatever goes wrong is that file's ERROR line.
+     */
+    
+    std::string result = "OK";
+    std::string reason;
+    try
+    {
+        if (operation == ENCRYPT && options.update)
+        {
+            UpdateReport update = updateEncryption (entry.input, keys, entry.output, options);
+            std::ostringstream summary;
+            summary << update.chunksWritten << " of " << update.chunkCount << " chunks rewritten";
+            if (!update.usedDigests)
+                summary << " (no digest file - compared by decrypting)";
+            reason = summary.str();
+        }
+        else if (operation == ENCRYPT)
+            encryption (entry.input, keys, entry.output, options);
+        else
+        {
+            ChecksumReport checksums = options.rekeyKeys ? rekeyEncryption (entry.input, keys, *options.rekeyKeys, entry.output, options)
+                                                         : decryptionReport (entry.input, keys, entry.output, options);
+            if (!checksums.passed())
+            {
+                result = "FAILED";
+                reason = describeFailure (checksums);
+            }
+        }
     }
     
-    catch (std::runtime_error e) {
-        std::cout << "\n\n******\n" << e.what() << "\n******\n\n";
+    catch (const std::runtime_error & e) {
+        result = "ERROR";
+        reason = e.what();
     }
     
-    catch (std::bad_alloc e) {
-        std::cout << "\n\n******\n" << "Allocation Error - Sufficient memory might not be available.\n" << e.what() << "\n******\n\n";
+    catch (const std::bad_alloc & e) {
+        result = "ERROR";
+        reason = "Allocation Error - Sufficient memory might not be available.";
     }
     
     catch (...) {
-        std::cout << "\n\n******\n" << "Unspecified Exception Caught: Restarting Menu" << "\n******\n\n";
+        result = "ERROR";
+        reason = "Unspecified Exception Caught";
+    }
+    
+    results.add (entry.input, result, reason);
+}
+
+std::string treePath (std::string root, std::string relative)
+{
+    // Path of a file in a tree run, from its path relative to the tree's root.
+    return relative.empty() ? root : root + "/" + relative;
+}
+
+int runTree (std::string inputRoot, std::string outputRoot, KeyScheduleCache & keys, OPERATION operation, const CryptoOptions & options, unsigned int workerCount, std::ostream & report)
+{
+    /*
+     Encrypts, decrypts or verifies every file under the directory inputRoot into the same path under outputRoot (created as needed),
+     with the one key. outputRoot is empty when only verifying.
+     
+     Everything runs on a work stealing pool of workerCount threads (0 = one per core). Each directory is a task that queues its
+     subdirectories, its small files in batches (TREE_BATCH_FILES or TREE_BATCH_BYTES to a task, so millions of tiny files don't cost a
+     task each), and its big files split into segments of chunks (TREE_SEGMENT_BYTES to a task, see splitTreeFile()), so a 100GB file is
+     spread over every worker instead of holding one up while the others sit idle. A worker that runs out takes the oldest task queued
+     by another. Every file's output is exactly what encrypting/decrypting it on its own would give.
+     
+     Prints one line per file as it finishes, the same as runBatch() - plus SKIPPED for symbolic links and anything else that isn't a
+     file or directory, which doesn't count against the exit status. Returns the EXIT_STATUS for the whole tree.
+     
+     Throws std::runtime_error if inputRoot isn't a directory or outputRoot can't be created. Linux & Mac only.
+     */
+    
+#ifdef _WIN32
+    throw (std::runtime_error("Directory tree mode is not available on this platform."));
+#else
+    
+    struct stat inputStats;
+    if (stat (inputRoot.c_str(), &inputStats) != 0 || !S_ISDIR(inputStats.st_mode))
+        throw (std::runtime_error("Could not open input directory " + inputRoot + "."));
+    
+    TreeJob job;
+    job.operation = operation;
+    job.keys = &keys;
+    job.options = options;
+    job.options.threadCount = 1;
+    job.inputRoot = inputRoot;
+    job.outputRoot = outputRoot;
+    job.outputDevice = 0;
+    job.outputInode = 0;
+    
+    if (!outputRoot.empty())
+    {
+        struct stat outputStats;
+        if ((mkdir (outputRoot.c_str(), 0777) != 0 && errno != EEXIST) || stat (outputRoot.c_str(), &outputStats) != 0 || !S_ISDIR(outputStats.st_mode))
+            throw (std::runtime_error("Could not create output directory " + outputRoot + "."));
+        if (outputStats.st_dev == inputStats.st_dev && outputStats.st_ino == inputStats.st_ino)
+            throw (std::runtime_error("INPUT DIRECTORY CANNOT EQUAL OUTPUT DIRECTORY"));
+        
+        // An output tree inside the input tree would otherwise be walked into as it's written.
+        job.outputDevice = outputStats.st_dev;
+        job.outputInode = outputStats.st_ino;
     }
-}
\ No newline at end of file
+    
+    if (workerCount == 0)
+        workerCount = std::thread::hardware_concurrency();
+    
+    BatchResults results (report);
+    WorkStealingPool pool (workerCount);
+    job.pool = &pool;
+    job.results = &results;
+    
+    TreeJob * jobPointer = &job;
+    pool.submit([jobPointer] { walkTreeDirectory(*jobPointer, ""); });
+    pool.wait();
+    
+    return results.exitStatus();
+#endif
+}
+
+#ifndef _WIN32
+
+void walkTreeDirectory (TreeJob & job, std::string relative)
+{
+    /*
+     One directory of the tree (relative to its root - empty for the root itself): creates its output directory, then queues a task
+     for each subdirectory, for each batch of small files, and for each segment of each big file.
+     A directory that can't be read is reported as an ERROR line, and the rest of the tree carries on.
+     */
+    
+    std::string inputPath = treePath (job.inputRoot, relative);
+    TreeJob * jobPointer = &job;
+    
+    try
+    {
+        if (!job.outputRoot.empty() && !relative.empty() && mkdir (treePath(job.outputRoot, relative).c_str(), 0777) != 0 && errno != EEXIST)
+            throw (std::runtime_error("Could not create output directory " + treePath(job.outputRoot, relative) + "."));
+        
+        DIR * directory = opendir (inputPath.c_str());
+        if (directory == NULL)
+            throw (std::runtime_error("Could not open directory."));
+        std::unique_ptr<DIR, int (*)(DIR *)> closer (directory, closedir);
+        
+        std::vector<BatchEntry> batch;
+        unsigned long long batchBytes = 0;
+        auto queueBatch = [&] ()
+        {
+            if (batch.empty())
+                return;
+            
+            std::vector<BatchEntry> files;
+            files.swap (batch);
+            batchBytes = 0;
+            job.pool->submit([jobPointer, files]
+            {
+                for (unsigned long long i = 0; i < files.size(); i++)
+                    runEntry (files[i], *jobPointer->keys, jobPointer->operation, jobPointer->options, *jobPointer->results);
+            });
+        };
+        
+        while (struct dirent * entry = readdir (directory))
+        {
+            std::string name = entry->d_name;
+            if (name == "." || name == "..")
+                continue;
+            
+            std::string child = relative.empty() ? name : relative + "/" + name;
+            struct stat entryStats;
+            if (fstatat (dirfd(directory), name.c_str(), &entryStats, AT_SYMLINK_NOFOLLOW) != 0)
+            {
+                job.results->add (treePath(job.inputRoot, child), "ERROR", "Could not read file's details.");
+                continue;
+            }
+            
+            if (S_ISDIR(entryStats.st_mode))
+            {
+                if (entryStats.st_dev != job.outputDevice || entryStats.st_ino != job.outputInode)
+                    job.pool->submit([jobPointer, child] { walkTreeDirectory(*jobPointer, child); });
+            }
+            else if (S_ISREG(entryStats.st_mode) && (unsigned long long)entryStats.st_size > TREE_SEGMENT_BYTES && !job.options.compress)
+                splitTreeFile (job, child, entryStats.st_size);
+            else if (S_ISREG(entryStats.st_mode))
+            {
+                BatchEntry file;
+                file.input = treePath (job.inputRoot, child);
+                if (!job.outputRoot.empty())
+                    file.output = treePath (job.outputRoot, child);
+                batch.push_back (file);
+                
+                batchBytes += entryStats.st_size;
+                if (batch.size() >= TREE_BATCH_FILES || batchBytes >= TREE_BATCH_BYTES)
+                    queueBatch();
+            }
+            else
+                job.results->add (treePath(job.inputRoot, child), "SKIPPED", "not a regular file or directory");
+        }
+        
+        queueBatch();
+    }
+    
+    catch (const std::runtime_error & e) {
+        job.results->add (inputPath, "ERROR", e.what());
+    }
+    
+    catch (const std::bad_alloc & e) {
+        job.results->add (inputPath, "ERROR", "Allocation Error - Sufficient memory might not be available.");
+    }
+}
+
+void splitTreeFile (TreeJob & job, std::string relative, unsigned long long length)
+{
+    /*
+     Sets a big file up to be encrypted/decrypted by many tasks at once, TREE_SEGMENT_BYTES of chunks each (runTreeSegment()).
+     The layout is the same as in place - every chunk's place in the input and output is known from the chunk size & length alone -
+     so the output is sized up front and every segment writes its chunks straight to where they belong.
+     A compressed file has no such layout, and is decrypted by a single task instead.
+     A file that can't be set up is reported as an ERROR line.
+     */
+    
+    std::shared_ptr<TreeFile> file (new TreeFile());
+    file->input = treePath (job.inputRoot, relative);
+    
+    try
+    {
+        file->inputFile.fd = open (file->input.c_str(), O_RDONLY);
+        if (file->inputFile.fd < 0)
+            throw (std::runtime_error("Could not open data file. Check that directory path is valid."));
+        
+        JournalRecord record;       // Only describes the layout - nothing is journaled
+        record.operation = job.operation;
+        record.inputLength = length;
+        
+        if (job.operation == ENCRYPT)
+        {
+            checkChunkSize (job.options.chunkSize);
+            file->header.chunkSize = job.options.chunkSize;
+            setOriginalLength (file->header, length);
+            encodeHeader (file->header, record.fileHeader);
+        }
+        else
+        {
+            StageTimer timer (job.options.stats, CryptoStats::DATA_READ);
+            readAt (file->inputFile.fd, record.fileHeader, HEADER_SIZE, 0);
+            if (!decodeHeader (record.fileHeader, file->header))
+                file->header = legacyHeader();
+        }
+        
+        // A compressed file's chunks vary in length, so it can't be split - it's one task, like a small file.
+        if (isCompressed(file->header))
+        {
+            BatchEntry entry;
+            entry.input = file->input;
+            if (!job.outputRoot.empty())
+                entry.output = treePath (job.outputRoot, relative);
+            
+            TreeJob * jobPointer = &job;
+            job.pool->submit([jobPointer, entry] { runEntry (entry, *jobPointer->keys, jobPointer->operation, jobPointer->options, *jobPointer->results); });
+            return;
+        }
+        
+        record.chunkSize = file->header.chunkSize;
+        file->layout = inPlaceLayout (record);
+        file->schedule = loadSchedule (*job.keys, record.chunkSize, job.options.stats);
+        
+        if (!job.outputRoot.empty())
+        {
+            StageTimer timer (job.options.stats, CryptoStats::WRITE);
+            std::string outputPath = treePath (job.outputRoot, relative);
+            file->outputFile.fd = open (outputPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            if (file->outputFile.fd < 0)
+                throw (std::runtime_error("Could not open output file. Check that directory path is valid."));
+            if (ftruncate (file->outputFile.fd, file->layout.outputLength) != 0)
+                throw (std::runtime_error("Could not size output file. Check that the volume has enough free space."));
+            if (job.operation == ENCRYPT)
+                writeAt (file->outputFile.fd, record.fileHeader, HEADER_SIZE, 0);
+        }
+    }
+    
+    catch (const std::runtime_error & e) {
+        job.results->add (file->input, "ERROR", e.what());
+        return;
+    }
+    
+    unsigned long long segmentChunks = std::max (1ULL, TREE_SEGMENT_BYTES / file->layout.chunkSize);
+    file->segmentsLeft = (file->layout.chunkCount + segmentChunks - 1) / segmentChunks;
+    
+    TreeJob * jobPointer = &job;
+    for (unsigned long long first = 0; first < file->layout.chunkCount; first += segmentChunks)
+    {
+        unsigned long long count = std::min (segmentChunks, file->layout.chunkCount - first);
+        job.pool->submit([jobPointer, file, first, count] { runTreeSegment(*jobPointer, file, first, count); });
+    }
+}
+
+void runTreeSegment (TreeJob & job, std::shared_ptr<TreeFile> file, unsigned long long first, unsigned long long count)
+{
+    /*
+     Encrypts/decrypts chunks [first, first + count) of a file set up by splitTreeFile(), one chunk at a time.
+     The last segment of the file to finish reports it - OK, FAILED with its bad chunks, or the first error any segment hit.
+     */
+    
+    const InPlaceLayout & layout = file->layout;
+    CryptoStats * stats = job.options.stats;
+    
+    try
+    {
+        SecureArena arena (layout.chunkSize, 1);
+        std::vector<Chunk> chunk(1);
+        chunk[0].data.attach (arena, 0);
+        
+        for (unsigned long long index = first; index < first + count; index++)
+        {
+            readInPlaceBatch (file->inputFile.fd, layout.inputStart + index * layout.inputStride, layout, file->schedule, index, 1, chunk, stats);
+            processChunkTimed (chunk[0], job.operation, stats, false, false, false);
+            
+            if (job.operation == DECRYPT && chunk[0].hashBefore != chunk[0].hashAfter)
+            {
+                std::lock_guard<std::mutex> lock(file->mutex);
+                file->badChunks.push_back(index);
+            }
+            
+            if (file->outputFile.fd >= 0)
+            {
+                StageTimer timer (stats, CryptoStats::WRITE);
+                writeAt (file->outputFile.fd, chunk[0].data.data() + chunk[0].writeOffset, chunk[0].writeSize, layout.outputStart + index * layout.outputStride);
+                if (stats)
+                    stats->addBytesWritten(chunk[0].writeSize);
+            }
+        }
+    }
+    
+    catch (const std::runtime_error & e) {
+        std::lock_guard<std::mutex> lock(file->mutex);
+        if (file->error.empty())
+            file->error = e.what();
+    }
+    
+    catch (const std::bad_alloc & e) {
+        std::lock_guard<std::mutex> lock(file->mutex);
+        if (file->error.empty())
+            file->error = "Allocation Error - Sufficient memory might not be available.";
+    }
+    
+    if (--file->segmentsLeft != 0)
+        return;
+    
+    // Last segment - every other one is done, so nothing else touches the file now.
+    std::string result = "OK";
+    std::string reason;
+    if (!file->error.empty())
+    {
+        result = "ERROR";
+        reason = file->error;
+    }
+    else if (job.operation == DECRYPT)
+    {
+        ChecksumReport report;
+        report.badChunks.swap (file->badChunks);
+        std::sort (report.badChunks.begin(), report.badChunks.end());
+        report.lengthMatches = (file->header.originalLength == UNKNOWN_LENGTH || file->header.originalLength == layout.outputLength);
+        if (!report.passed())
+        {
+            result = "FAILED";
+            reason = describeFailure (report);
+        }
+        
+        if (stats)
+            stats->addChecksumFailures(report.badChunks.size());
+    }
+    
+    if (stats)
+        stats->addFile();
+    job.results->add (file->input, result, reason);
+}
+
+#endif
+
+void openFiles (std::string datafilename, std::string outputname, OPERATION operation, const CryptoOptions & options, CryptoFiles & files)
+{
+    /*
+     Opens the data and output files. Encryption writes the header out (its length is filled in by closeFiles),
+     decryption reads it in. Either way files.header has the chunk size to use afterwards.
+     A filename of - uses standard input/output instead, so the utility can sit in the middle of a shell pipeline.
+     An empty outputname opens no output file, and nothing is written (verify only).
+     
+     Throws std::runtime_error exception if filepaths cannot be opened.
+     */
+    
+    // Input file & output file cannot be equal.
+    if (datafilename == outputname && !isStandardStream(datafilename))
+        throw std::runtime_error ("INPUT FILE CANNOT EQUAL OUTPUT FILE");
+    
+    if (options.directIO && (isStandardStream(datafilename) || isStandardStream(outputname)))
+        throw (std::runtime_error("Direct I/O needs files, not pipes."));
+#ifdef _WIN32
+    if (options.directIO)
+        throw (std::runtime_error("Direct I/O is not available on this platform."));
+#endif
+    
+    // Open data file
+    if (isStandardStream(datafilename))
+    {
+#ifdef _WIN32
+        _setmode (_fileno(stdin), _O_BINARY);   // Otherwise line endings get translated
+#endif
+        files.input = &std::cin;
+    }
+#ifndef _WIN32
+    else if (options.directIO)
+    {
+        files.directData.open (datafilename, false, options.queueDepth, options.directUring);
+        files.input = &files.directData;
+    }
+#endif
+    else
+    {
+        files.datafilestream.open (datafilename.c_str(), std::ios::in | std::ios::binary);
+        if (!files.datafilestream.is_open())
+            throw (std::runtime_error("Could not open data file. Check that directory path is valid."));
+        files.input = &files.datafilestream;
+    }
+    
+    // Open output file
+    files.output = NULL;
+    if (isStandardStream(outputname))
+    {
+#ifdef _WIN32
+        _setmode (_fileno(stdout), _O_BINARY);
+#endif
+        files.output = &std::cout;
+    }
+#ifndef _WIN32
+    else if (!outputname.empty() && options.directIO)
+    {
+        files.directOut.open (outputname, true, options.queueDepth, options.directUring);
+        files.output = &files.directOut;
+    }
+#endif
+    else if (!outputname.empty())
+    {
+        files.outfilestream.open (outputname.c_str(), std::ios::out | std::ios::binary);
+        if (!files.outfilestream.is_open())
+            throw (std::runtime_error("Could not open output file. Check that directory path is valid."));
+        files.output = &files.outfilestream;
+    }
+    
+    files.schedule = NULL;
+    files.chunksRead = 0;
+    files.stopOnBadChunk = options.stopOnBadChunk;
+    files.stats = options.stats;
+    files.stopped = false;
+    files.dataLength = 0;
+    files.outputLength = 0;
+    files.pendingRead = 0;
+    files.writeFrames = (operation == ENCRYPT && options.compress);
+    
+    if (operation == ENCRYPT)
+    {
+        checkChunkSize (options.chunkSize);
+        files.header = FileHeader();
+        files.header.chunkSize = options.chunkSize;
+        if (options.compress)
+            files.header.version = COMPRESSED_VERSION;
+        
+        unsigned int blocks[HEADER_BLOCKS];
+        encodeHeader (files.header, blocks);
+        if (files.output)
+            files.output->write((const char*)blocks, HEADER_SIZE);
+    }
+    else
+        readHeader (files);
+}
+
+void closeFiles (CryptoFiles & files, OPERATION operation)
+{
+    /*
+     Finishes off the output once every chunk has been written.
+     
+     Encryption only knows the length of the data once it has all been read. If the output is a file, the header is
+     rewritten with it - output to a pipe can't go back, and keeps UNKNOWN_LENGTH.
+     */
+    
+    StageTimer timer (files.stats, CryptoStats::WRITE);
+    
+    // A full disk or closed pipe only shows up as a failed stream - nothing throws by itself.
+    if (files.output && !files.output->flush())
+        throw (std::runtime_error("Could not write to output file."));
+    
+#ifndef _WIN32
+    // Direct output only writes its last, partial slab now.
+    if (files.directOut.is_open())
+    {
+        files.directOut.finish();
+        if (operation == ENCRYPT)
+        {
+            setOriginalLength (files.header, files.dataLength);
+            
+            unsigned int blocks[HEADER_BLOCKS];
+            encodeHeader (files.header, blocks);
+            files.directOut.rewrite (0, blocks, HEADER_SIZE);
+        }
+    }
+    files.directData.close();
+    files.directOut.close();
+#endif
+    
+    if (operation == ENCRYPT && files.outfilestream.is_open())
+    {
+        setOriginalLength (files.header, files.dataLength);
+        
+        unsigned int blocks[HEADER_BLOCKS];
+        encodeHeader (files.header, blocks);
+        files.outfilestream.seekp(0, std::ios::beg);
+        files.outfilestream.write((const char*)blocks, HEADER_SIZE);
+        
+        if (!files.outfilestream.flush())
+            throw (std::runtime_error("Could not write to output file."));
+    }
+    
+    // Bytes of a header-less file read while looking for a header are plain data when encrypting.
+    if (!files.pending.empty())
+        secureZero (&files.pending[0], files.pending.size());
+    
+    files.datafilestream.close();
+    files.outfilestream.close();
+}
+
+bool isStandardStream (std::string filename)
+{
+    // - in place of a file path means standard input or standard output.
+    return filename == "-";
+}
+
+void readHeader (CryptoFiles & files)
+{
+    /*
+     Reads the header from the front of an encrypted file into files.header.
+     A file from before headers starts straight with its data - the bytes read are kept in files.pending, to be read again as data.
+     
+     Throws std::runtime_error if the file has a header for a format this build can't decrypt.
+     */
+    
+    StageTimer timer (files.stats, CryptoStats::DATA_READ);
+    
+    unsigned int blocks[HEADER_BLOCKS] = {0};
+    files.input->read((char*)blocks, HEADER_SIZE);
+    unsigned long long bytesRead = files.input->gcount();
+    
+    if (bytesRead == HEADER_SIZE && decodeHeader (blocks, files.header))
+        return;
+    
+    files.header = legacyHeader();
+    files.pending.assign((char*)blocks, (char*)blocks + bytesRead);
+    files.pendingRead = 0;
+}
+
+unsigned long long readInput (CryptoFiles & files, char * buffer, unsigned long long size)
+{
+    // Reads up to size bytes of data - anything pending first, then from the input. Returns the number of bytes read.
+    unsigned long long count = 0;
+    while (files.pendingRead < files.pending.size() && count < size)
+        buffer[count++] = files.pending[files.pendingRead++];
+    
+    if (count < size)
+    {
+        files.input->read(buffer + count, size - count);
+        count += files.input->gcount();
+    }
+    
+    return count;
+}
+
+bool inputFinished (CryptoFiles & files)
+{
+    return files.pendingRead == files.pending.size() && files.input->peek() == EOF;
+}
+
+void readChunk (CryptoFiles & files, OPERATION operation, Chunk & chunk)
+{
+    /*
+     Reads the next piece of the data into the chunk.
+     
+     Encryption reads chunkSize-4 bytes, leaving room at the front for the checksum.
+     Decryption reads chunkSize bytes, which includes the checksum stored by encryption.
+     
+     The length of the data is never needed up front, so pipes work the same as files: this is the last chunk
+     if the read comes up short, or if nothing is left after it.
+     Sets chunk.finalByteCount if this is the last piece of the data, and picks the chunk's key stream from the schedule.
+     */
+    
+    StageTimer timer (files.stats, CryptoStats::DATA_READ);
+    
+    // chunk.data is a fixed block of the job's arena - this only undoes the trimming of a final chunk, it never allocates.
+    unsigned long long chunkIndex = files.chunksRead++;
+    chunk.keyStream = files.schedule->stream(chunkIndex);
+    chunk.rekeyStream = files.rekeySchedule ? files.rekeySchedule->stream(chunkIndex) : NULL;
+    
+    // A compressed file's chunks vary in length - each one's frame word says how long it is.
+    if (operation == DECRYPT && isCompressed(files.header))
+    {
+        readFrame (files, chunk);
+        return;
+    }
+    
+    // Encryption reads in after the block reserved for the checksum.
+    unsigned int chunkSize = files.header.chunkSize;
+    unsigned int readOffset = (operation == ENCRYPT) ? 1 : 0;
+    unsigned int readSize = chunkSize - 4*readOffset;
+    
+    // The first chunks read into each block commit (lock) it as they fill - doubling each time - so a short file only locks what it uses.
+    // After that the whole chunk is committed, and this is a single read.
+    unsigned long long bytesRead = 0;
+    unsigned long long room = 0;
+    while (bytesRead == room && room < readSize)
+    {
+        chunk.data.reserve (readOffset + bytesRead/4 + 1);
+        room = std::min ((unsigned long long)readSize, 4 * (chunk.data.committed() - readOffset));
+        bytesRead += readInput (files, (char*)(chunk.data.data() + readOffset) + bytesRead, room - bytesRead);
+    }
+    chunk.data.resize (std::min (chunk.data.committed(), (unsigned long long)chunkSize/4));
+    files.dataLength += bytesRead;
+    
+    if (files.stats)
+    {
+        files.stats->addChunks(1);
+        files.stats->addBytesRead(bytesRead);
+    }
+    
+    // Full chunk, unless the read came up short or there's no data after it
+    bool finalChunk = (bytesRead < readSize || inputFinished(files));
+    finishChunk (chunk, operation, chunkSize, bytesRead, finalChunk);
+}
+
+void readFrame (CryptoFiles & files, Chunk & chunk)
+{
+    /*
+     Reads the next frame of a compressed file into the chunk - its frame word, then the encrypted chunk it describes.
+     
+     The chunk is left for processChunkTimed() to decrypt & decompress, with writeSize set to the plain data it should hold:
+     chunkSize-4 bytes for every frame but the last, and whatever is left of the header's length for the last one -
+     UNKNOWN_LENGTH if the file was encrypted from a pipe.
+     
+     Throws std::runtime_error if the file ends part way through a frame, or a frame word is too damaged to find the next frame by.
+     */
+    
+    unsigned int chunkSize = files.header.chunkSize;
+    unsigned int frameWord = 0;
+    unsigned long long bytesRead = readInput (files, (char*)&frameWord, 4);
+    unsigned long long payload = frameWord & FRAME_LENGTH_MASK;
+    if (bytesRead == 4 && payload > chunkSize - 4)
+        throw (std::runtime_error("Compressed file has a damaged frame - nothing after it can be found."));
+    
+    // Room for the frame to decompress into, not just for the frame.
+    unsigned long long frameBytes = 4 + (payload + 3) / 4 * 4;
+    chunk.data.reserve (chunkSize/4);
+    if (bytesRead == 4)
+        bytesRead += readInput (files, (char*)chunk.data.data(), frameBytes);
+    if (bytesRead != 4 + frameBytes)
+        throw (std::runtime_error("Compressed file ends part way through a frame - it has been truncated."));
+    
+    chunk.data.resize (frameBytes/4);
+    chunk.frameWord = frameWord;
+    files.dataLength += bytesRead;
+    
+    if (files.stats)
+    {
+        files.stats->addChunks(1);
+        files.stats->addBytesRead(bytesRead);
+    }
+    
+    chunk.writeOffset = 1;
+    chunk.finalByteCount = 0;
+    chunk.writeSize = chunkSize - 4;
+    
+    // Payloads are whole blocks, so the last frame is marked as ending on a whole block - the same as compressChunk() marked it.
+    if (inputFinished(files))
+    {
+        chunk.finalByteCount = 4;
+        
+        unsigned long long before = (files.chunksRead - 1) * (chunkSize - 4);
+        if (files.header.originalLength == UNKNOWN_LENGTH)
+            chunk.writeSize = UNKNOWN_LENGTH;
+        else if (files.header.originalLength < before)
+            chunk.writeSize = 0;
+        else
+            chunk.writeSize = std::min (files.header.originalLength - before, (unsigned long long)chunkSize - 4);
+    }
+}
+
+void processChunkTimed (Chunk & chunk, OPERATION operation, CryptoStats * stats, bool takeDigest, bool framed, bool rekey)
+{
+    // takeDigest (encryption only) digests the plain data first, while it's still in cache.
+    // framed (compressed files) compresses the data before it's checksummed & encrypted, or decompresses it once it's decrypted & checked.
+    // rekey (read as for decryption) moves the chunk to its rekeyStream instead of decrypting it - a frame stays compressed, as it was.
+    StageTimer timer (stats, CryptoStats::CIPHER);
+    if (rekey)
+    {
+        rekeyChunk (chunk);
+        return;
+    }
+    
+    if (takeDigest)
+        chunk.digest = chunkDigest ((const unsigned char *)(chunk.data.data() + 1), chunk.writeSize - 4);
+    
+    if (framed && operation == ENCRYPT)
+        compressChunk (chunk);
+    
+    processChunk (chunk, operation);
+    
+    if (framed && operation == DECRYPT)
+        decompressChunk (chunk);
+}
+
+SecureArena & frameScratch (unsigned long long bytes)
+{
+    /*
+     Scratch space for compressing & decompressing - block 0 holds up to bytes of data, block 1 the compressor's hash table.
+     One per thread, kept for the thread's lifetime and only grown when a bigger chunk comes along. It holds plain data,
+     so it's locked & zeroed the same as chunk memory.
+     */
+    
+    static thread_local SecureArena scratch;
+    bytes = std::max (bytes, (unsigned long long)LZ_HASH_SIZE * 4);
+    if (scratch.blockBytes() < bytes)
+        scratch.allocate (bytes, 2);
+    return scratch;
+}
+
+void compressChunk (Chunk & chunk)
+{
+    /*
+     Compresses an encryption chunk's data where it is, ahead of the checksum & cipher, and sets the frame word writeChunk() puts
+     in front of it. Data that doesn't come out smaller is stored as it was.
+     
+     Either way the payload is padded with zeros to whole blocks, and a last chunk is marked as ending on a whole block,
+     so frames never need the partial last block handling.
+     */
+    
+    unsigned char * data = (unsigned char *)(chunk.data.data() + 1);
+    unsigned long long length = chunk.writeSize - 4;
+    unsigned long long payload = 0;
+    
+    if (length)
+    {
+        SecureArena & scratch = frameScratch (length);
+        unsigned char * packed = (unsigned char *)scratch.commit (0, length);
+        unsigned int * table = scratch.commit (1, LZ_HASH_SIZE * 4);
+        
+        payload = lzCompress (data, length, packed, length - 1, table);
+        if (payload)
+            memcpy (data, packed, payload);
+    }
+    
+    if (payload)
+        chunk.frameWord = (unsigned int)payload;
+    else
+    {
+        payload = length;
+        chunk.frameWord = (unsigned int)length | FRAME_STORED;
+    }
+    
+    // Shrinking never commits memory, so this is safe on a worker thread.
+    unsigned long long blocks = (payload + 3) / 4;
+    std::fill (data + payload, data + 4 * blocks, 0);
+    chunk.data.resize (1 + blocks);
+    chunk.writeSize = 4 + 4 * blocks;
+    
+    if (chunk.finalByteCount)
+        chunk.finalByteCount = 4;
+}
+
+void decompressChunk (Chunk & chunk)
+{
+    /*
+     Decompresses a frame read by readFrame() once it has been decrypted and checked against its checksum, so only data that
+     passed is ever decompressed. Sets writeSize to the plain data the frame holds.
+     
+     A frame that failed its checksum, won't decompress, or holds the wrong length of data is marked bad (hashAfter no longer
+     matches hashBefore). Its length can't be trusted, so it's written out as zeros, as long as the frame should have held -
+     the data after it still ends up in the right place.
+     */
+    
+    unsigned char * data = (unsigned char *)(chunk.data.data() + 1);
+    unsigned long long expected = chunk.writeSize;
+    unsigned long long payload = chunk.frameWord & FRAME_LENGTH_MASK;
+    unsigned long long written = payload;
+    bool stored = (chunk.frameWord & FRAME_STORED) != 0;
+    bool good = (chunk.hashBefore == chunk.hashAfter);
+    
+    if (good && !stored)
+    {
+        // readFrame() reserved the whole chunk, so there's room for a full chunk of data.
+        SecureArena & scratch = frameScratch (payload);
+        unsigned char * packed = (unsigned char *)scratch.commit (0, payload);
+        memcpy (packed, data, payload);
+        good = lzDecompress (packed, payload, data, 4 * chunk.data.committed() - 4, written);
+    }
+    
+    if (good && (expected == UNKNOWN_LENGTH || written == expected))
+    {
+        chunk.writeSize = written;
+        return;
+    }
+    
+    chunk.hashAfter = ~chunk.hashBefore;
+    if (expected == UNKNOWN_LENGTH)
+        expected = stored ? payload : 0;
+    std::fill (data, data + expected, 0);
+    chunk.writeSize = expected;
+}
+
+void writeChunk (CryptoFiles & files, const Chunk & chunk)
+{
+    StageTimer timer (files.stats, CryptoStats::WRITE);
+    
+    // CRC of exactly what's written, frame word & all - taken while the chunk is still in cache.
+    if (files.crcs && files.output)
+    {
+        ChunkCrc entry;
+        entry.offset = HEADER_SIZE + files.outputLength;
+        entry.length = (unsigned int)chunk.writeSize;
+        entry.crc = 0;
+        if (files.writeFrames)
+        {
+            entry.length += 4;
+            entry.crc = crc32c (entry.crc, &chunk.frameWord, 4);
+        }
+        entry.crc = crc32c (entry.crc, chunk.data.data() + chunk.writeOffset, chunk.writeSize);
+        files.crcs->push_back(entry);
+    }
+    
+    files.outputLength += chunk.writeSize;
+    
+    if (files.digests)
+        files.digests->push_back(chunk.digest);
+    
+    // Write out to file, unless only verifying
+    if (files.output)
+    {
+        if (files.writeFrames)
+        {
+            files.output->write((const char*)&chunk.frameWord, 4);
+            files.outputLength += 4;
+            if (files.stats)
+                files.stats->addBytesWritten(4);
+        }
+        
+        files.output->write((const char*)(chunk.data.data() + chunk.writeOffset), chunk.writeSize);
+        if (files.stats)
+            files.stats->addBytesWritten(chunk.writeSize);
+    }
+}
+
+void writeCrcSidecar (std::string outputname, unsigned int chunkSize, std::vector<ChunkCrc> & crcs, CryptoStats * stats)
+{
+    /*
+     Writes the CRC sidecar (ws-chunkCrc.h) for a finished output file, from the chunk CRCs writeChunk() collected.
+     The header is read back for its CRC - encryption only fills in its length once the data is done - and the sidecar is
+     stamped with the file as it is now, so any later change to the file without a new sidecar makes this one stale.
+     */
+    
+    StageTimer timer (stats, CryptoStats::WRITE);
+    unsigned int blocks[HEADER_BLOCKS];
+    std::ifstream output (outputname.c_str(), std::ios::in | std::ios::binary);
+    struct stat outputStats;
+    if (!output.read ((char *)blocks, HEADER_SIZE) || stat (outputname.c_str(), &outputStats) != 0)
+        throw (std::runtime_error("Could not read output file back for its checksum file."));
+    
+    CrcFile sidecar;
+    sidecar.chunkSize = chunkSize;
+    sidecar.headerCrc = crc32c (0, blocks, HEADER_SIZE);
+    sidecar.chunks.swap (crcs);
+    sidecar.stamp (outputStats);
+    writeCrcFile (outputname + CRC_SUFFIX, sidecar);
+}
+
+const KeySchedule * loadSchedule (KeyScheduleCache & keys, unsigned int chunkSize, CryptoStats * stats)
+{
+    // Built the first time each chunk size is used - after that it's only a lookup.
+    StageTimer timer (stats, CryptoStats::KEY_READ);
+    return &keys.schedule(chunkSize);
+}
+
+void runChunks (CryptoFiles & files, OPERATION operation, const CryptoOptions & options, std::vector<unsigned int> & hashesBefore, std::vector<unsigned int> & hashesAfter)
+{
+    /*
+     Runs the read/process/write loop over the whole data file, in the mode chosen by options.
+     
+     Each chunk carries its own checksum and its own piece of key, so chunks don't depend on each other.
+     */
+    
+    unsigned int threadCount = options.threadCount;
+    if (threadCount == 0)
+        threadCount = std::thread::hardware_concurrency();
+    if (threadCount == 0)
+        threadCount = 1;
+    
+    if (options.pipelined)
+        runChunksPipelined (files, operation, threadCount, hashesBefore, hashesAfter);
+    else
+        runChunksBatched (files, operation, threadCount, hashesBefore, hashesAfter);
+}
+
+void runChunksBatched (CryptoFiles & files, OPERATION operation, unsigned int threadCount, std::vector<unsigned int> & hashesBefore, std::vector<unsigned int> & hashesAfter)
+{
+    /*
+     Serial mode (threadCount == 1) reads, processes and writes one chunk at a time.
+     Parallel mode reads one chunk per worker thread, processes the batch on the thread pool,
+     and writes the batch back out in file order before reading the next one.
+     */
+    
+    std::unique_ptr<ThreadPool> pool;
+    if (threadCount > 1)
+        pool.reset(new ThreadPool(threadCount));
+    
+    // One locked block per worker, reused for every batch.
+    SecureArena arena (files.header.chunkSize, threadCount);
+    std::vector<Chunk> batch(threadCount);
+    for (unsigned int i = 0; i < batch.size(); i++)
+        batch[i].data.attach (arena, i);
+    
+    bool takeDigest = (files.digests != NULL);
+    bool framed = isCompressed(files.header);
+    bool rekey = (files.rekeySchedule != NULL);
+    bool finalChunkRead = false;
+    
+    while (!finalChunkRead && !files.stopped)
+    {
+        // Read in data - in chunk sized pieces, one per worker
+        unsigned int chunkCount = 0;
+        while (chunkCount < batch.size() && !finalChunkRead)
+        {
+            readChunk (files, operation, batch[chunkCount]);
+            finalChunkRead = (batch[chunkCount].finalByteCount != 0);
+            chunkCount++;
+        }
+        
+        // Encrypt/Decrypt
+        if (pool)
+        {
+            for (unsigned int i = 0; i < chunkCount; i++)
+            {
+                Chunk * chunk = &batch[i];
+                CryptoStats * stats = files.stats;
+                pool->submit([chunk, operation, stats, takeDigest, framed, rekey] { processChunkTimed(*chunk, operation, stats, takeDigest, framed, rekey); });
+            }
+            pool->wait();
+        }
+        else
+            processChunkTimed (batch[0], operation, files.stats, takeDigest, framed, rekey);
+        
+        // Write out to file, in order
+        for (unsigned int i = 0; i < chunkCount && !files.stopped; i++)
+        {
+            writeChunk (files, batch[i]);
+            
+            if (operation == DECRYPT)
+            {
+                hashesBefore.push_back(batch[i].hashBefore);
+                hashesAfter.push_back(batch[i].hashAfter);
+                
+                if (files.stopOnBadChunk && batch[i].hashBefore != batch[i].hashAfter)
+                    files.stopped = true;
+            }
+        }
+    }
+}
+
+void runChunksPipelined (CryptoFiles & files, OPERATION operation, unsigned int threadCount, std::vector<unsigned int> & hashesBefore, std::vector<unsigned int> & hashesAfter)
+{
+    /*
+     Pipelined mode. A reader thread fills chunk buffers from disk, this thread encrypts/decrypts them
+     (on the thread pool when there is more than one worker), and a writer thread writes them out in file order.
+     
+     Buffers come from a fixed pool of locked blocks and go back to the reader once they have been written, so disk I/O
+     and encryption overlap instead of taking turns, and no chunk memory is allocated once the loop starts.
+     */
+    
+    std::unique_ptr<ThreadPool> pool;
+    if (threadCount > 1)
+        pool.reset(new ThreadPool(threadCount));
+    
+    // One batch being read, one being processed, one being written.
+    SecureArena arena (files.header.chunkSize, 3 * threadCount);
+    std::vector<Chunk> chunks(3 * threadCount);
+    for (unsigned int i = 0; i < chunks.size(); i++)
+        chunks[i].data.attach (arena, i);
+    
+    BoundedQueue<Chunk *> freeChunks (chunks.size());
+    BoundedQueue<Chunk *> readChunks (chunks.size());
+    BoundedQueue<Chunk *> processedChunks (chunks.size());
+    
+    for (unsigned int i = 0; i < chunks.size(); i++)
+        freeChunks.push(&chunks[i]);
+    
+    std::exception_ptr readError;
+    std::exception_ptr processError;
+    std::exception_ptr writeError;
+    
+    // Any stage failing releases the other two, so nothing is left waiting on a queue.
+    auto stopPipeline = [&] ()
+    {
+        freeChunks.close();
+        readChunks.close();
+        processedChunks.close();
+    };
+    
+    // Read in data - in chunk sized pieces
+    std::thread reader ([&] ()
+    {
+        try {
+            bool finalChunkRead = false;
+            Chunk * chunk;
+            
+            while (!finalChunkRead && freeChunks.pop(chunk))
+            {
+                readChunk (files, operation, *chunk);
+                finalChunkRead = (chunk->finalByteCount != 0);
+                
+                if (!readChunks.push(chunk))
+                    break;
+            }
+        }
+        catch (...) {
+            readError = std::current_exception();
+            stopPipeline();
+        }
+        readChunks.close();
+    });
+    
+    // Write out to file, in order
+    std::thread writer ([&] ()
+    {
+        try {
+            Chunk * chunk;
+            
+            while (processedChunks.pop(chunk))
+            {
+                writeChunk (files, *chunk);
+                
+                if (operation == DECRYPT)
+                {
+                    hashesBefore.push_back(chunk->hashBefore);
+                    hashesAfter.push_back(chunk->hashAfter);
+                    
+                    // A bad chunk shuts the pipeline down the same way an error does, minus the error.
+                    if (files.stopOnBadChunk && chunk->hashBefore != chunk->hashAfter)
+                    {
+                        files.stopped = true;
+                        stopPipeline();
+                        break;
+                    }
+                }
+                
+                freeChunks.push(chunk);
+            }
+        }
+        catch (...) {
+            writeError = std::current_exception();
+            stopPipeline();
+        }
+    });
+    
+    // Encrypt/Decrypt - takes whatever the reader has ready, up to one chunk per worker.
+    bool takeDigest = (files.digests != NULL);
+    bool framed = isCompressed(files.header);
+    bool rekey = (files.rekeySchedule != NULL);
+    try {
+        std::vector<Chunk *> batch;
+        Chunk * chunk;
+        
+        while (readChunks.pop(chunk))
+        {
+            batch.clear();
+            batch.push_back(chunk);
+            while (batch.size() < threadCount && readChunks.tryPop(chunk))
+                batch.push_back(chunk);
+            
+            if (pool && batch.size() > 1)
+            {
+                for (unsigned int i = 0; i < batch.size(); i++)
+                {
+                    Chunk * batchChunk = batch[i];
+                    CryptoStats * stats = files.stats;
+                    pool->submit([batchChunk, operation, stats, takeDigest, framed, rekey] { processChunkTimed(*batchChunk, operation, stats, takeDigest, framed, rekey); });
+                }
+                pool->wait();
+            }
+            else
+                processChunkTimed (*batch[0], operation, files.stats, takeDigest, framed, rekey);
+            
+            for (unsigned int i = 0; i < batch.size(); i++)
+                processedChunks.push(batch[i]);
+        }
+    }
+    catch (...) {
+        processError = std::current_exception();
+        stopPipeline();
+    }
+    processedChunks.close();
+    
+    reader.join();
+    writer.join();
+    
+    if (readError)
+        std::rethrow_exception(readError);
+    if (processError)
+        std::rethrow_exception(processError);
+    if (writeError)
+        std::rethrow_exception(writeError);
+}
+
+#ifndef _WIN32
+
+MappedFile::MappedFile ()
+: fd(-1), base(0), length(0)
+{}
+
+MappedFile::~MappedFile ()
+{
+    if (base)
+        munmap(base, length);
+    if (fd >= 0)
+        close(fd);
+}
+
+void mapInput (std::string filename, MappedFile & file, std::string description)
+{
+    /*
+     Maps a file read-only, hinting the kernel that it will be read front to back.
+     Empty files are opened but not mapped (base stays null).
+     */
+    
+    file.fd = open (filename.c_str(), O_RDONLY);
+    if (file.fd < 0)
+        throw (std::runtime_error("Could not open " + description + " file. Check that directory path is valid."));
+    
+    struct stat fileStats;
+    if (fstat(file.fd, &fileStats) != 0)
+        throw (std::runtime_error("Could not read size of " + description + " file."));
+    
+    file.length = fileStats.st_size;
+    if (file.length == 0)
+        return;
+    
+    // A 32bit build can't map more than its address space - mmap would silently map a truncated length.
+    if (file.length > (size_t)-1)
+        throw (std::runtime_error("Could not memory map " + description + " file. It is too large for this build's address space - use the 64bit build, or leave memory mapping off."));
+    
+    void * mapping = mmap (0, file.length, PROT_READ, MAP_SHARED, file.fd, 0);
+    if (mapping == MAP_FAILED)
+        throw (std::runtime_error("Could not memory map " + description + " file. It may be too large for this build's address space."));
+    
+    file.base = mapping;
+    madvise (file.base, file.length, MADV_SEQUENTIAL);
+}
+
+void mapOutput (std::string filename, unsigned long long length, MappedFile & file)
+{
+    /*
+     Creates (or truncates) the output file, sizes it to its final length up front and maps it writable.
+     
+     The blocks are reserved as well as the length. A sparse file would only run out of space partway through the run, when a
+     store through the mapping faults (SIGBUS) - reserving them up front makes a full disk or quota a clean error instead.
+     */
+    
+    if (length > (size_t)-1)
+        throw (std::runtime_error("Could not memory map output file. It is too large for this build's address space - use the 64bit build, or leave memory mapping off."));
+    
+    file.fd = open (filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (file.fd < 0)
+        throw (std::runtime_error("Could not open output file. Check that directory path is valid."));
+    
+    if (ftruncate(file.fd, length) != 0)
+        throw (std::runtime_error("Could not size output file. Check that the volume has enough free space."));
+    
+    file.length = length;
+    if (file.length == 0)
+        return;
+    
+#ifdef __APPLE__
+    fstore_t reservation = {F_ALLOCATEALL, F_PEOFPOSMODE, 0, (off_t)length, 0};
+    if (fcntl (file.fd, F_PREALLOCATE, &reservation) == -1)
+#else
+    if (posix_fallocate (file.fd, 0, length) != 0)
+#endif
+        throw (std::runtime_error("Could not reserve space for output file. Check that the volume has enough free space."));
+    
+    void * mapping = mmap (0, file.length, PROT_READ | PROT_WRITE, MAP_SHARED, file.fd, 0);
+    if (mapping == MAP_FAILED)
+        throw (std::runtime_error("Could not memory map output file. It may be too large for this build's address space."));
+    
+    file.base = mapping;
+    madvise (file.base, file.length, MADV_SEQUENTIAL);
+}
+
+void processMappedChunk (const MappedJob & job, unsigned long long chunkIndex)
+{
+    /*
+     Encrypts or decrypts one chunk straight from the mapped input into the mapped output.
+     Produces exactly the same bytes as readChunk/processChunk/writeChunk.
+     
+     Any last partial 4 byte block is read/written as a whole block - the rest of that block is
+     past the end of file but still inside the mapped page, which reads as zeros and is never saved.
+     */
+    
+    // An earlier bad chunk already stopped the run.
+    if (job.stopped && *job.stopped)
+        return;
+    
+    // Pages of the input are read from disk as the cipher touches them, so that's timed here too.
+    StageTimer timer (job.stats, CryptoStats::CIPHER);
+    
+    // Key stream for this chunk, already as long as the chunk so it never wraps.
+    const unsigned int * keyStream = job.schedule->stream(chunkIndex);
+    
+    bool finalChunk = (chunkIndex == job.chunkCount - 1);
+    
+    if (job.operation == ENCRYPT)
+    {
+        unsigned long long dataStart = chunkIndex * (job.chunkSize - 4);
+        unsigned long long dataSize = job.inputLength - dataStart;
+        if (dataSize > job.chunkSize - 4)
+            dataSize = job.chunkSize - 4;
+        
+        unsigned long long words = (dataSize + 3) / 4;
+        const unsigned int * data = (const unsigned int *)((const char *)job.input + dataStart);
+        unsigned int * output = (unsigned int *)((char *)job.output + chunkIndex * job.chunkSize);
+        
+        if (job.digests)
+            job.digests[chunkIndex] = chunkDigest ((const unsigned char *)data, dataSize);
+        
+        // Encrypt data into the output, computing its hash on the way through
+        unsigned int hash = keyStreamHashAlgorithm (data, data + words, output + 1, keyStream + 1, ENCRYPT);
+        
+        // Encrypt checksum
+        keyStreamAlgorithm (&hash, &hash + 1, output, keyStream, ENCRYPT);
+        
+        // Last block of the file is only partially written out, rotate the meaningful bytes back down into it.
+        if (finalChunk)
+            output[words] = (output[words]<<(BIT_SHIFT_COUNT)) + (output[words]>>(32 - BIT_SHIFT_COUNT));
+    }
+    
+    else
+    {
+        unsigned long long dataStart = chunkIndex * job.chunkSize;
+        unsigned long long dataSize = job.inputLength - dataStart;
+        if (dataSize > job.chunkSize)
+            dataSize = job.chunkSize;
+        
+        unsigned long long words = (dataSize + 3) / 4 - 1;    // Not counting the checksum
+        const unsigned int * data = (const unsigned int *)((const char *)job.input + dataStart);
+        unsigned int * output = (unsigned int *)((char *)job.output + chunkIndex * (job.chunkSize - 4));
+        
+        // The input is read-only, so the last block of the file is shifted back into original placement in a local copy.
+        unsigned int lastBlock = data[words];
+        if (finalChunk)
+            lastBlock = ((lastBlock>>(BIT_SHIFT_COUNT))+(lastBlock<<(32 - BIT_SHIFT_COUNT)));
+        
+        // Decrypt checksum
+        unsigned int hash = (words == 0) ? lastBlock : data[0];
+        keyStreamAlgorithm (&hash, &hash + 1, &hash, keyStream, DECRYPT);
+        job.hashesBefore[chunkIndex] = hash;
+        
+        unsigned int hashAfter = 0;
+        if (words)
+        {
+            // Decrypt data & compute hash, then the last block from its local copy
+            unsigned long long lastWord = finalChunk ? words - 1 : words;
+            hashAfter = keyStreamHashAlgorithm (data + 1, data + 1 + lastWord, output, keyStream + 1, DECRYPT);
+            
+            if (finalChunk)
+            {
+                keyStreamAlgorithm (&lastBlock, &lastBlock + 1, output + lastWord, keyStream + words, DECRYPT);
+                
+                // Removes unsignificant bits that were originally 0, if the last block is partial.
+                unsigned int finalByteCount = job.inputLength % 4;
+                if (finalByteCount)
+                    output[lastWord] &= ~(0xFFFFFFFF<<(8*finalByteCount));
+                
+                hashAfter ^= output[lastWord];
+            }
+        }
+        
+        job.hashesAfter[chunkIndex] = hashAfter;
+        
+        if (job.stopOnBadChunk && hashAfter != job.hashesBefore[chunkIndex])
+            *job.stopped = true;
+    }
+}
+
+void runMapped (std::string datafilename, KeyScheduleCache & keys, std::string outputname, OPERATION operation, const CryptoOptions & options, CryptoFiles & files, std::vector<unsigned int> & hashesBefore, std::vector<unsigned int> & hashesAfter)
+{
+    /*
+     Memory mapped version of the chunk loop. The data file is mapped read-only, the output file is
+     sized to its final length and mapped writable, and every chunk goes from one mapping to the other in a single pass
+     with no stream buffers or per-chunk vectors in between.
+     
+     Chunks are independent, so with more than one thread they are handed out to the thread pool.
+     
+     Fills in files.header, files.dataLength and files.outputLength the same way the chunk loop does - and files.digests, if it was given one.
+     */
+    
+    // Input file & output file cannot be equal.
+    if (datafilename == outputname)
+        throw std::runtime_error ("INPUT FILE CANNOT EQUAL OUTPUT FILE");
+    
+    MappedFile dataFile;
+    MappedFile outFile;
+    
+    {
+        StageTimer timer (options.stats, CryptoStats::DATA_READ);
+        mapInput (datafilename, dataFile, "data");
+    }
+    
+    MappedJob job;
+    job.operation = operation;
+    job.input = dataFile.base;
+    job.inputLength = dataFile.length;
+    job.hashesBefore = NULL;
+    job.hashesAfter = NULL;
+    job.digests = NULL;
+    
+    std::atomic<bool> stopped (false);
+    job.stopOnBadChunk = options.stopOnBadChunk && operation == DECRYPT;
+    job.stopped = &stopped;
+    job.stats = options.stats;
+    
+    // Work out how many chunks there are, and how big the output will be.
+    unsigned long long outputLength;
+    unsigned int headerSize = 0;        // Header in front of the output
+    if (operation == ENCRYPT)
+    {
+        checkChunkSize (options.chunkSize);
+        files.header = FileHeader();
+        files.header.chunkSize = options.chunkSize;
+        setOriginalLength (files.header, job.inputLength);
+        headerSize = HEADER_SIZE;
+        
+        job.chunkSize = files.header.chunkSize;
+        job.chunkCount = (job.inputLength + (job.chunkSize - 4) - 1) / (job.chunkSize - 4);
+        if (job.chunkCount == 0)
+            job.chunkCount = 1;     // An empty file still gets a checksum
+        outputLength = job.inputLength + 4 * job.chunkCount;
+        
+        if (files.digests)
+        {
+            files.digests->assign(job.chunkCount, 0);
+            job.digests = &(*files.digests)[0];
+        }
+    }
+    else
+    {
+        // Skip over the header, if the file was written with one.
+        if (job.inputLength >= HEADER_SIZE && decodeHeader ((const unsigned int *)job.input, files.header))
+        {
+            job.input = (const char *)job.input + HEADER_SIZE;
+            job.inputLength -= HEADER_SIZE;
+        }
+        else
+            files.header = legacyHeader();
+        
+        // Frames of a compressed file vary in length, so where each one goes can't be worked out up front - those are read in chunks instead.
+        if (isCompressed(files.header))
+        {
+            openFiles (datafilename, outputname, DECRYPT, options, files);
+            files.schedule = loadSchedule (keys, files.header.chunkSize, options.stats);
+            runChunks (files, DECRYPT, options, hashesBefore, hashesAfter);
+            closeFiles (files, DECRYPT);
+            return;
+        }
+        
+        job.chunkSize = files.header.chunkSize;
+        job.chunkCount = (job.inputLength + job.chunkSize - 1) / job.chunkSize;
+        if (job.inputLength % job.chunkSize && job.inputLength % job.chunkSize < 4)
+            throw (std::runtime_error("Encrypted file is too short to contain its checksum."));
+        if (job.chunkCount == 0)
+            throw (std::runtime_error("Encrypted file is too short to contain its checksum."));
+        outputLength = job.inputLength - 4 * job.chunkCount;
+        
+        hashesBefore.assign(job.chunkCount, 0);
+        hashesAfter.assign(job.chunkCount, 0);
+        job.hashesBefore = &hashesBefore[0];
+        job.hashesAfter = &hashesAfter[0];
+    }
+    
+    job.schedule = loadSchedule (keys, job.chunkSize, options.stats);
+    
+    {
+        StageTimer timer (options.stats, CryptoStats::WRITE);
+        mapOutput (outputname, headerSize + outputLength, outFile);
+    }
+    job.output = (char *)outFile.base + headerSize;
+    if (headerSize)
+        encodeHeader (files.header, (unsigned int *)outFile.base);
+    
+    unsigned int threadCount = options.threadCount;
+    if (threadCount == 0)
+        threadCount = std::thread::hardware_concurrency();
+    
+    if (threadCount > 1 && job.chunkCount > 1)
+    {
+        ThreadPool pool(threadCount);
+        for (unsigned long long i = 0; i < job.chunkCount; i++)
+            pool.submit([&job, i] { processMappedChunk(job, i); });
+        pool.wait();
+    }
+    else
+    {
+        for (unsigned long long i = 0; i < job.chunkCount; i++)
+            processMappedChunk (job, i);
+    }
+    
+    // Written back before anything is reported - an error writing the pages out would otherwise only surface after munmap, where nothing sees it.
+    if (outFile.base)
+    {
+        StageTimer timer (options.stats, CryptoStats::WRITE);
+        if (msync (outFile.base, outFile.length, MS_SYNC) != 0)
+            throw (std::runtime_error("Could not write output file. Check that the volume has enough free space."));
+    }
+    
+    files.dataLength = job.inputLength;
+    files.outputLength = outputLength;
+    files.stopped = stopped;
+    
+    if (options.stats)
+    {
+        options.stats->addChunks(job.chunkCount);
+        options.stats->addBytesRead(job.inputLength);
+        options.stats->addBytesWritten(outputLength);
+    }
+}
+
+#else
+
+void runMapped (std::string, KeyScheduleCache &, std::string, OPERATION, const CryptoOptions &, CryptoFiles &, std::vector<unsigned int> &, std::vector<unsigned int> &)
+{
+    throw (std::runtime_error("Memory mapped mode is not available on this platform."));
+}
+
+#endif
+
+#ifndef _WIN32
+
+InPlaceLayout inPlaceLayout (const JournalRecord & record)
+{
+    /*
+     Works out where every chunk of an in-place run goes, from what the journal records - so an interrupted run is finished
+     with the same layout it started with, whatever the file looks like by then.
+     
+     Throws std::runtime_error if an encrypted file is too short to hold its checksum.
+     */
+    
+    InPlaceLayout layout;
+    layout.operation = record.operation;
+    layout.chunkSize = record.chunkSize;
+    
+    if (record.operation == ENCRYPT)
+    {
+        // Plain data in, chunkSize-4 bytes per chunk. An empty file still gets one chunk, holding only its checksum.
+        layout.inputStride = record.chunkSize - 4;
+        layout.outputStride = record.chunkSize;
+        layout.inputStart = 0;
+        layout.outputStart = HEADER_SIZE;
+        layout.inputLength = record.inputLength;
+        layout.chunkCount = (record.inputLength + layout.inputStride - 1) / layout.inputStride;
+        if (layout.chunkCount == 0)
+            layout.chunkCount = 1;
+        layout.outputLength = HEADER_SIZE + record.inputLength + 4 * layout.chunkCount;
+    }
+    else
+    {
+        FileHeader header;
+        bool hasHeader = decodeHeader (record.fileHeader, header);
+        if (hasHeader && isCompressed(header))
+            throw (std::runtime_error("Compressed files can't be decrypted in place - their chunks aren't a fixed size. Decrypt to a second file instead."));
+        
+        layout.inputStride = record.chunkSize;
+        layout.outputStride = record.chunkSize - 4;
+        layout.inputStart = hasHeader ? HEADER_SIZE : 0;
+        layout.outputStart = 0;
+        layout.inputLength = (record.inputLength > layout.inputStart) ? record.inputLength - layout.inputStart : 0;
+        layout.chunkCount = (layout.inputLength + layout.inputStride - 1) / layout.inputStride;
+        if (layout.chunkCount == 0 || (layout.inputLength % layout.inputStride && layout.inputLength % layout.inputStride < 4))
+            throw (std::runtime_error("Encrypted file is too short to contain its checksum."));
+        layout.outputLength = layout.inputLength - 4 * layout.chunkCount;
+    }
+    
+    return layout;
+}
+
+void readInPlaceBatch (int fd, unsigned long long offset, const InPlaceLayout & layout, const KeySchedule * schedule, unsigned long long first, unsigned long long count, std::vector<Chunk> & batch, CryptoStats * stats)
+{
+    /*
+     Reads the input of chunks [first, first + count) into batch, and sets each chunk up to be processed.
+     The chunks are read from fd starting at offset, inputStride apart - from the data file itself, or from a journal slot,
+     which holds the same bytes laid out the same way.
+     */
+    
+    StageTimer timer (stats, CryptoStats::DATA_READ);
+    unsigned int readOffset = (layout.operation == ENCRYPT) ? 1 : 0;
+    
+    for (unsigned long long k = 0; k < count; k++)
+    {
+        unsigned long long index = first + k;
+        unsigned long long size = std::min (layout.inputStride, layout.inputLength - index * layout.inputStride);
+        Chunk & chunk = batch[k];
+        
+        chunk.keyStream = schedule->stream(index);
+        chunk.data.resize (std::min ((unsigned long long)layout.chunkSize/4, readOffset + (size + 3)/4));
+        readAt (fd, chunk.data.data() + readOffset, size, offset + k * layout.inputStride);
+        finishChunk (chunk, layout.operation, layout.chunkSize, size, index == layout.chunkCount - 1);
+        
+        if (stats)
+        {
+            stats->addChunks(1);
+            stats->addBytesRead(size);
+        }
+    }
+}
+
+void writeInPlaceBatch (int fd, const InPlaceLayout & layout, const JournalRecord & record, std::vector<Chunk> & batch, CryptoStats * stats)
+{
+    /*
+     Writes the processed chunks of record's batch over the file, and syncs it - only then can the journal move on to the next batch.
+     Encryption writes the header along with the batch holding chunk 0, since until then the front of the file is data still to be read.
+     */
+    
+    StageTimer timer (stats, CryptoStats::WRITE);
+    
+    for (unsigned long long k = 0; k < record.batchCount; k++)
+    {
+        const Chunk & chunk = batch[k];
+        writeAt (fd, chunk.data.data() + chunk.writeOffset, chunk.writeSize, layout.outputStart + (record.batchFirst + k) * layout.outputStride);
+        if (stats)
+            stats->addBytesWritten(chunk.writeSize);
+    }
+    
+    if (layout.operation == ENCRYPT && record.batchFirst == 0)
+        writeAt (fd, record.fileHeader, HEADER_SIZE, 0);
+    
+    syncFile (fd);
+}
+
+#endif
+
+ChecksumReport cryptInPlace (std::string filename, KeyScheduleCache & keys, OPERATION operation, const CryptoOptions & options)
+{
+    /*
+     Encrypts or decrypts a file over itself, without a second copy - needing only a journal of one batch (IN_PLACE_BATCH_BYTES) of free space.
+     
+     Every encrypted chunk is exactly 4 bytes (its checksum) longer than the plain data it holds, and the header adds HEADER_SIZE,
+     so where each chunk ends up is known before anything is read. Encryption grows the file to its final length, then works from
+     the last chunk back to the first: chunk N's output starts past the end of chunk N's input, so it only ever lands on input that
+     has already been read. Decryption works forwards and truncates the file at the end, for the same reason.
+     
+     Each batch is copied into the journal (ws-inPlaceJournal.h) before it's written over. Run the same command again after an
+     interruption and it picks up from the journal: the batch that was being written is redone from its copy, and the run carries on
+     with the same chunk size & layout it started with. The journal is removed once the file is finished.
+     
+     Decryption leaves the file untouched if the first chunk fails its checksum, since that almost always means the wrong key.
+     Otherwise bad chunks are reported like decryptionReport(), but the whole file is still decrypted - stopOnBadChunk would leave it
+     half done. A resumed run only reports the chunks it processed itself.
+     
+     Returns the report, with dataLength the length of the plain data.
+     
+     Throws std::runtime_error if the file can't be opened or written, isn't a file, has a journal from the other operation,
+     or is compressed (or to be) - compressed chunks don't have a fixed place in the file.
+     */
+    
+#ifdef _WIN32
+    throw (std::runtime_error("In-place mode is not available on this platform."));
+#else
+    
+    if (isStandardStream(filename))
+        throw (std::runtime_error("In-place mode needs a file, not a pipe."));
+    if (operation == ENCRYPT && options.compress)
+        throw (std::runtime_error("Compressed encryption can't be done in place - where each chunk goes isn't known up front."));
+    
+    MappedFile file;        // Never mapped - only owns the descriptor
+    file.fd = open (filename.c_str(), O_RDWR);
+    if (file.fd < 0)
+        throw (std::runtime_error("Could not open data file. Check that directory path is valid and writable."));
+    
+    struct stat fileStats;
+    if (fstat(file.fd, &fileStats) != 0 || !S_ISREG(fileStats.st_mode))
+        throw (std::runtime_error("In-place mode needs a regular file."));
+    unsigned long long fileLength = fileStats.st_size;
+    
+    InPlaceJournal journal (filename);
+    JournalRecord record;
+    bool resuming = journal.open (record);
+    
+    if (resuming && record.operation != operation)
+        throw (std::runtime_error(std::string("File was left part way through being ") + (record.operation == ENCRYPT ? "encrypted" : "decrypted")
+                                  + " in place. Run the same command (" + (record.operation == ENCRYPT ? "enc" : "dec") + " --in-place) to finish it first - journal " + journal.path()));
+    
+    if (!resuming)
+    {
+        record = JournalRecord();
+        record.operation = operation;
+        record.inputLength = fileLength;
+        
+        FileHeader header;
+        if (operation == ENCRYPT)
+        {
+            // Running the command again after a finished run (rather than an interrupted one) mustn't encrypt the file twice.
+            unsigned int blocks[HEADER_BLOCKS] = {0};
+            if (fileLength >= HEADER_SIZE)
+            {
+                readAt (file.fd, blocks, HEADER_SIZE, 0);
+                if (decodeHeader (blocks, header))
+                {
+                    unsigned long long encryptedLength = fileLength - HEADER_SIZE;
+                    unsigned long long chunkCount = (encryptedLength + header.chunkSize - 1) / header.chunkSize;
+                    if (chunkCount && encryptedLength >= 4 * chunkCount && header.originalLength == encryptedLength - 4 * chunkCount)
+                        throw (std::runtime_error("File is already encrypted - its header matches its length."));
+                }
+                header = FileHeader();
+            }
+            
+            checkChunkSize (options.chunkSize);
+            header.chunkSize = options.chunkSize;
+            setOriginalLength (header, fileLength);
+            encodeHeader (header, record.fileHeader);
+        }
+        else
+        {
+            StageTimer timer (options.stats, CryptoStats::DATA_READ);
+            readAt (file.fd, record.fileHeader, std::min (fileLength, (unsigned long long)HEADER_SIZE), 0);
+            decodeHeader (record.fileHeader, header);
+        }
+        record.chunkSize = header.chunkSize;
+    }
+    
+    InPlaceLayout layout = inPlaceLayout (record);
+    if (fileLength != layout.outputLength && fileLength != record.inputLength)
+        throw (std::runtime_error("File has changed length since its in-place run was interrupted - it doesn't match journal " + journal.path()));
+    
+    const KeySchedule * schedule = loadSchedule (keys, record.chunkSize, options.stats);
+    
+    unsigned int threadCount = options.threadCount;
+    if (threadCount == 0)
+        threadCount = std::thread::hardware_concurrency();
+    if (threadCount == 0)
+        threadCount = 1;
+    
+    std::unique_ptr<ThreadPool> pool;
+    if (threadCount > 1)
+        pool.reset(new ThreadPool(threadCount));
+    
+    // Batches are at least a chunk per worker, and at least IN_PLACE_BATCH_BYTES so the journal's syncs are spread over plenty of data.
+    // Every chunk's block takes at least a page of the arena, so tiny chunks are counted as a page each.
+    unsigned long long batchChunks;
+    if (resuming)
+        batchChunks = record.slotBytes / layout.inputStride;
+    else
+    {
+        batchChunks = std::max ((unsigned long long)threadCount, IN_PLACE_BATCH_BYTES / std::max ((size_t)record.chunkSize, SecureArena::pageSize()));
+        batchChunks = std::min (batchChunks, layout.chunkCount);
+        record.slotBytes = batchChunks * layout.inputStride;
+        journal.create (record);
+    }
+    
+    if (operation == ENCRYPT && fileLength != layout.outputLength && ftruncate (file.fd, layout.outputLength) != 0)
+        throw (std::runtime_error("Could not grow file to its encrypted length. Check that the volume has enough free space."));
+    
+    SecureArena arena (record.chunkSize, batchChunks);
+    std::vector<Chunk> batch(batchChunks);
+    for (unsigned int i = 0; i < batch.size(); i++)
+        batch[i].data.attach (arena, i);
+    
+    ChecksumReport report;
+    auto processBatch = [&] ()
+    {
+        if (pool)
+        {
+            for (unsigned long long k = 0; k < record.batchCount; k++)
+            {
+                Chunk * chunk = &batch[k];
+                CryptoStats * stats = options.stats;
+                pool->submit([chunk, operation, stats] { processChunkTimed(*chunk, operation, stats, false, false, false); });
+            }
+            pool->wait();
+        }
+        else
+        {
+            for (unsigned long long k = 0; k < record.batchCount; k++)
+                processChunkTimed (batch[k], operation, options.stats, false, false, false);
+        }
+        
+        if (operation == DECRYPT)
+            for (unsigned long long k = 0; k < record.batchCount; k++)
+                if (batch[k].hashBefore != batch[k].hashAfter)
+                    report.badChunks.push_back(record.batchFirst + k);
+    };
+    
+    // Redo the batch that was being written when the last run stopped, from its copy in the journal.
+    if (resuming && record.batchCount)
+    {
+        readInPlaceBatch (journal.descriptor(), journal.payloadOffset(record), layout, schedule, record.batchFirst, record.batchCount, batch, options.stats);
+        processBatch();
+        writeInPlaceBatch (file.fd, layout, record, batch, options.stats);
+    }
+    
+    // Encryption runs back to front, decryption front to back. Sequence 0 is the record from before any batch.
+    unsigned long long done = record.batchCount ? record.batchFirst : layout.chunkCount;
+    if (operation == DECRYPT)
+        done = record.batchFirst + record.batchCount;
+    
+    while ((operation == ENCRYPT) ? done > 0 : done < layout.chunkCount)
+    {
+        unsigned long long first, count;
+        if (operation == ENCRYPT)
+        {
+            count = std::min (batchChunks, done);
+            first = done - count;
+            done = first;
+        }
+        else
+        {
+            count = std::min (batchChunks, layout.chunkCount - done);
+            first = done;
+            done += count;
+        }
+        
+        readInPlaceBatch (file.fd, layout.inputStart + first * layout.inputStride, layout, schedule, first, count, batch, options.stats);
+        
+        // Copy the batch's input into the journal, and only once it's safely there record that the batch is being written.
+        {
+            StageTimer timer (options.stats, CryptoStats::WRITE);
+            record.sequence++;
+            record.batchFirst = first;
+            record.batchCount = count;
+            record.payloadBytes = 0;
+            
+            unsigned int readOffset = (operation == ENCRYPT) ? 1 : 0;
+            for (unsigned long long k = 0; k < count; k++)
+            {
+                unsigned long long size = std::min (layout.inputStride, layout.inputLength - (first + k) * layout.inputStride);
+                writeAt (journal.descriptor(), batch[k].data.data() + readOffset, size, journal.payloadOffset(record) + k * layout.inputStride);
+                record.payloadBytes += size;
+            }
+            journal.commit (record);
+        }
+        
+        processBatch();
+        
+        // A first chunk that fails is almost always the wrong key - stop while the file is still as it was.
+        if (operation == DECRYPT && record.sequence == 1 && !report.badChunks.empty() && report.badChunks[0] == 0)
+        {
+            journal.remove();
+            throw (std::runtime_error("First chunk failed its checksum - probably the wrong key. The file was left as it was."));
+        }
+        
+        writeInPlaceBatch (file.fd, layout, record, batch, options.stats);
+    }
+    
+    if (operation == DECRYPT)
+    {
+        if (ftruncate (file.fd, layout.outputLength) != 0)
+            throw (std::runtime_error("Could not truncate file to its decrypted length."));
+        syncFile (file.fd);
+    }
+    
+    journal.remove();
+    
+    report.dataLength = (operation == ENCRYPT) ? layout.inputLength : layout.outputLength;
+    if (operation == DECRYPT)
+    {
+        FileHeader header;
+        decodeHeader (record.fileHeader, header);
+        report.lengthMatches = (header.originalLength == UNKNOWN_LENGTH || header.originalLength == layout.outputLength);
+    }
+    
+    if (options.stats)
+    {
+        options.stats->addFile();
+        options.stats->addChecksumFailures(report.badChunks.size());
+    }
+    
+    return report;
+#endif
+}
+
+UpdateReport updateEncryption (std::string datafilename, KeyScheduleCache & keys, std::string outputname, const CryptoOptions & options)
+{
+    /*
+     Brings outputname - encrypted earlier from an older copy of datafilename - up to date with the data as it is now, only
+     encrypting & writing the chunks that changed. The result is byte for byte what encrypting datafilename from scratch would give.
+     
+     Every chunk is encrypted on its own, at a place fixed by its index, so a chunk whose plain data hasn't changed encrypts to
+     exactly what's already in the file. Which chunks changed is found from the digest file (outputname + DIGEST_SUFFIX), if
+     there's one that still describes outputname: each chunk of the new data is digested and compared with the old digest, and the
+     encrypted file is only read to check the key. Without one, each old chunk is decrypted and compared with the new data instead -
+     slower, but it still only writes what changed, and a chunk that fails its checksum is rewritten too. Either way the digest file is
+     written afresh at the end, so the next update can use it.
+     
+     Chunks past the end of the old data, and the last chunk of the old & new data when the length changed, are always rewritten.
+     The chunk size is the encrypted file's own - options.chunkSize is not used. Nothing is journaled: an interrupted update leaves a
+     mix of old & new chunks, which running the update again finishes.
+     
+     Throws std::runtime_error if either file can't be opened, if the encrypted file has no header (encrypt it normally once first)
+     or is compressed, or if its first chunk fails its checksum - almost always the wrong key - in which case nothing has been written.
+     */
+    
+#ifdef _WIN32
+    throw (std::runtime_error("Updating an encrypted file is not available on this platform."));
+#else
+    
+    if (isStandardStream(datafilename) || isStandardStream(outputname))
+        throw (std::runtime_error("Updating needs files, not pipes."));
+    if (options.compress)
+        throw (std::runtime_error("Compressed files can't be updated - a changed chunk can change length, and move every chunk after it."));
+    if (datafilename == outputname)
+        throw (std::runtime_error("INPUT FILE CANNOT EQUAL OUTPUT FILE"));
+    
+    MappedFile dataFile;        // Never mapped - these only own the descriptors
+    MappedFile encryptedFile;
+    struct stat dataStats;
+    struct stat encryptedStats;
+    
+    dataFile.fd = open (datafilename.c_str(), O_RDONLY);
+    if (dataFile.fd < 0 || fstat(dataFile.fd, &dataStats) != 0)
+        throw (std::runtime_error("Could not open data file. Check that directory path is valid."));
+    
+    encryptedFile.fd = open (outputname.c_str(), O_RDWR);
+    if (encryptedFile.fd < 0 || fstat(encryptedFile.fd, &encryptedStats) != 0 || !S_ISREG(encryptedStats.st_mode))
+        throw (std::runtime_error("Could not open the encrypted file to update. Check that it exists and is writable."));
+    
+    // The old data's length & chunk size, from the header.
+    unsigned long long encryptedLength = encryptedStats.st_size;
+    unsigned int blocks[HEADER_BLOCKS] = {0};
+    FileHeader header;
+    {
+        StageTimer timer (options.stats, CryptoStats::DATA_READ);
+        readAt (encryptedFile.fd, blocks, std::min (encryptedLength, (unsigned long long)HEADER_SIZE), 0);
+    }
+    if (encryptedLength < HEADER_SIZE || !decodeHeader (blocks, header))
+        throw (std::runtime_error("Encrypted file has no header - it was written by an older version. Encrypt it once without --update first."));
+    if (isCompressed(header))
+        throw (std::runtime_error("Compressed files can't be updated - a changed chunk can change length, and move every chunk after it."));
+    
+    unsigned int chunkSize = header.chunkSize;
+    unsigned long long dataPerChunk = chunkSize - 4;
+    
+    unsigned long long oldLength = header.originalLength;
+    if (oldLength == UNKNOWN_LENGTH)
+    {
+        // Written to a pipe, so the header never got its length - work it out from the file's.
+        unsigned long long encryptedData = encryptedLength - HEADER_SIZE;
+        unsigned long long chunks = (encryptedData + chunkSize - 1) / chunkSize;
+        if (chunks == 0 || encryptedData < 4 * chunks || (encryptedData % chunkSize && encryptedData % chunkSize < 4))
+            throw (std::runtime_error("Encrypted file is too short to contain its checksum."));
+        oldLength = encryptedData - 4 * chunks;
+    }
+    
+    unsigned long long oldChunkCount = std::max (1ULL, (oldLength + dataPerChunk - 1) / dataPerChunk);
+    unsigned long long newLength = dataStats.st_size;
+    unsigned long long newChunkCount = std::max (1ULL, (newLength + dataPerChunk - 1) / dataPerChunk);
+    bool lengthChanged = (newLength != oldLength);
+    
+    DigestFile oldDigests;
+    bool usedDigests = readDigestFile (outputname + DIGEST_SUFFIX, oldDigests) && oldDigests.describes (encryptedStats)
+                       && oldDigests.chunkSize == chunkSize && oldDigests.dataLength == oldLength;
+    
+    const KeySchedule * schedule = loadSchedule (keys, chunkSize, options.stats);
+    
+    unsigned int threadCount = options.threadCount;
+    if (threadCount == 0)
+        threadCount = std::thread::hardware_concurrency();
+    if (threadCount == 0)
+        threadCount = 1;
+    
+    std::unique_ptr<ThreadPool> pool;
+    if (threadCount > 1)
+        pool.reset(new ThreadPool(threadCount));
+    
+    // Each batch holds the new data and, without digests, the old chunks to compare it with. Every block takes at least a page.
+    unsigned long long batchChunks = std::max ((unsigned long long)threadCount, IN_PLACE_BATCH_BYTES / std::max ((size_t)chunkSize, SecureArena::pageSize()));
+    batchChunks = std::min (batchChunks, newChunkCount);
+    SecureArena arena (chunkSize, 2 * batchChunks);
+    std::vector<Chunk> newChunks(batchChunks);
+    std::vector<Chunk> oldChunks(batchChunks);
+    for (unsigned int i = 0; i < batchChunks; i++)
+    {
+        newChunks[i].data.attach (arena, i);
+        oldChunks[i].data.attach (arena, batchChunks + i);
+    }
+    
+    // Reads old chunk index into chunk, ready to decrypt. False if the file doesn't hold all of it (an earlier update was cut short).
+    auto readOldChunk = [&] (unsigned long long index, Chunk & chunk) -> bool
+    {
+        unsigned long long start = index * chunkSize;
+        unsigned long long size = std::min ((unsigned long long)chunkSize, oldLength + 4 * oldChunkCount - start);
+        if (HEADER_SIZE + start + size > encryptedLength)
+            return false;
+        
+        chunk.keyStream = schedule->stream(index);
+        chunk.data.resize ((size + 3) / 4);
+        readAt (encryptedFile.fd, chunk.data.data(), size, HEADER_SIZE + start);
+        finishChunk (chunk, DECRYPT, chunkSize, size, index == oldChunkCount - 1);
+        
+        if (options.stats)
+            options.stats->addBytesRead(size);
+        return true;
+    };
+    
+    // Updating with the wrong key would leave a file of two keys - check it against the first chunk before writing anything.
+    {
+        bool readFirst;
+        {
+            StageTimer timer (options.stats, CryptoStats::DATA_READ);
+            readFirst = readOldChunk (0, oldChunks[0]);
+        }
+        if (readFirst)
+            processChunkTimed (oldChunks[0], DECRYPT, options.stats, false, false, false);
+        if (!readFirst || oldChunks[0].hashBefore != oldChunks[0].hashAfter)
+            throw (std::runtime_error("First chunk of the encrypted file failed its checksum - probably the wrong key. Nothing was changed."));
+    }
+    
+    UpdateReport report;
+    DigestFile newDigests;
+    newDigests.chunkSize = chunkSize;
+    newDigests.dataLength = newLength;
+    newDigests.digests.resize (newChunkCount);
+    std::vector<char> changed(batchChunks);
+    std::vector<char> compare(batchChunks);
+    
+    for (unsigned long long first = 0; first < newChunkCount; first += batchChunks)
+    {
+        unsigned long long count = std::min (batchChunks, newChunkCount - first);
+        
+        // Read the new data, and the old chunks to compare it with if there are no digests.
+        {
+            StageTimer timer (options.stats, CryptoStats::DATA_READ);
+            for (unsigned long long k = 0; k < count; k++)
+            {
+                unsigned long long index = first + k;
+                unsigned long long size = std::min (dataPerChunk, newLength - index * dataPerChunk);
+                Chunk & chunk = newChunks[k];
+                
+                chunk.keyStream = schedule->stream(index);
+                chunk.data.resize (std::min ((unsigned long long)chunkSize/4, 1 + (size + 3)/4));
+                readAt (dataFile.fd, chunk.data.data() + 1, size, index * dataPerChunk);
+                finishChunk (chunk, ENCRYPT, chunkSize, size, index == newChunkCount - 1);
+                
+                // A chunk whose length or place in the file changed is different whatever its data.
+                bool rewrite = index >= oldChunkCount || (lengthChanged && (index == oldChunkCount - 1 || index == newChunkCount - 1));
+                compare[k] = !rewrite && (usedDigests || readOldChunk (index, oldChunks[k]));
+                changed[k] = rewrite || !compare[k];
+                
+                if (options.stats)
+                {
+                    options.stats->addChunks(1);
+                    options.stats->addBytesRead(size);
+                }
+            }
+        }
+        
+        // Digest, compare, and encrypt whatever changed.
+        auto updateChunk = [&] (unsigned long long k)
+        {
+            StageTimer timer (options.stats, CryptoStats::CIPHER);
+            unsigned long long index = first + k;
+            Chunk & chunk = newChunks[k];
+            unsigned long long size = chunk.writeSize - 4;
+            
+            chunk.digest = chunkDigest ((const unsigned char *)(chunk.data.data() + 1), size);
+            newDigests.digests[index] = chunk.digest;
+            
+            if (compare[k])
+            {
+                if (usedDigests)
+                    changed[k] = (chunk.digest != oldDigests.digests[index]);
+                else
+                {
+                    Chunk & old = oldChunks[k];
+                    processChunk (old, DECRYPT);
+                    changed[k] = old.hashBefore != old.hashAfter || old.writeSize != size
+                                 || memcmp (old.data.data() + 1, chunk.data.data() + 1, size) != 0;
+                }
+            }
+            
+            if (changed[k])
+                processChunk (chunk, ENCRYPT);
+        };
+        
+        if (pool && count > 1)
+        {
+            for (unsigned long long k = 0; k < count; k++)
+                pool->submit([&updateChunk, k] { updateChunk(k); });
+            pool->wait();
+        }
+        else
+        {
+            for (unsigned long long k = 0; k < count; k++)
+                updateChunk (k);
+        }
+        
+        // Write back only the chunks that changed, each where it belongs.
+        {
+            StageTimer timer (options.stats, CryptoStats::WRITE);
+            for (unsigned long long k = 0; k < count; k++)
+            {
+                if (!changed[k])
+                    continue;
+                
+                const Chunk & chunk = newChunks[k];
+                writeAt (encryptedFile.fd, chunk.data.data(), chunk.writeSize, HEADER_SIZE + (first + k) * chunkSize);
+                report.chunksWritten++;
+                if (options.stats)
+                    options.stats->addBytesWritten(chunk.writeSize);
+            }
+        }
+    }
+    
+    // New length into the header, then cut off whatever is past the end of the new data.
+    {
+        StageTimer timer (options.stats, CryptoStats::WRITE);
+        if (header.originalLength != newLength)
+        {
+            setOriginalLength (header, newLength);
+            encodeHeader (header, blocks);
+            writeAt (encryptedFile.fd, blocks, HEADER_SIZE, 0);
+        }
+        
+        unsigned long long newEncryptedLength = HEADER_SIZE + newLength + 4 * newChunkCount;
+        if (encryptedLength > newEncryptedLength && ftruncate (encryptedFile.fd, newEncryptedLength) != 0)
+            throw (std::runtime_error("Could not truncate the encrypted file to its new length."));
+        
+        if (fstat (encryptedFile.fd, &encryptedStats) != 0)
+            throw (std::runtime_error("Could not read the encrypted file's modification time for its digest file."));
+        newDigests.stamp (encryptedStats);
+        writeDigestFile (outputname + DIGEST_SUFFIX, newDigests);
+    }
+    
+    if (options.stats)
+        options.stats->addFile();
+    
+    report.dataLength = newLength;
+    report.chunkCount = newChunkCount;
+    report.usedDigests = usedDigests;
+    return report;
+#endif
+}
+
+unsigned long long encryption (std::string datafilename, std::string keyfilename, std::string outputname, const CryptoOptions & options)
+{
+    /*
+     Reads in data and key from file paths passed in. Hashes data into checksum, 
+     Encrypts data+checksum and writes out to output path passed in.
+     
+     Returns the size of the data file encrypted, in bytes - 64 bits, since files can be larger than 4GB.
+     
+     Throws exception if filepaths cannot be opened.
+     */
+    
+    // Input file & output file cannot be equal - except in place, where there's only the one file.
+    if (datafilename == outputname && !isStandardStream(datafilename) && !options.inPlace)
+        throw std::runtime_error ("INPUT FILE CANNOT EQUAL OUTPUT FILE");
+    
+    std::unique_ptr<KeyScheduleCache> keys;
+    {
+        StageTimer timer (options.stats, CryptoStats::KEY_READ);
+        keys.reset(new KeyScheduleCache(keyfilename));
+    }
+    return encryption (datafilename, *keys, outputname, options);
+}
+
+unsigned long long encryption (std::string datafilename, KeyScheduleCache & keys, std::string outputname, const CryptoOptions & options)
+{
+    /*
+     Same as above, with a key that has already been loaded - so one key can be used for many files without re-reading it.
+     With options.inPlace, datafilename is encrypted over itself (see cryptInPlace()) and outputname is ignored.
+     With options.update, outputname is brought up to date instead of written from scratch (see updateEncryption()).
+     With options.writeDigests, every chunk's digest is written to outputname + DIGEST_SUFFIX once it's done, for a later update.
+     With options.writeCrcs, every stored chunk's CRC32C is written to outputname + CRC_SUFFIX, for a later scrubFile().
+     */
+    
+    if (options.inPlace)
+        return cryptInPlace (datafilename, keys, ENCRYPT, options).dataLength;
+    
+    if (options.update)
+        return updateEncryption (datafilename, keys, outputname, options).dataLength;
+    
+    if (options.writeDigests && isStandardStream(outputname))
+        throw (std::runtime_error("Digests can only be written alongside an output file, not a pipe."));
+    
+    if (options.writeCrcs && isStandardStream(outputname))
+        throw (std::runtime_error("Chunk CRCs can only be written alongside an output file, not a pipe."));
+    
+    CryptoFiles files;
+    std::vector<unsigned int> hashesBefore;
+    std::vector<unsigned int> hashesAfter;
+    std::vector<unsigned long long> digests;
+    std::vector<ChunkCrc> crcs;
+    if (options.writeDigests)
+        files.digests = &digests;
+    if (options.writeCrcs)
+        files.crcs = &crcs;
+    
+    // Pipes can't be mapped, so they are always read in chunks - as is compressed output, whose frames vary in length,
+    // and output with chunk CRCs, which are taken from each chunk as it's written.
+    if (options.mapped && !options.compress && !options.writeCrcs && !isStandardStream(datafilename) && !isStandardStream(outputname))
+        runMapped (datafilename, keys, outputname, ENCRYPT, options, files, hashesBefore, hashesAfter);
+    else
+    {
+        openFiles (datafilename, outputname, ENCRYPT, options, files);
+        files.schedule = loadSchedule (keys, files.header.chunkSize, options.stats);
+        runChunks (files, ENCRYPT, options, hashesBefore, hashesAfter);
+        closeFiles (files, ENCRYPT);
+    }
+    
+    // Stamped with the finished file's length & time - any later change to it without a new sidecar makes this one stale.
+    if (options.writeDigests)
+    {
+        StageTimer timer (options.stats, CryptoStats::WRITE);
+        DigestFile sidecar;
+        sidecar.chunkSize = files.header.chunkSize;
+        sidecar.dataLength = files.dataLength;
+        sidecar.digests.swap (digests);
+        
+        struct stat outputStats;
+        if (stat (outputname.c_str(), &outputStats) != 0)
+            throw (std::runtime_error("Could not read output file's modification time for its digest file."));
+        sidecar.stamp (outputStats);
+        writeDigestFile (outputname + DIGEST_SUFFIX, sidecar);
+    }
+    
+    if (options.writeCrcs)
+        writeCrcSidecar (outputname, files.header.chunkSize, crcs, options.stats);
+    
+    if (options.stats)
+        options.stats->addFile();
+    
+    return files.dataLength;
+}
+
+std::pair<unsigned long long,bool> decryption (std::string datafilename, std::string keyfilename, std::string outputname, const CryptoOptions & options)
+{
+    /*
+     Reads in encrypted data and key from file paths passed in. Decrypts encrypted data,
+     pulls out pre-encrypted checksum & computes checksum of now decrypted data.
+     Writes out decrypted data to output path.
+     
+     Returns pair of unsigned long long & bool. The first is the size of the data read in (bytes, 64 bits), and the bool is based on the comparison of the checksums, to see if they're equal.
+     
+     Throws std::runtime_error exception if filepaths cannot be opened.
+     */
+    
+    // Input file cannot equal output file, unless decrypting in place
+    if (datafilename == outputname && !isStandardStream(datafilename) && !options.inPlace)
+        throw (std::runtime_error("INPUT FILE CANNOT EQUAL OUTPUT FILE"));
+    
+    std::unique_ptr<KeyScheduleCache> keys;
+    {
+        StageTimer timer (options.stats, CryptoStats::KEY_READ);
+        keys.reset(new KeyScheduleCache(keyfilename));
+    }
+    return decryption (datafilename, *keys, outputname, options);
+}
+
+std::pair<unsigned long long,bool> decryption (std::string datafilename, KeyScheduleCache & keys, std::string outputname, const CryptoOptions & options)
+{
+    /*
+     Same as above, with a key that has already been loaded. The chunk size comes from the file's header.
+     An empty outputname only verifies the checksums, without writing the decrypted data anywhere.
+     */
+    
+    ChecksumReport report = decryptionReport (datafilename, keys, outputname, options);
+    
+    return std::pair<unsigned long long,bool>(report.dataLength,report.passed());  // Return size of data & Return true if decryption matches the hash.
+}
+
+ChecksumReport decryptionReport (std::string datafilename, KeyScheduleCache & keys, std::string outputname, const CryptoOptions & options)
+{
+    /*
+     Same as decryption(), but reports which chunks failed their checksums instead of just whether they all passed.
+     Every chunk is compared to its own checksum, so two bad chunks can't cancel each other out.
+     */
+    
+    if (options.inPlace)
+        return cryptInPlace (datafilename, keys, DECRYPT, options);
+    
+    if (options.rangeOffset != 0 || options.rangeLength != TO_END_OF_FILE)
+        return decryptRange (datafilename, keys, outputname, options);
+    
+    CryptoFiles files;
+    std::vector<unsigned int> hashesBefore;
+    std::vector<unsigned int> hashesAfter;
+    ChecksumReport report;
+    
+    // Mapped mode needs an output file to map into, so verifying alone always reads in chunks - as do pipes.
+    if (options.mapped && !outputname.empty() && !isStandardStream(datafilename) && !isStandardStream(outputname))
+        runMapped (datafilename, keys, outputname, DECRYPT, options, files, hashesBefore, hashesAfter);
+    else
+    {
+        openFiles (datafilename, outputname, DECRYPT, options, files);
+        files.schedule = loadSchedule (keys, files.header.chunkSize, options.stats);
+        runChunks (files, DECRYPT, options, hashesBefore, hashesAfter);
+        closeFiles (files, DECRYPT);
+    }
+    
+    for (unsigned long long i = 0; i < hashesBefore.size(); i++)
+        if (hashesBefore[i] != hashesAfter[i])
+            report.badChunks.push_back(i);
+    
+    report.dataLength = files.dataLength;
+    report.stoppedEarly = files.stopped;
+    
+    // Dropping whole chunks off the end of a file leaves every remaining checksum intact - the length in the header catches that.
+    // A run stopped early hasn't seen the whole file, so its length says nothing.
+    if (!files.stopped)
+        report.lengthMatches = (files.header.originalLength == UNKNOWN_LENGTH || files.header.originalLength == files.outputLength);
+    
+    if (options.stats)
+    {
+        options.stats->addFile();
+        options.stats->addChecksumFailures(report.badChunks.size());
+    }
+    
+    return report;
+}
+
+ChecksumReport rekeyEncryption (std::string datafilename, KeyScheduleCache & oldKeys, KeyScheduleCache & newKeys, std::string outputname, const CryptoOptions & options)
+{
+    /*
+     Moves an encrypted file from oldKeys to newKeys, writing the result to outputname - for rotating keys.
+
+     It's one pass through the file, and the data is never decrypted (see rekeyChunk()): each chunk's encrypted data is converted
+     straight from one key stream to the other. So it's one read & one write instead of a decryption and an encryption, and no
+     plain copy is ever written out, not even to a temporary file.
+
+     Every chunk is checked against its checksum on the way through, and the report says which didn't match, the same as
+     decryptionReport() - an old key that isn't the one the file was encrypted with fails every chunk. A bad chunk is still moved to
+     the new key, exactly as damaged as it was, so decrypting the output fails on the same chunks instead of hiding the damage.
+
+     The output has the same chunk size & format as the input - a compressed file stays compressed, frame for frame. A file from
+     before headers gets a header for its LEGACY_CHUNK_SIZE chunks. Runs through the chunk loops with options' threads, pipelining
+     & direct I/O. Mapped mode, in place & ranges don't apply. With options.writeCrcs the output gets a CRC sidecar, as encryption() does.
+
+     Throws std::runtime_error if either file can't be opened, or there's no output to write to.
+     */
+
+    if (outputname.empty())
+        throw (std::runtime_error("Rekeying needs an output file."));
+
+    if (options.writeCrcs && isStandardStream(outputname))
+        throw (std::runtime_error("Chunk CRCs can only be written alongside an output file, not a pipe."));
+
+    CryptoFiles files;
+    std::vector<unsigned int> hashesBefore;
+    std::vector<unsigned int> hashesAfter;
+    std::vector<ChunkCrc> crcs;
+    ChecksumReport report;
+    if (options.writeCrcs)
+        files.crcs = &crcs;
+
+    openFiles (datafilename, outputname, DECRYPT, options, files);
+    files.schedule = loadSchedule (oldKeys, files.header.chunkSize, options.stats);
+    files.rekeySchedule = loadSchedule (newKeys, files.header.chunkSize, options.stats);
+    files.writeFrames = isCompressed(files.header);
+
+    // The header isn't encrypted, and says the same about the data under the new key.
+    FileHeader header = files.header;
+    if (header.version == 0)
+        header.version = FORMAT_VERSION;
+
+    unsigned int blocks[HEADER_BLOCKS];
+    encodeHeader (header, blocks);
+    files.output->write((const char*)blocks, HEADER_SIZE);
+
+    runChunks (files, DECRYPT, options, hashesBefore, hashesAfter);
+    closeFiles (files, DECRYPT);
+
+    // CRCs of the output as written - a chunk that failed its checksum was moved over as damaged as it was, and so is its CRC.
+    if (options.writeCrcs)
+        writeCrcSidecar (outputname, files.header.chunkSize, crcs, options.stats);
+
+    for (unsigned long long i = 0; i < hashesBefore.size(); i++)
+        if (hashesBefore[i] != hashesAfter[i])
+            report.badChunks.push_back(i);
+
+    report.dataLength = files.dataLength;
+    report.stoppedEarly = files.stopped;
+
+    // Nothing is decrypted, so the header's length is checked against the chunks read - and for an uncompressed file,
+    // against the encrypted length less a checksum per chunk.
+    unsigned long long originalLength = files.header.originalLength;
+    if (!files.stopped && originalLength != UNKNOWN_LENGTH)
+    {
+        unsigned long long chunkData = files.header.chunkSize - 4;
+        unsigned long long chunkCount = std::max ((originalLength + chunkData - 1) / chunkData, 1ULL);
+        report.lengthMatches = (chunkCount == files.chunksRead) && (isCompressed(files.header) || originalLength == files.dataLength - 4 * files.chunksRead);
+    }
+
+    if (options.stats)
+    {
+        options.stats->addFile();
+        options.stats->addChecksumFailures(report.badChunks.size());
+    }
+
+    return report;
+}
+
+ScrubReport scrubFile (std::string filename, std::string copyname, unsigned int workerCount)
+{
+    /*
+     Checks every chunk of an encrypted file against the CRC its sidecar (filename + CRC_SUFFIX, written with --crc) has for it.
+     Without the key and without decrypting anything - it's a read of the file and a CRC32C (ws-chunkCrc.h), so it runs at disk speed.
+     
+     The file is split into workerCount ranges of chunks (0 for one per core), each read & checked by its own thread through its own stream.
+     
+     If copyname isn't empty, every damaged chunk - and the header, if it's damaged - is read from the same place in copyname, and written
+     back into the file if the copy's bytes match the CRC. Chunks the copy has lost too are left as they are, and reported. Once anything
+     has been repaired the sidecar is stamped with the file as it is now, since every chunk it lists is back the way it was written.
+     
+     Throws std::runtime_error if there's no usable sidecar, the file has been changed since the sidecar was written (so it no longer
+     describes it - repairing would put old data back over new), or the file can't be read or written.
+     */
+    
+    if (isStandardStream(filename) || isStandardStream(copyname))
+        throw (std::runtime_error("Scrubbing needs the encrypted file itself, not a pipe."));
+    
+    std::string sidecarname = filename + CRC_SUFFIX;
+    CrcFile sidecar;
+    if (!readCrcFile (sidecarname, sidecar))
+        throw (std::runtime_error("No usable checksum file " + sidecarname + " - encrypt or rekey with --crc to write one."));
+    
+    struct stat fileStats;
+    if (stat (filename.c_str(), &fileStats) != 0)
+        throw (std::runtime_error("Could not open file."));
+    if (!sidecar.describes (fileStats))
+        throw (std::runtime_error("The file has changed since " + sidecarname + " was written - its CRCs are out of date."));
+    
+    ScrubReport report;
+    report.chunkCount = sidecar.chunks.size();
+    
+    unsigned int blocks[HEADER_BLOCKS];
+    {
+        std::ifstream file (filename.c_str(), std::ios::in | std::ios::binary);
+        if (!file.read ((char *)blocks, HEADER_SIZE))
+            throw (std::runtime_error("Could not read file."));
+    }
+    report.headerDamaged = (crc32c (0, blocks, HEADER_SIZE) != sidecar.headerCrc);
+    
+    if (workerCount == 0)
+        workerCount = std::thread::hardware_concurrency();
+    unsigned long long rangeCount = std::max (std::min ((unsigned long long)workerCount, report.chunkCount), 1ULL);
+    std::vector<std::vector<unsigned long long> > damaged (rangeCount);
+    
+    if (rangeCount > 1)
+    {
+        ThreadPool pool(rangeCount);
+        for (unsigned long long i = 0; i < rangeCount; i++)
+        {
+            unsigned long long first = report.chunkCount * i / rangeCount;
+            unsigned long long end = report.chunkCount * (i + 1) / rangeCount;
+            std::vector<unsigned long long> * found = &damaged[i];
+            pool.submit([&filename, &sidecar, first, end, found] { scrubChunks (filename, sidecar, first, end, *found); });
+        }
+        pool.wait();
+    }
+    else
+        scrubChunks (filename, sidecar, 0, report.chunkCount, damaged[0]);
+    
+    for (unsigned long long i = 0; i < rangeCount; i++)
+        report.badChunks.insert (report.badChunks.end(), damaged[i].begin(), damaged[i].end());
+    
+    if (copyname.empty() || (report.badChunks.empty() && !report.headerDamaged))
+        return report;
+    
+    // Repair - only bytes that match their CRC are written, so a bad copy can't make the file any worse.
+    std::ifstream copy (copyname.c_str(), std::ios::in | std::ios::binary);
+    std::fstream file (filename.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+    if (!copy.is_open())
+        throw (std::runtime_error("Could not open copy " + copyname + "."));
+    if (!file.is_open())
+        throw (std::runtime_error("Could not open file for writing."));
+    
+    if (report.headerDamaged && copy.read ((char *)blocks, HEADER_SIZE) && crc32c (0, blocks, HEADER_SIZE) == sidecar.headerCrc)
+    {
+        file.seekp (0);
+        file.write ((const char *)blocks, HEADER_SIZE);
+        report.headerRepaired = true;
+    }
+    
+    std::vector<char> buffer (sidecar.chunkSize + 4);
+    for (unsigned long long i = 0; i < report.badChunks.size(); i++)
+    {
+        const ChunkCrc & chunk = sidecar.chunks[report.badChunks[i]];
+        if (!chunkMatches (copy, chunk, buffer))
+            continue;
+        
+        file.seekp (chunk.offset);
+        file.write (&buffer[0], chunk.length);
+        report.repairedChunks.push_back(report.badChunks[i]);
+    }
+    
+    file.close();
+    if (file.fail())
+        throw (std::runtime_error("Could not write repaired chunks to file."));
+    
+    if (report.headerRepaired || !report.repairedChunks.empty())
+    {
+        if (stat (filename.c_str(), &fileStats) != 0)
+            throw (std::runtime_error("Could not read file's modification time for its checksum file."));
+        sidecar.stamp (fileStats);
+        writeCrcFile (sidecarname, sidecar);
+    }
+    
+    return report;
+}
+
+void scrubChunks (std::string filename, const CrcFile & sidecar, unsigned long long first, unsigned long long end, std::vector<unsigned long long> & damaged)
+{
+    // One thread's share of scrubFile() - chunks [first, end), read in order through a stream of its own.
+    std::ifstream file (filename.c_str(), std::ios::in | std::ios::binary);
+    if (!file.is_open())
+        throw (std::runtime_error("Could not open file."));
+    
+    std::vector<char> buffer (sidecar.chunkSize + 4);
+    for (unsigned long long i = first; i < end; i++)
+        if (!chunkMatches (file, sidecar.chunks[i], buffer))
+            damaged.push_back(i);
+}
+
+bool chunkMatches (std::istream & file, const ChunkCrc & chunk, std::vector<char> & buffer)
+{
+    // Reads one stored chunk into buffer, and checks it against its CRC. A chunk that can't be read at all doesn't match.
+    file.clear();
+    file.seekg (chunk.offset);
+    if (!file.read (&buffer[0], chunk.length))
+        return false;
+    
+    return crc32c (0, &buffer[0], chunk.length) == chunk.crc;
+}
+
+ChecksumReport decryptRange (std::string datafilename, KeyScheduleCache & keys, std::string outputname, const CryptoOptions & options)
+{
+    /*
+     Decrypts only bytes [options.rangeOffset, options.rangeOffset + options.rangeLength) of the plain data, clipped to the end of the data.
+     
+     Every chunk holds chunkSize-4 bytes of data, so the chunks holding the range are found by division and read straight
+     from their place in the file, and chunk N is decrypted with the key stream for chunk N - nothing before them is touched.
+     Only those chunks' checksums are checked, each one on its own.
+     
+     A compressed file's frames vary in length, so the frame words in front of the range are read to find its first frame -
+     only 4 bytes per frame. The length of the data comes from the header, so it has to have been encrypted from a file, not a pipe.
+     
+     Returns the chunks that failed, like decryptionReport(), with dataLength set to the number of bytes written out.
+     
+     Throws std::runtime_error if files can't be opened, or the data is a pipe, which can't be seeked.
+     */
+    
+    if (isStandardStream(datafilename))
+        throw (std::runtime_error("Decrypting a range needs an encrypted file, not a pipe - it has to seek to the range."));
+    
+    CryptoFiles files;
+    ChecksumReport report;
+    unsigned long long offset = options.rangeOffset;
+    unsigned long long length = options.rangeLength;
+    
+    // A range is a few seeks & reads - it always goes through the page cache.
+    CryptoOptions rangeOptions = options;
+    rangeOptions.directIO = false;
+    openFiles (datafilename, outputname, DECRYPT, rangeOptions, files);
+    files.schedule = loadSchedule (keys, files.header.chunkSize, options.stats);
+    
+    // Find where the data starts, and how much of it there is.
+    unsigned long long headerSize = files.header.version ? HEADER_SIZE : 0;
+    files.datafilestream.clear();
+    files.datafilestream.seekg(0, std::ios::end);
+    unsigned long long fileLength = files.datafilestream.tellg();
+    
+    unsigned long long chunkSize = files.header.chunkSize;
+    unsigned long long dataPerChunk = chunkSize - 4;
+    unsigned long long encryptedLength = fileLength - headerSize;
+    unsigned long long dataLength;
+    bool framed = isCompressed(files.header);
+    
+    if (framed)
+    {
+        if (files.header.originalLength == UNKNOWN_LENGTH)
+            throw (std::runtime_error("Decrypting a range of a compressed file needs the length in its header, and this one was encrypted from a pipe."));
+        dataLength = files.header.originalLength;
+    }
+    else
+    {
+        unsigned long long chunkCount = (encryptedLength + chunkSize - 1) / chunkSize;
+        if (chunkCount == 0 || (encryptedLength % chunkSize && encryptedLength % chunkSize < 4))
+            throw (std::runtime_error("Encrypted file is too short to contain its checksum."));
+        
+        dataLength = encryptedLength - 4 * chunkCount;
+        report.lengthMatches = (files.header.originalLength == UNKNOWN_LENGTH || files.header.originalLength == dataLength);
+    }
+    
+    // Clip the range to the data.
+    if (offset > dataLength)
+        offset = dataLength;
+    if (length > dataLength - offset)
+        length = dataLength - offset;
+    
+    if (length)
+    {
+        unsigned long long firstChunk = offset / dataPerChunk;
+        unsigned long long lastChunk = (offset + length - 1) / dataPerChunk;
+        
+        // Seek straight to the first chunk - or for frames, hop from one frame word to the next until it's reached.
+        // Anything read looking for a header is from before it.
+        if (framed)
+        {
+            StageTimer timer (files.stats, CryptoStats::DATA_READ);
+            files.datafilestream.seekg(headerSize, std::ios::beg);
+            for (unsigned long long i = 0; i < firstChunk; i++)
+            {
+                unsigned int frameWord;
+                if (!files.datafilestream.read((char*)&frameWord, 4))
+                    throw (std::runtime_error("Compressed file ends before the range - it has been truncated."));
+                files.datafilestream.seekg(4 + ((frameWord & FRAME_LENGTH_MASK) + 3) / 4 * 4, std::ios::cur);
+            }
+        }
+        else
+            files.datafilestream.seekg(headerSize + firstChunk * chunkSize, std::ios::beg);
+        files.pending.clear();
+        files.pendingRead = 0;
+        files.chunksRead = firstChunk;
+        
+        SecureArena arena (chunkSize, 1);
+        Chunk chunk;
+        chunk.data.attach (arena, 0);
+        for (unsigned long long i = firstChunk; i <= lastChunk; i++)
+        {
+            readChunk (files, DECRYPT, chunk);
+            processChunkTimed (chunk, DECRYPT, files.stats, false, framed, false);
+            
+            if (chunk.hashBefore != chunk.hashAfter)
+            {
+                report.badChunks.push_back(i);
+                if (options.stopOnBadChunk)
+                {
+                    report.stoppedEarly = true;
+                    break;
+                }
+            }
+            
+            // Part of this chunk's data inside the range
+            unsigned long long chunkStart = i * dataPerChunk;
+            unsigned long long sliceStart = (offset > chunkStart) ? offset - chunkStart : 0;
+            unsigned long long sliceEnd = offset + length - chunkStart;
+            if (sliceEnd > chunk.writeSize)
+                sliceEnd = chunk.writeSize;
+            
+            if (files.output)
+            {
+                StageTimer timer (files.stats, CryptoStats::WRITE);
+                files.output->write((const char*)(chunk.data.data() + chunk.writeOffset) + sliceStart, sliceEnd - sliceStart);
+                if (files.stats)
+                    files.stats->addBytesWritten(sliceEnd - sliceStart);
+            }
+            report.dataLength += sliceEnd - sliceStart;
+        }
+    }
+    
+    closeFiles (files, DECRYPT);
+    
+    if (options.stats)
+    {
+        options.stats->addFile();
+        options.stats->addChecksumFailures(report.badChunks.size());
+    }
+    
+    return report;
+}
+
+void timePrint (double time1, double time2, unsigned long long dataSize)
+{
+    /*
+     Calculates and prints to console the data speed of a given operation.
+     
+     time1 & time2 are the times before and after the operation.
+     dataSize is the size (in bytes) of the data operated on - what encryption() & decryption() return.
+     
+     */
+    
+    int byteCounter = 0;
+    
+    double bytesPerSecond = dataSize/(time2-time1);
+    
+    if (bytesPerSecond > 1024)
+    {
+        byteCounter = KILOBYTES;
+        bytesPerSecond = bytesPerSecond / 1024;
+    }
+    
+    if (bytesPerSecond > 1024)
+    {
+        byteCounter = MEGABYTES;
+        bytesPerSecond = bytesPerSecond / 1024;
+    }
+    
+    if (bytesPerSecond > 1024)
+    {
+        byteCounter = GIGABYTES;
+        bytesPerSecond = bytesPerSecond / 1024;
+    }
+    
+    std::string byteUnits;
+    switch (byteCounter)
+    {
+        case (BYTES):
+            byteUnits = "B/s";
+            break;
+        case (KILOBYTES):
+            byteUnits = "KB/s";
+            break;
+        case (MEGABYTES):
+            byteUnits = "MB/s";
+            break;
+        default: 
+            byteUnits = "GB/s";
+    }
+    
+    std::cout << "\n Processed at an average rate of: " << bytesPerSecond << " " << byteUnits << std::endl << std::endl;
+    
+}
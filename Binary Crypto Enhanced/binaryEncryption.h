@@ -0,0 +1,85 @@
+/*
+    File encryption entry points from binaryEncryption.cpp, for programs built along with it (the benchmark) instead of through its menu.
+
+    binaryEncryption.cpp is compiled with WS_NO_MAIN defined when another file provides main().
+
+    Written by William Showalter. williamshowalter@gmail.com.
+
+    Released under Creative Commons - creativecommons.org/licenses/by-nc-sa/3.0/
+    Attribution-NonCommercial-ShareAlike 3.0 Unported (CC BY-NC-SA 3.0)
+*/
+
+#ifndef BINARYENCRYPTION_H
+#define BINARYENCRYPTION_H
+
+#include <string>       // std::string file paths
+#include <utility>      // std::pair
+
+#include "ws-cryptoBuffer.h"
+#include "ws-cryptoStats.h"
+#include "ws-keySchedule.h"
+
+const unsigned int MAX_FILE_SIZE = 1024 * 1024;       // 1MB. Default chunk size - maximum vector size, to avoid reading entire file (which could bad_alloc and has non-optimal performance).
+const unsigned long long TO_END_OF_FILE = 0xFFFFFFFFFFFFFFFFULL;   // Range length that runs to the end of the data
+const unsigned int DEFAULT_QUEUE_DEPTH = 8;                        // Direct I/O - slabs in flight per file
+
+// How encryption() & decryption() process the file.
+struct CryptoOptions
+{
+    unsigned int threadCount;           // 1 = serial, 0 = one worker thread per core, otherwise number of chunks processed at once
+    bool pipelined;                     // Read, encrypt/decrypt and write on separate threads so disk I/O overlaps with the cipher
+    bool mapped;                        // Memory map the files and encrypt/decrypt straight from the input mapping to the output mapping
+    unsigned int chunkSize;             // Encryption only - bytes per encrypted chunk. Decryption reads it from the file's header.
+    unsigned long long rangeOffset;     // Decryption only - byte range of the plain data to decrypt. Whole file by default.
+    unsigned long long rangeLength;
+    bool stopOnBadChunk;                // Decryption only - stop at the first chunk that fails its checksum, instead of finishing the file
+    bool inPlace;                       // Rewrite the data file itself, with a journal to recover from interruptions (Linux & Mac). outputname is left empty.
+    bool writeDigests;                  // Encryption only - also write each chunk's digest to outputname + DIGEST_SUFFIX, for a later update (ws-chunkDigest.h)
+    bool writeCrcs;                     // Encryption & rekeying only - also write a CRC32C of every chunk as stored to outputname + CRC_SUFFIX, for scrubFile() (ws-chunkCrc.h)
+    bool update;                        // Encryption only - outputname was encrypted from an older copy of the data. Rewrite just the chunks that changed (see updateEncryption()).
+    bool compress;                      // Encryption only - compress each chunk before it's encrypted, and write it as a frame (ws-fileHeader.h)
+    bool directIO;                      // Read & write the files with O_DIRECT, queueDepth slabs ahead, instead of through the page cache (ws-directIO.h, Linux & Mac).
+                                        // Whole files through the chunk loops only - pipes, ranges, -m, in-place, update & tree mode's split files are unaffected.
+    unsigned int queueDepth;            // directIO only - slabs in flight per file, each way
+    bool directUring;                   // directIO only - queue the slabs with io_uring when the kernel has it. False always uses pread/pwrite threads.
+    KeyScheduleCache * rekeyKeys;       // Batch mode only - when set, each entry is moved to this key by rekeyEncryption() instead of decrypted
+    CryptoStats * stats;                // NULL for no instrumentation. Otherwise each run adds its stage times & counts to it (ws-cryptoStats.h).
+
+    CryptoOptions () : threadCount(1), pipelined(false), mapped(false), chunkSize(MAX_FILE_SIZE), rangeOffset(0), rangeLength(TO_END_OF_FILE), stopOnBadChunk(false), inPlace(false), writeDigests(false), writeCrcs(false), update(false), compress(false), directIO(false), queueDepth(DEFAULT_QUEUE_DEPTH), directUring(true), rekeyKeys(NULL), stats(NULL) {}
+};
+
+// Outcome of updateEncryption().
+struct UpdateReport
+{
+    unsigned long long dataLength;      // Bytes of plain data the encrypted file holds now
+    unsigned long long chunkCount;
+    unsigned long long chunksWritten;   // Chunks that changed, and were encrypted & written again
+    bool usedDigests;                   // False if there was no usable digest file, so unchanged chunks were found by decrypting & comparing
+
+    UpdateReport () : dataLength(0), chunkCount(0), chunksWritten(0), usedDigests(false) {}
+};
+
+// Outcome of scrubFile().
+struct ScrubReport
+{
+    unsigned long long chunkCount;
+    bool headerDamaged;                 // The header no longer matches its CRC
+    bool headerRepaired;
+    std::vector<unsigned long long> badChunks;      // Chunks that no longer match their CRC, in file order
+    std::vector<unsigned long long> repairedChunks; // Those of them rewritten from the copy - a chunk the copy has damaged too stays bad
+
+    ScrubReport () : chunkCount(0), headerDamaged(false), headerRepaired(false) {}
+};
+
+unsigned long long              encryption(std::string datafilename, std::string keyfilename, std::string outputname, const CryptoOptions & options = CryptoOptions());
+unsigned long long              encryption(std::string datafilename, KeyScheduleCache & keys, std::string outputname, const CryptoOptions & options = CryptoOptions());
+std::pair<unsigned long long,bool> decryption(std::string datafilename, std::string keyfilename, std::string outputname, const CryptoOptions & options = CryptoOptions());
+std::pair<unsigned long long,bool> decryption(std::string datafilename, KeyScheduleCache & keys, std::string outputname, const CryptoOptions & options = CryptoOptions());
+ChecksumReport                  decryptionReport(std::string datafilename, KeyScheduleCache & keys, std::string outputname, const CryptoOptions & options = CryptoOptions());
+UpdateReport                    updateEncryption (std::string datafilename, KeyScheduleCache & keys, std::string outputname, const CryptoOptions & options = CryptoOptions());
+ChecksumReport                  cryptInPlace (std::string filename, KeyScheduleCache & keys, OPERATION operation, const CryptoOptions & options = CryptoOptions());
+ChecksumReport                  rekeyEncryption (std::string datafilename, KeyScheduleCache & oldKeys, KeyScheduleCache & newKeys, std::string outputname, const CryptoOptions & options = CryptoOptions());
+ScrubReport                     scrubFile (std::string filename, std::string copyname, unsigned int workerCount);
+bool                            parseSize (std::string text, unsigned long long & size);
+
+#endif
@@ -0,0 +1,211 @@
+/*
+    Checks the encryption & hashing kernels against the round by round cipher - built & run by "make check-kernels",
+    once linked with the assembly kernels (kernelCheck, 32bit) and once with ws-cryptoLib64.cpp (kernelCheck64, every version
+    the processor supports), along with kernelCheck.sh's round trips of files between cryptoUtil and cryptoUtil64.
+
+    The expected words are worked out the slow way, as the protocol in ws-cryptoLibEnc.nasm describes it: 16 rounds of xor with
+    the key then rotate by 1, not the folded key stream the kernels use. Every kernel is run over array lengths either side of
+    the vector widths and key lengths that do & don't divide them, and each kernel's output is decrypted again by the same build.
+
+    Prints KERNELS OK and returns 0, or prints the first mismatch and returns 1.
+
+    Written by William Showalter. williamshowalter@gmail.com.
+
+    Released under Creative Commons - creativecommons.org/licenses/by-nc-sa/3.0/
+    Attribution-NonCommercial-ShareAlike 3.0 Unported (CC BY-NC-SA 3.0)
+*/
+
+#include <iostream>     // Result
+#include <string>       // Kernel version names
+#include <vector>       // STL Container std::vector
+
+#include "ws-cryptoLib.h"
+
+const unsigned int CHECK_MAX_WORDS = 70;                    // Past two AVX2 steps and a tail, either side of every vector width
+const unsigned int CHECK_KEY_LENGTHS[] = {1, 2, 3, 5, 8, 9, 256, 300};
+
+unsigned int rotateRight (unsigned int value, unsigned int count)
+{
+    count %= 32;
+    return count ? (value >> count) | (value << (32 - count)) : value;
+}
+
+unsigned int rotateLeft (unsigned int value, unsigned int count)
+{
+    return rotateRight (value, 32 - count % 32);
+}
+
+unsigned int encryptedWord (unsigned int plain, unsigned int key)
+{
+    // xor with the key, then rotate right by 1 - BIT_SHIFT_COUNT times.
+    for (unsigned int round = 0; round < BIT_SHIFT_COUNT; round++)
+        plain = rotateRight (plain ^ key, 1);
+    return plain;
+}
+
+unsigned int decryptedWord (unsigned int encrypted, unsigned int key)
+{
+    // Undoes encryptedWord - rotate left by 1, then xor with the key.
+    for (unsigned int round = 0; round < BIT_SHIFT_COUNT; round++)
+        encrypted = rotateLeft (encrypted, 1) ^ key;
+    return encrypted;
+}
+
+unsigned int streamWord (unsigned int key)
+{
+    // The combined key stream word a KeySchedule holds for key - what encrypting 0 with it leaves.
+    return encryptedWord (0, key);
+}
+
+class Words
+{
+public:
+    Words () : state (0x2545F491u) {}
+
+    std::vector<unsigned int> next (unsigned int count)
+    {
+        std::vector<unsigned int> words (count);
+        for (unsigned int i = 0; i < count; i++)
+        {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            words[i] = state;
+        }
+        return words;
+    }
+
+private:
+    unsigned int state;
+};
+
+bool fail (const std::string & kernels, const std::string & what, unsigned int words, unsigned int keyWords)
+{
+    std::cout << what << " doesn't match the round by round cipher (" << kernels << " kernels, " << words << " words";
+    if (keyWords)
+        std::cout << ", " << keyWords << " word key";
+    std::cout << ")\n";
+    return false;
+}
+
+bool checkKeyKernels (const std::string & kernels, Words & random)
+{
+    // encryptionAlgorithm & encryptionAlgorithmCopy - a raw key, looped over the data.
+    for (unsigned int k = 0; k < sizeof(CHECK_KEY_LENGTHS) / sizeof(CHECK_KEY_LENGTHS[0]); k++)
+    {
+        unsigned int keyWords = CHECK_KEY_LENGTHS[k];
+        std::vector<unsigned int> key = random.next (keyWords);
+
+        for (unsigned int words = 0; words <= CHECK_MAX_WORDS; words++)
+        {
+            std::vector<unsigned int> plain = random.next (words + 1);  // +1 keeps &plain[0] valid when words == 0
+            unsigned int keyStart = words % keyWords;                   // For the copy kernel, a key position other than the start
+
+            std::vector<unsigned int> data (plain);
+            encryptionAlgorithm (&data[0], &data[0] + words, &key[0], &key[0] + keyWords, ENCRYPT);
+            for (unsigned int i = 0; i < words; i++)
+                if (data[i] != encryptedWord (plain[i], key[i % keyWords]))
+                    return fail (kernels, "encryptionAlgorithm", words, keyWords);
+            if (data[words] != plain[words])
+                return fail (kernels, "encryptionAlgorithm (wrote past the end)", words, keyWords);
+
+            encryptionAlgorithm (&data[0], &data[0] + words, &key[0], &key[0] + keyWords, DECRYPT);
+            if (data != plain)
+                return fail (kernels, "encryptionAlgorithm decryption", words, keyWords);
+
+            std::vector<unsigned int> output (words + 1, 0xA5A5A5A5u);
+            encryptionAlgorithmCopy (&plain[0], &plain[0] + words, &output[0], &key[0], &key[0] + keyWords, &key[keyStart], ENCRYPT);
+            for (unsigned int i = 0; i < words; i++)
+                if (output[i] != encryptedWord (plain[i], key[(keyStart + i) % keyWords]))
+                    return fail (kernels, "encryptionAlgorithmCopy", words, keyWords);
+            if (output[words] != 0xA5A5A5A5u)
+                return fail (kernels, "encryptionAlgorithmCopy (wrote past the end)", words, keyWords);
+
+            encryptionAlgorithmCopy (&output[0], &output[0] + words, &output[0], &key[0], &key[0] + keyWords, &key[keyStart], DECRYPT);
+            for (unsigned int i = 0; i < words; i++)
+                if (output[i] != plain[i])
+                    return fail (kernels, "encryptionAlgorithmCopy decryption in place", words, keyWords);
+        }
+    }
+    return true;
+}
+
+bool checkStreamKernels (const std::string & kernels, Words & random)
+{
+    // keyStreamAlgorithm, keyStreamHashAlgorithm & hashingAlgorithm - a combined key stream, one word per data word.
+    for (unsigned int words = 0; words <= CHECK_MAX_WORDS; words++)
+    {
+        std::vector<unsigned int> plain = random.next (words + 1);
+        std::vector<unsigned int> keys = random.next (words + 1);
+        std::vector<unsigned int> stream (words + 1);
+        for (unsigned int i = 0; i <= words; i++)
+            stream[i] = streamWord (keys[i]);
+
+        unsigned int plainHash = 0;
+        for (unsigned int i = 0; i < words; i++)
+            plainHash ^= plain[i];
+        if ((unsigned int)hashingAlgorithm (&plain[0], &plain[0] + words) != plainHash)
+            return fail (kernels, "hashingAlgorithm", words, 0);
+
+        std::vector<unsigned int> encrypted (words + 1, 0xA5A5A5A5u);
+        keyStreamAlgorithm (&plain[0], &plain[0] + words, &encrypted[0], &stream[0], ENCRYPT);
+        for (unsigned int i = 0; i < words; i++)
+            if (encrypted[i] != encryptedWord (plain[i], keys[i]))
+                return fail (kernels, "keyStreamAlgorithm", words, 0);
+        if (encrypted[words] != 0xA5A5A5A5u)
+            return fail (kernels, "keyStreamAlgorithm (wrote past the end)", words, 0);
+
+        std::vector<unsigned int> fused (words + 1, 0xA5A5A5A5u);
+        if ((unsigned int)keyStreamHashAlgorithm (&plain[0], &plain[0] + words, &fused[0], &stream[0], ENCRYPT) != plainHash)
+            return fail (kernels, "keyStreamHashAlgorithm's hash when encrypting", words, 0);
+        if (fused != encrypted)
+            return fail (kernels, "keyStreamHashAlgorithm", words, 0);
+
+        std::vector<unsigned int> decrypted (encrypted);
+        keyStreamAlgorithm (&decrypted[0], &decrypted[0] + words, &decrypted[0], &stream[0], DECRYPT);
+        for (unsigned int i = 0; i < words; i++)
+            if (decrypted[i] != decryptedWord (encrypted[i], keys[i]) || decrypted[i] != plain[i])
+                return fail (kernels, "keyStreamAlgorithm decryption in place", words, 0);
+
+        fused.assign (words + 1, 0xA5A5A5A5u);
+        if ((unsigned int)keyStreamHashAlgorithm (&encrypted[0], &encrypted[0] + words, &fused[0], &stream[0], DECRYPT) != plainHash)
+            return fail (kernels, "keyStreamHashAlgorithm's hash when decrypting", words, 0);
+        for (unsigned int i = 0; i < words; i++)
+            if (fused[i] != plain[i])
+                return fail (kernels, "keyStreamHashAlgorithm decryption", words, 0);
+    }
+    return true;
+}
+
+int main ()
+{
+    if (kernelRotateCount() != BIT_SHIFT_COUNT)
+    {
+        std::cout << "Kernels were built for a rotate count of " << kernelRotateCount() << ", not " << BIT_SHIFT_COUNT << "\n";
+        return 1;
+    }
+
+#ifdef WS_CRYPTO_64
+    const char * versions[] = {"scalar", "sse2", "avx2"};
+    for (unsigned int v = 0; v < 3; v++)
+    {
+        if (!useKernels (versions[v]))
+        {
+            std::cout << "Kernel version " << versions[v] << " isn't supported on this processor - skipped.\n";
+            continue;
+        }
+        Words random;
+        if (!checkKeyKernels (versions[v], random) || !checkStreamKernels (versions[v], random))
+            return 1;
+    }
+    useKernels ("auto");
+#else
+    // 32bit build - only the assembly kernels exist.
+    Words random;
+    if (!checkKeyKernels ("asm", random) || !checkStreamKernels ("asm", random))
+        return 1;
+#endif
+
+    std::cout << "KERNELS OK\n";
+    return 0;
+}
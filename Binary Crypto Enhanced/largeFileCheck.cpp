@@ -0,0 +1,80 @@
+/*
+    Checks encryptBuffer() & decryptBuffer() at key offsets past word 2^32 of the key stream - built & run by "make check-large64",
+    along with largeFileCheck.sh's round trips of a file past 4GB.
+
+    Every word is checked against the cipher worked out by hand from the key schedule, with a 64 bit stream position: block N of
+    the data is rotated and xor'd with word N % chunkWords of chunk N / chunkWords's stream. The schedule's chunk size is 12 bytes,
+    so its period has a factor of 3 and can't divide 2^32 - a position cut to 32 bits anywhere would pick different key words, and
+    that's checked too, so the test can't pass by accident.
+
+    Prints LARGE KEY OFFSETS OK and returns 0, or prints the first mismatch and returns 1.
+
+    Written by William Showalter. williamshowalter@gmail.com.
+
+    Released under Creative Commons - creativecommons.org/licenses/by-nc-sa/3.0/
+    Attribution-NonCommercial-ShareAlike 3.0 Unported (CC BY-NC-SA 3.0)
+*/
+
+#include <cstring>      // memcmp
+#include <iostream>     // Result
+#include <vector>       // STL Container std::vector
+
+#include "ws-cryptoBuffer.h"
+#include "ws-keySchedule.h"
+
+const unsigned int CHECK_CHUNK_SIZE = 12;
+const unsigned long long CHECK_WORDS = 64;                  // Straddling word 2^32, half each side
+
+unsigned int expectedWord (unsigned int plain, const KeySchedule & schedule, unsigned long long position)
+{
+    // The cipher for one block, from the schedule - rotate right by BIT_SHIFT_COUNT, then xor with the stream.
+    unsigned long long chunkWords = CHECK_CHUNK_SIZE / 4;
+    unsigned int rotated = (plain >> BIT_SHIFT_COUNT) | (plain << (32 - BIT_SHIFT_COUNT));
+    return rotated ^ schedule.stream(position / chunkWords)[position % chunkWords];
+}
+
+int main ()
+{
+    std::vector<unsigned int> key;
+    for (unsigned int i = 0; i < 5; i++)
+        key.push_back(0x9E3779B9u * (i + 1));
+    KeySchedule schedule (key, CHECK_CHUNK_SIZE);
+
+    std::vector<unsigned int> plain (CHECK_WORDS);
+    for (unsigned int i = 0; i < CHECK_WORDS; i++)
+        plain[i] = 0x01234567u + 0x10204081u * i;
+
+    unsigned long long firstWord = (1ULL << 32) - CHECK_WORDS / 2;
+    std::vector<unsigned int> encrypted (CHECK_WORDS);
+    std::vector<unsigned int> decrypted (CHECK_WORDS);
+    encryptBuffer ((const unsigned char *)&plain[0], CHECK_WORDS * 4, (unsigned char *)&encrypted[0], schedule, firstWord * 4);
+    decryptBuffer ((const unsigned char *)&encrypted[0], CHECK_WORDS * 4, (unsigned char *)&decrypted[0], schedule, firstWord * 4);
+
+    bool truncatedDiffers = false;
+    for (unsigned long long i = 0; i < CHECK_WORDS; i++)
+    {
+        unsigned long long position = firstWord + i;
+        if (encrypted[i] != expectedWord (plain[i], schedule, position))
+        {
+            std::cout << "encryptBuffer doesn't match the key schedule at stream word " << position << "\n";
+            return 1;
+        }
+        if (encrypted[i] != expectedWord (plain[i], schedule, (unsigned int)position))
+            truncatedDiffers = true;
+    }
+
+    if (memcmp (&plain[0], &decrypted[0], CHECK_WORDS * 4) != 0)
+    {
+        std::cout << "decryptBuffer doesn't give back the data past stream word 2^32\n";
+        return 1;
+    }
+
+    if (!truncatedDiffers)
+    {
+        std::cout << "Key stream repeats every 2^32 words - the check can't tell a 32 bit position from a 64 bit one\n";
+        return 1;
+    }
+
+    std::cout << "LARGE KEY OFFSETS OK\n";
+    return 0;
+}
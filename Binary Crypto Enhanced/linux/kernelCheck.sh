@@ -0,0 +1,67 @@
+#!/bin/sh
+#
+#   Checks the assembly kernels against the 64bit ones - run by "make check-kernels"
+#   (or by hand: sh kernelCheck.sh cryptoUtil cryptoUtil64 kernelCheck kernelCheck64 [dir]).
+#
+#   Runs kernelCheck (kernelCheck.cpp) in both builds, then for files from empty to just past 1MB, a short & an odd length key,
+#   and chunk sizes from the smallest to the default, serial, pipelined & memory mapped:
+#       - encrypts with cryptoUtil & cryptoUtil64, and checks both write the same file
+#       - decrypts cryptoUtil's file with cryptoUtil64, and cryptoUtil64's with cryptoUtil, and compares each with the original
+#
+#   Prints KERNELS MATCH and exits 0, or says what failed and exits 1.
+#
+#   Written by William Showalter. williamshowalter@gmail.com.
+#
+#   Released under Creative Commons - creativecommons.org/licenses/by-nc-sa/3.0/
+#   Attribution-NonCommercial-ShareAlike 3.0 Unported (CC BY-NC-SA 3.0)
+#
+
+util32=${1:-./cryptoUtil}
+util64=${2:-./cryptoUtil64}
+check32=${3:-./kernelCheck}
+check64=${4:-./kernelCheck64}
+dir=${5:-${TMPDIR:-/tmp}}/wsKernelCheck.$$
+
+fail ()
+{
+    echo "KERNELS DIFFER: $1"
+    exit 1
+}
+
+"$check32" || fail "assembly kernels (kernelCheck)"
+"$check64" || fail "64bit kernels (kernelCheck64)"
+
+mkdir "$dir" || fail "could not create $dir"
+trap 'rm -rf "$dir"' EXIT
+
+head -c 16 /dev/urandom > "$dir/key.16"
+head -c 1001 /dev/urandom > "$dir/key.1001"
+
+for size in 0 1 3 4 5 4095 4096 4097 1048579
+do
+    head -c $size /dev/urandom > "$dir/plain"
+    for key in "$dir/key.16" "$dir/key.1001"
+    do
+        for chunk in 8 4K 1M
+        do
+            for mode in -s -p -m
+            do
+                # -s isn't an option - serial is the default, so it's dropped.
+                flag=$mode
+                [ "$mode" = "-s" ] && flag=
+                what="$size bytes, $(basename "$key"), -c $chunk $mode"
+
+                "$util32" enc -k "$key" -c $chunk $flag "$dir/plain" "$dir/32.enc" > /dev/null || fail "cryptoUtil encryption ($what)"
+                "$util64" enc -k "$key" -c $chunk $flag "$dir/plain" "$dir/64.enc" > /dev/null || fail "cryptoUtil64 encryption ($what)"
+                cmp -s "$dir/32.enc" "$dir/64.enc" || fail "cryptoUtil & cryptoUtil64 encrypt differently ($what)"
+
+                "$util64" dec -k "$key" $flag "$dir/32.enc" "$dir/32.dec" > /dev/null || fail "cryptoUtil64 decrypting cryptoUtil's file ($what)"
+                cmp -s "$dir/32.dec" "$dir/plain" || fail "cryptoUtil64 doesn't give back cryptoUtil's file ($what)"
+                "$util32" dec -k "$key" $flag "$dir/64.enc" "$dir/64.dec" > /dev/null || fail "cryptoUtil decrypting cryptoUtil64's file ($what)"
+                cmp -s "$dir/64.dec" "$dir/plain" || fail "cryptoUtil doesn't give back cryptoUtil64's file ($what)"
+            done
+        done
+    done
+done
+
+echo "KERNELS MATCH"
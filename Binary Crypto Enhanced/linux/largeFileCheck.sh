@@ -0,0 +1,55 @@
+#!/bin/sh
+#
+#   Checks files past 4GB end to end - run by "make check-large64" (or by hand: sh largeFileCheck.sh cryptoUtil keyOffsetCheck [dir]).
+#
+#   Writes a sparse 4GB + 4101 byte file, random around the 2^32 byte mark and at the end, then:
+#       - encrypts it serial, pipelined & memory mapped, and checks all three write the same file
+#       - decrypts it through a pipe and compares it with the original
+#       - decrypts an --offset/--length range across byte 2^32 and compares it with the same bytes of the original
+#       - runs keyOffsetCheck (largeFileCheck.cpp), for encryptBuffer past stream word 2^32
+#   Needs about 8.5GB free in dir (default $TMPDIR or /tmp) - the encrypted copies aren't sparse.
+#
+#   Prints LARGE FILES OK and exits 0, or says what failed and exits 1.
+#
+#   Written by William Showalter. williamshowalter@gmail.com.
+#
+#   Released under Creative Commons - creativecommons.org/licenses/by-nc-sa/3.0/
+#   Attribution-NonCommercial-ShareAlike 3.0 Unported (CC BY-NC-SA 3.0)
+#
+
+util=${1:-./cryptoUtil64}
+keyOffsetCheck=${2:-./largeFileCheck64}
+dir=${3:-${TMPDIR:-/tmp}}/wsLargeFileCheck.$$
+
+fail ()
+{
+    echo "LARGE FILES FAILED: $1"
+    exit 1
+}
+
+mkdir "$dir" || fail "could not create $dir"
+trap 'rm -rf "$dir"' EXIT
+
+head -c 4096 /dev/urandom > "$dir/key"
+
+# 4KB either side of 2^32 is random, the rest of the first 4GB is a hole. Then 5 bytes past that, so the last block is partial.
+dd if=/dev/urandom of="$dir/plain" bs=4096 count=2 seek=1048575 2>/dev/null || fail "could not write the test file"
+head -c 5 /dev/urandom >> "$dir/plain"
+
+"$util" enc -k "$dir/key" "$dir/plain" "$dir/serial.enc" > /dev/null || fail "serial encryption"
+"$util" enc -k "$dir/key" -p "$dir/plain" "$dir/other.enc" > /dev/null || fail "pipelined encryption"
+cmp -s "$dir/serial.enc" "$dir/other.enc" || fail "pipelined encryption differs from serial"
+"$util" enc -k "$dir/key" -m "$dir/plain" "$dir/other.enc" > /dev/null || fail "memory mapped encryption"
+cmp -s "$dir/serial.enc" "$dir/other.enc" || fail "memory mapped encryption differs from serial"
+rm -f "$dir/other.enc"
+
+"$util" dec -k "$dir/key" "$dir/serial.enc" - 2> /dev/null | cmp -s - "$dir/plain" || fail "decryption doesn't give back the file"
+
+# 200 bytes, 100 either side of 2^32.
+"$util" dec -k "$dir/key" --offset 4294967196 --length 200 "$dir/serial.enc" "$dir/range" > /dev/null || fail "range decryption"
+dd if="$dir/plain" of="$dir/expected" bs=4 skip=1073741799 count=50 2>/dev/null
+cmp -s "$dir/range" "$dir/expected" || fail "range across 2^32 doesn't match the file"
+
+"$keyOffsetCheck" || fail "encryptBuffer past stream word 2^32"
+
+echo "LARGE FILES OK"
@@ -0,0 +1,111 @@
+/*
+    Stress check for WorkStealingPool - built & run by "make check-pool64".
+
+    Runs a wide tree of tasks shaped like runTree()'s walk, over and over: a root task queues directory tasks, each of those queues
+    more directories and file tasks, and each file task adds its line to the report. wait() must only return once every file's line
+    is in, and must rethrow the error a file task deep in the tree threw - a task counted after it could already be run and finished
+    by another worker would let wait() return while its parent was still queueing, and lose both.
+
+    Prints POOL OK and returns 0, or prints the first round that went wrong and returns 1.
+
+    Written by William Showalter. williamshowalter@gmail.com.
+
+    Released under Creative Commons - creativecommons.org/licenses/by-nc-sa/3.0/
+    Attribution-NonCommercial-ShareAlike 3.0 Unported (CC BY-NC-SA 3.0)
+*/
+
+#include <cstdlib>      // std::exit
+#include <iostream>     // Result
+#include <mutex>        // Report lock
+#include <stdexcept>    // std::runtime_error
+#include <string>       // Report lines
+#include <thread>       // std::this_thread::yield
+#include <vector>       // STL Container std::vector
+
+#include "ws-threadPool.h"
+
+const unsigned int CHECK_ROUNDS = 2000;
+const unsigned int CHECK_WORKERS = 8;                       // More than the cores of most machines, so workers are preempted mid submit()
+const unsigned int CHECK_DIRECTORIES = 16;                  // Under the root, and again under each of those
+const unsigned int CHECK_FILES = 8;                         // In every directory below the root
+
+struct Walk
+{
+    WorkStealingPool * pool;
+    std::mutex reportMutex;
+    std::vector<std::string> report;
+    unsigned int failingFile;                               // Which file line this round throws instead of adding
+};
+
+void walkFile (Walk & walk, unsigned int file)
+{
+    std::lock_guard<std::mutex> lock(walk.reportMutex);
+    if (file == walk.failingFile)
+        throw (std::runtime_error("file task failed"));
+    walk.report.push_back ("OK");
+}
+
+void walkDirectory (Walk & walk, unsigned int depth, unsigned int first)
+{
+    // Everything is queued before the directory is done, the same as walkTreeDirectory() - and yielding between submits
+    // gives other workers the chance to take each task, run it and finish it while this one is still going.
+    Walk * walkPointer = &walk;
+    if (depth < 2)
+        for (unsigned int i = 0; i < CHECK_DIRECTORIES; i++)
+        {
+            unsigned int childFirst = (depth == 0) ? i * (CHECK_FILES + CHECK_DIRECTORIES * CHECK_FILES) : first + (i + 1) * CHECK_FILES;
+            walk.pool->submit([walkPointer, depth, childFirst] { walkDirectory(*walkPointer, depth + 1, childFirst); });
+            std::this_thread::yield();
+        }
+
+    if (depth > 0)
+        for (unsigned int i = 0; i < CHECK_FILES; i++)
+        {
+            unsigned int file = first + i;
+            walk.pool->submit([walkPointer, file] { walkFile(*walkPointer, file); });
+            std::this_thread::yield();
+        }
+}
+
+void fail (const std::string & what, unsigned int round)
+{
+    // Exits without unwinding main() - after an early wait() the round's tasks may still be running against its Walk.
+    std::cout << what << ", round " << round << "\n";
+    std::exit (1);
+}
+
+int main ()
+{
+    // 16 directories of 8 files, each with 16 subdirectories of 8 files.
+    const unsigned int fileCount = CHECK_DIRECTORIES * (CHECK_FILES + CHECK_DIRECTORIES * CHECK_FILES);
+
+    WorkStealingPool pool (CHECK_WORKERS);
+    for (unsigned int round = 0; round < CHECK_ROUNDS; round++)
+    {
+        Walk walk;
+        walk.pool = &pool;
+        walk.failingFile = (round * 7919) % fileCount;      // Past the first file, somewhere different every round
+        if (walk.failingFile == 0)
+            walk.failingFile = fileCount - 1;
+
+        Walk * walkPointer = &walk;
+        pool.submit([walkPointer] { walkDirectory(*walkPointer, 0, 0); });
+
+        bool threw = false;
+        try {
+            pool.wait();
+        }
+        catch (const std::runtime_error & e) {
+            threw = true;
+        }
+
+        std::lock_guard<std::mutex> lock(walk.reportMutex);
+        if (walk.report.size() != fileCount - 1)
+            fail ("wait() returned with " + std::to_string(walk.report.size()) + " of " + std::to_string(fileCount - 1) + " file lines in", round);
+        if (!threw)
+            fail ("wait() didn't rethrow the failed file task's error", round);
+    }
+
+    std::cout << "POOL OK\n";
+    return 0;
+}
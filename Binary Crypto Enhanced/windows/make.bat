@@ -3,6 +3,8 @@ nasm -f win32 --prefix _ ../ws-cryptoLibEnc.nasm -o ws-cryptoLibEnc.o
 nasm -f win32 --prefix _ ../ws-cryptoLibHash.nasm -o ws-cryptoLibHash.o
 
 
-g++ -g -m32 -o crypto.exe ../binaryEncryption.cpp ws-cryptoLibEnc.o ws-cryptoLibHash.o -static-libstdc++ -static-libgcc
+g++ -g -m32 -o crypto.exe ../ws-cryptoBuffer.cpp ../binaryEncryption.cpp ws-cryptoLibEnc.o ws-cryptoLibHash.o -pthread -static-libstdc++ -static-libgcc
+
+g++ -O2 -m32 -DWS_NO_MAIN -o cryptoBench.exe ../benchmark.cpp ../ws-cryptoBuffer.cpp ../binaryEncryption.cpp ws-cryptoLibEnc.o ws-cryptoLibHash.o -pthread -static-libstdc++ -static-libgcc
 
 del *.o
\ No newline at end of file
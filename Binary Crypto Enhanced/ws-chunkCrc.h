@@ -0,0 +1,260 @@
+/*
+    Chunk CRCs - a CRC32C of every chunk exactly as it's stored in the encrypted file, kept in a sidecar file next to it
+    (encrypted + CRC_SUFFIX). With it a file can be checked chunk by chunk, on every core, without the key and without decrypting
+    anything - and a chunk that has gone bad can be copied back in from another copy of the file (cryptoUtil scrub).
+
+    Written by encryption or rekeying with --crc, straight from the bytes as they're written out. The sidecar also records the
+    encrypted file's length & modification time - once the file has been changed by anything else (encrypted again, updated,
+    decrypted in place), the sidecar no longer describes it and scrub refuses it rather than "repair" new data back to old.
+    Damage on the disk itself doesn't change either, which is what scrub is for.
+
+    The checksum each chunk carries inside the file is an xor of its plain data - it can only be checked with the key, by decrypting,
+    and it can't see blocks that were swapped or repeated. CRC32C (the Castagnoli polynomial) sees all of those, and every burst of
+    errors up to 32 bits long.
+
+    crc32c() uses the SSE4.2 crc32 instruction when the processor has it, 8 bytes at a time and three streams at once: the instruction
+    takes 3 cycles, but a new one can start every cycle, so one stream would leave it idle two thirds of the time. Each stream works
+    through its own CRC_STREAM_BYTES of the data, and the three results are joined with a table that moves a CRC forward over
+    CRC_STREAM_BYTES of zeros. Other processors use tables, 8 bytes at a time (slicing by 8). Either one runs well ahead of the cipher.
+
+    Written by William Showalter. williamshowalter@gmail.com.
+
+    Released under Creative Commons - creativecommons.org/licenses/by-nc-sa/3.0/
+    Attribution-NonCommercial-ShareAlike 3.0 Unported (CC BY-NC-SA 3.0)
+*/
+
+#ifndef WS_CHUNKCRC_H
+#define WS_CHUNKCRC_H
+
+#include <cstring>      // memcpy
+#include <fstream>      // Reading the sidecar
+#include <string>       // std::string file paths
+#include <vector>       // STL Container std::vector
+
+#include "ws-sidecarFile.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#  define WS_CRC_X86 1
+#  include <nmmintrin.h> // SSE4.2 crc32
+#endif
+
+const char * const          CRC_SUFFIX          = ".wscrc";
+const unsigned long long    CRC_MAGIC           = 0x0043524345425357ULL;    // "WSBECRC" as it reads in the file
+const unsigned int          CRC_VERSION         = 1;
+const unsigned int          CRC_HEADER_WORDS    = 8;
+const unsigned int          CRC_POLYNOMIAL      = 0x82F63B78;               // Castagnoli, bit reversed
+const unsigned int          CRC_STREAM_BYTES    = 4096;                     // Each hardware stream's share of a run
+
+// Lookup tables, built once on first use.
+struct CrcTables
+{
+    unsigned int slice[8][256];         // Software CRC - byte k of an 8 byte step goes through slice[7-k]
+    unsigned int shift[4][256];         // Moves a CRC register forward over CRC_STREAM_BYTES zeros, a byte of the register at a time
+    bool hardware;                      // The processor has SSE4.2
+
+    CrcTables ();
+};
+
+inline unsigned int crcRawTables (const CrcTables & tables, unsigned int crc, const unsigned char * data, unsigned long long length)
+{
+    // The bare CRC register update - no inverting before or after, so CRCs of pieces can be combined.
+    for (; length >= 8; length -= 8, data += 8)
+    {
+        unsigned int low, high;
+        memcpy (&low, data, 4);
+        memcpy (&high, data + 4, 4);
+        low ^= crc;
+        crc = tables.slice[7][low & 0xFF] ^ tables.slice[6][(low >> 8) & 0xFF] ^ tables.slice[5][(low >> 16) & 0xFF] ^ tables.slice[4][low >> 24]
+            ^ tables.slice[3][high & 0xFF] ^ tables.slice[2][(high >> 8) & 0xFF] ^ tables.slice[1][(high >> 16) & 0xFF] ^ tables.slice[0][high >> 24];
+    }
+    for (; length; length--)
+        crc = (crc >> 8) ^ tables.slice[0][(crc ^ *data++) & 0xFF];
+    return crc;
+}
+
+inline unsigned int crcShift (const CrcTables & tables, unsigned int crc)
+{
+    // The register as it would be after CRC_STREAM_BYTES more zeros - the CRC is linear in the register, so each byte is looked up on its own.
+    return tables.shift[0][crc & 0xFF] ^ tables.shift[1][(crc >> 8) & 0xFF] ^ tables.shift[2][(crc >> 16) & 0xFF] ^ tables.shift[3][crc >> 24];
+}
+
+inline CrcTables::CrcTables ()
+{
+    for (unsigned int byte = 0; byte < 256; byte++)
+    {
+        unsigned int crc = byte;
+        for (unsigned int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (CRC_POLYNOMIAL & (0 - (crc & 1)));
+        slice[0][byte] = crc;
+    }
+    for (unsigned int k = 1; k < 8; k++)
+        for (unsigned int byte = 0; byte < 256; byte++)
+            slice[k][byte] = (slice[k-1][byte] >> 8) ^ slice[0][slice[k-1][byte] & 0xFF];
+
+    // Each of the 32 register bits run over the zeros, then every byte value is the xor of its bits' results.
+    std::vector<unsigned char> zeros (CRC_STREAM_BYTES, 0);
+    unsigned int bitShift[32];
+    for (unsigned int bit = 0; bit < 32; bit++)
+        bitShift[bit] = crcRawTables (*this, 1U << bit, &zeros[0], CRC_STREAM_BYTES);
+    for (unsigned int k = 0; k < 4; k++)
+        for (unsigned int byte = 0; byte < 256; byte++)
+        {
+            unsigned int shifted = 0;
+            for (unsigned int bit = 0; bit < 8; bit++)
+                if (byte & (1U << bit))
+                    shifted ^= bitShift[8*k + bit];
+            shift[k][byte] = shifted;
+        }
+
+    hardware = false;
+#ifdef WS_CRC_X86
+    __builtin_cpu_init();
+    hardware = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+inline const CrcTables & crcTables ()
+{
+    static const CrcTables tables;      // Built once, by whichever thread gets here first
+    return tables;
+}
+
+#ifdef WS_CRC_X86
+__attribute__((target("sse4.2"))) inline unsigned int crcRawHardware (const CrcTables & tables, unsigned int crc, const unsigned char * data, unsigned long long length)
+{
+    /*
+     Same as crcRawTables(), with the crc32 instruction. Runs of 3 * CRC_STREAM_BYTES are split into three streams - the first
+     carries on from crc, the other two start from 0 - and joined: crc(A B C) = shift(shift(crc(A)) ^ crc(B)) ^ crc(C).
+     */
+
+    unsigned long long first = crc;
+    for (; length >= 3 * CRC_STREAM_BYTES; length -= 3 * CRC_STREAM_BYTES, data += 3 * CRC_STREAM_BYTES)
+    {
+        unsigned long long second = 0;
+        unsigned long long third = 0;
+        for (unsigned int i = 0; i < CRC_STREAM_BYTES; i += 8)
+        {
+            unsigned long long words[3];
+            memcpy (&words[0], data + i, 8);
+            memcpy (&words[1], data + CRC_STREAM_BYTES + i, 8);
+            memcpy (&words[2], data + 2 * CRC_STREAM_BYTES + i, 8);
+            first = _mm_crc32_u64 (first, words[0]);
+            second = _mm_crc32_u64 (second, words[1]);
+            third = _mm_crc32_u64 (third, words[2]);
+        }
+        first = crcShift (tables, crcShift (tables, (unsigned int)first) ^ (unsigned int)second) ^ (unsigned int)third;
+    }
+
+    for (; length >= 8; length -= 8, data += 8)
+    {
+        unsigned long long word;
+        memcpy (&word, data, 8);
+        first = _mm_crc32_u64 (first, word);
+    }
+    unsigned int last = (unsigned int)first;
+    for (; length; length--)
+        last = _mm_crc32_u8 (last, *data++);
+    return last;
+}
+#endif
+
+inline unsigned int crc32c (unsigned int crc, const void * data, unsigned long long length, bool allowHardware = true)
+{
+    /*
+     CRC32C of length bytes of data - the standard one, so crc32c(0, "123456789", 9) is 0xE3069283.
+     Pass in 0 to start, or an earlier result to carry on from it over more data. allowHardware = false always uses the tables.
+     */
+
+    const CrcTables & tables = crcTables();
+    const unsigned char * bytes = (const unsigned char *)data;
+#ifdef WS_CRC_X86
+    if (allowHardware && tables.hardware)
+        return ~crcRawHardware (tables, ~crc, bytes, length);
+#else
+    (void)allowHardware;
+#endif
+    return ~crcRawTables (tables, ~crc, bytes, length);
+}
+
+inline bool crc32cHardware ()
+{
+    return crcTables().hardware;
+}
+
+// One chunk of the encrypted file, as it's stored - a compressed file's frame word included.
+struct ChunkCrc
+{
+    unsigned long long offset;          // From the start of the file
+    unsigned int length;
+    unsigned int crc;
+};
+
+// Contents of a CRC sidecar - the stamp says whether scrub can still trust it with the encrypted file.
+struct CrcFile : SidecarStamp
+{
+    unsigned int chunkSize;
+    unsigned int headerCrc;                         // Of the file's header
+    std::vector<ChunkCrc> chunks;                   // In file order
+
+    CrcFile () : chunkSize(0), headerCrc(0) {}
+};
+
+inline unsigned long long crcFileChecksum (const unsigned long long * header, const std::vector<ChunkCrc> & chunks)
+{
+    unsigned int crc = crc32c (0, header, CRC_HEADER_WORDS * 8);
+    if (!chunks.empty())
+        crc = crc32c (crc, &chunks[0], chunks.size() * sizeof(ChunkCrc));
+    return crc;
+}
+
+inline bool readCrcFile (std::string filename, CrcFile & file)
+{
+    // Returns false if there's no sidecar, or it's damaged or from another version.
+    std::ifstream input (filename.c_str(), std::ios::in | std::ios::binary);
+    if (!input.is_open())
+        return false;
+
+    unsigned long long header[CRC_HEADER_WORDS];
+    unsigned long long checksum;
+    if (!input.read ((char *)header, sizeof(header)) || header[0] != CRC_MAGIC || header[1] != CRC_VERSION)
+        return false;
+
+    file.chunkSize = (unsigned int)header[2];
+    file.headerCrc = (unsigned int)header[3];
+    file.encryptedLength = header[4];
+    file.modifiedSeconds = header[5];
+    file.modifiedNanoseconds = header[6];
+
+    // Every chunk is at least 4 bytes - a damaged count can't make this allocate anything silly.
+    unsigned long long chunkCount = header[7];
+    if (chunkCount == 0 || chunkCount > file.encryptedLength / 4)
+        return false;
+
+    file.chunks.resize (chunkCount);
+    if (!input.read ((char *)&file.chunks[0], chunkCount * sizeof(ChunkCrc)) || !input.read ((char *)&checksum, 8))
+        return false;
+    if (checksum != crcFileChecksum (header, file.chunks))
+        return false;
+
+    // Chunks have to lie inside the file, in order, each no longer than a chunk - a compressed one's frame word makes it 4 bytes longer.
+    unsigned long long end = 0;
+    for (unsigned long long i = 0; i < chunkCount; i++)
+    {
+        const ChunkCrc & chunk = file.chunks[i];
+        if (chunk.offset < end || chunk.length > (unsigned long long)file.chunkSize + 4 || chunk.offset + chunk.length > file.encryptedLength)
+            return false;
+        end = chunk.offset + chunk.length;
+    }
+    return true;
+}
+
+inline void writeCrcFile (std::string filename, const CrcFile & file)
+{
+    unsigned long long header[CRC_HEADER_WORDS] = {CRC_MAGIC, CRC_VERSION, file.chunkSize, file.headerCrc,
+                                                   file.encryptedLength, file.modifiedSeconds, file.modifiedNanoseconds, file.chunks.size()};
+    unsigned long long checksum = crcFileChecksum (header, file.chunks);
+
+    writeSidecarFile (filename, "checksum file", header, sizeof(header), file.chunks.empty() ? NULL : &file.chunks[0], file.chunks.size() * sizeof(ChunkCrc), checksum);
+}
+
+#endif
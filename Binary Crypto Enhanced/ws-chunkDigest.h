@@ -0,0 +1,140 @@
+/*
+    Chunk digests - a 64 bit fingerprint of every chunk's plain data, kept in a sidecar file next to the encrypted file
+    (encrypted + DIGEST_SUFFIX), so a later run can tell which chunks of changed data need encrypting again (cryptoUtil enc --update).
+
+    Written by encryption with --digests, and rewritten by every --update. The sidecar also records the encrypted file's length and
+    modification time as they were once it was written - if the encrypted file has been touched since (encrypted again without
+    --digests, copied over, an interrupted update), the sidecar no longer describes it and is ignored.
+
+    chunkDigest() is not a cryptographic hash - it only has to notice that a chunk changed, not stand up to someone making a
+    change it misses on purpose. It reads 32 bytes at a time in four independent lanes, so it runs at close to memory speed.
+    The per-chunk checksum the file format already stores is too weak for this: it's an xor of the data, so swapping two
+    blocks, or changing the same bit in two of them, leaves it the same.
+
+    Written by William Showalter. williamshowalter@gmail.com.
+
+    Released under Creative Commons - creativecommons.org/licenses/by-nc-sa/3.0/
+    Attribution-NonCommercial-ShareAlike 3.0 Unported (CC BY-NC-SA 3.0)
+*/
+
+#ifndef WS_CHUNKDIGEST_H
+#define WS_CHUNKDIGEST_H
+
+#include <cstring>      // memcpy
+#include <fstream>      // Reading the sidecar
+#include <string>       // std::string file paths
+#include <vector>       // STL Container std::vector
+
+#include "ws-sidecarFile.h"
+
+const char * const          DIGEST_SUFFIX       = ".wsdigest";
+const unsigned long long    DIGEST_MAGIC        = 0x5453474445425357ULL;    // "WSBEDGST" as it reads in the file
+const unsigned int          DIGEST_VERSION      = 1;
+const unsigned int          DIGEST_HEADER_WORDS = 8;
+
+inline unsigned long long digestRotate (unsigned long long value, unsigned int count)
+{
+    return (value << count) | (value >> (64 - count));
+}
+
+inline unsigned long long digestMix (unsigned long long hash)
+{
+    // Every input bit ends up affecting every output bit.
+    hash ^= hash >> 33;
+    hash *= 0xC2B2AE3D27D4EB4FULL;
+    hash ^= hash >> 29;
+    hash *= 0x165667B19E3779F9ULL;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+inline unsigned long long chunkDigest (const unsigned char * data, unsigned long long length)
+{
+    const unsigned long long PRIME1 = 0x9E3779B185EBCA87ULL;
+    const unsigned long long PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+    unsigned long long lanes[4] = {PRIME1 + PRIME2, PRIME2, 0, 0 - PRIME1};
+
+    unsigned long long position = 0;
+    for (; position + 32 <= length; position += 32)
+    {
+        for (unsigned int lane = 0; lane < 4; lane++)
+        {
+            unsigned long long word;
+            memcpy (&word, data + position + 8 * lane, 8);
+            lanes[lane] = digestRotate (lanes[lane] + word * PRIME2, 31) * PRIME1;
+        }
+    }
+
+    unsigned long long hash = length * PRIME1;
+    for (unsigned int lane = 0; lane < 4; lane++)
+        hash = digestRotate (hash ^ digestRotate (lanes[lane] * PRIME2, 31) * PRIME1, 27) * PRIME1 + PRIME2;
+
+    for (; position < length; position++)
+        hash = digestRotate (hash ^ (data[position] * PRIME1), 11) * PRIME2;
+
+    return digestMix (hash);
+}
+
+// Contents of a digest sidecar, stamped with the encrypted file it was written for.
+struct DigestFile : SidecarStamp
+{
+    unsigned int chunkSize;
+    unsigned long long dataLength;                  // Plain data the digests cover
+    std::vector<unsigned long long> digests;        // One per chunk, in file order
+
+    DigestFile () : chunkSize(0), dataLength(0) {}
+};
+
+inline unsigned long long digestFileChecksum (const unsigned long long * header, const std::vector<unsigned long long> & digests)
+{
+    unsigned long long hash = chunkDigest ((const unsigned char *)header, (DIGEST_HEADER_WORDS - 1) * 8);
+    if (!digests.empty())
+        hash ^= digestRotate (chunkDigest ((const unsigned char *)&digests[0], digests.size() * 8), 1);
+    return hash;
+}
+
+inline bool readDigestFile (std::string filename, DigestFile & file)
+{
+    // Returns false if there's no sidecar, or it's damaged or from another version - it's only ever an optimization.
+    std::ifstream input (filename.c_str(), std::ios::in | std::ios::binary);
+    if (!input.is_open())
+        return false;
+
+    unsigned long long header[DIGEST_HEADER_WORDS];
+    unsigned long long checksum;
+    if (!input.read ((char *)header, sizeof(header)) || header[0] != DIGEST_MAGIC || header[1] != DIGEST_VERSION)
+        return false;
+
+    file.chunkSize = (unsigned int)header[2];
+    file.dataLength = header[3];
+    file.encryptedLength = header[4];
+    file.modifiedSeconds = header[5];
+    file.modifiedNanoseconds = header[6];
+
+    // Chunk count from the lengths - a damaged count can't make this allocate anything silly.
+    if (file.chunkSize <= 4)
+        return false;
+    unsigned long long chunkCount = (file.dataLength + file.chunkSize - 5) / (file.chunkSize - 4);
+    if (chunkCount == 0)
+        chunkCount = 1;
+    if (chunkCount > file.encryptedLength / 4)
+        return false;
+
+    file.digests.resize (chunkCount);
+    if (!input.read ((char *)&file.digests[0], chunkCount * 8) || !input.read ((char *)&checksum, 8))
+        return false;
+
+    return checksum == digestFileChecksum (header, file.digests) && header[DIGEST_HEADER_WORDS - 1] == checksum;
+}
+
+inline void writeDigestFile (std::string filename, const DigestFile & file)
+{
+    unsigned long long header[DIGEST_HEADER_WORDS] = {DIGEST_MAGIC, DIGEST_VERSION, file.chunkSize, file.dataLength,
+                                                      file.encryptedLength, file.modifiedSeconds, file.modifiedNanoseconds, 0};
+    unsigned long long checksum = digestFileChecksum (header, file.digests);
+    header[DIGEST_HEADER_WORDS - 1] = checksum;
+
+    writeSidecarFile (filename, "digest file", header, sizeof(header), file.digests.empty() ? NULL : &file.digests[0], file.digests.size() * 8, checksum);
+}
+
+#endif
@@ -0,0 +1,401 @@
+/*
+    In-memory encryption - see "ws-cryptoBuffer.h".
+
+    Built into cryptoUtil along with binaryEncryption.cpp, and on its own (with the kernels) into libwscrypto.
+
+    Written by William Showalter. williamshowalter@gmail.com.
+
+    Released under Creative Commons - creativecommons.org/licenses/by-nc-sa/3.0/
+    Attribution-NonCommercial-ShareAlike 3.0 Unported (CC BY-NC-SA 3.0)
+*/
+
+#include <algorithm>    // std::min, std::fill
+#include <cstdint>      // uintptr_t, for checking buffer alignment
+#include <cstring>      // memcpy
+#include <stdexcept>    // Thrown for bad arguments & short encrypted data
+#include <vector>       // STL Container std::vector
+
+#include "ws-cryptoBuffer.h"
+
+const unsigned int STAGING_WORDS = 1024;     // cryptBuffer() works through unaligned buffers 4KB at a time
+
+void finishChunk (Chunk & chunk, OPERATION operation, unsigned int chunkSize, unsigned long long bytesRead, bool finalChunk)
+{
+    /*
+     Sets up a chunk once its data has been read in - bytesRead bytes of data after the checksum block when encrypting,
+     or bytesRead bytes of encrypted data (checksum included) when decrypting. chunk.data must hold at least the blocks the data is in.
+
+     For every chunk but the last, finalChunk is false and bytesRead is the whole chunk.
+     The last chunk is trimmed down to the blocks that hold data, and the unused bytes of a partial last block are zeroed.
+     Sets chunk.finalByteCount if this is the last piece of the data.
+     */
+
+    unsigned int readOffset = (operation == ENCRYPT) ? 1 : 0;
+    chunk.writeOffset = (operation == ENCRYPT) ? 0 : 1;
+    chunk.finalByteCount = 0;
+
+    if (!finalChunk)
+    {
+        chunk.writeSize = (operation == ENCRYPT) ? chunkSize : chunkSize - 4;
+        return;
+    }
+
+    if (operation == DECRYPT && bytesRead < 4)
+        throw (std::runtime_error("Encrypted file is too short to contain its checksum."));
+
+    // if mod ++ is in case division truncated bytesRead
+    unsigned long long resizeAmmount = readOffset + bytesRead/4;
+    if (bytesRead%4)
+    {
+        resizeAmmount++;
+
+        // Bytes past the end of the data are left over from the last chunk read into this one.
+        unsigned char * lastBlock = (unsigned char *)&chunk.data[resizeAmmount-1];
+        std::fill (lastBlock + bytesRead%4, lastBlock + 4, 0);
+    }
+    chunk.data.resize (resizeAmmount);
+
+    chunk.writeSize = (operation == ENCRYPT) ? bytesRead + 4 : bytesRead - 4; // Adjust for checksum
+
+    // Chunks before this one were all whole blocks, so the last block's byte count only depends on this chunk.
+    chunk.finalByteCount = bytesRead % 4;
+    if (!chunk.finalByteCount)
+        chunk.finalByteCount = 4;
+}
+
+void processChunk (Chunk & chunk, OPERATION operation)
+{
+    /*
+     Encrypts or decrypts one chunk in place. Touches nothing but the chunk, so chunks can be processed on separate threads.
+
+     Encryption: encrypts the data and computes its checksum in the same pass, then stores and encrypts the checksum in data[0].
+     Decryption: decrypts the stored checksum, then decrypts the data and computes its checksum in the same pass.
+     The stored checksum is left in data[0] and skipped over by writeChunk, rather than erased (which would move the whole chunk).
+     */
+
+    SecureBlock & data = chunk.data;
+
+    if (operation == ENCRYPT)
+    {
+        // Encrypt data & compute hash
+        // vector.begin() & vector.end() will work on some compilers, but iterators may be implemented as a class, which wouldn't be compatible with the assembly function.
+        data[0] = keyStreamHashAlgorithm (&data[0]+1, &data[0]+data.size(), &data[0]+1, chunk.keyStream+1, ENCRYPT);
+
+        // Encrypt hash
+        keyStreamAlgorithm (&data[0], &data[0]+1, &data[0], chunk.keyStream, ENCRYPT);
+
+        // Last block of the file is only partially written out, rotate the meaningful bytes back down into it.
+        if (chunk.finalByteCount)
+            data[data.size()-1] = (data[data.size()-1]<<(BIT_SHIFT_COUNT)) + (data[data.size()-1]>>(32 - BIT_SHIFT_COUNT));
+    }
+
+    else
+    {
+        // Shift last section back into original placement.
+        if (chunk.finalByteCount)
+            data[data.size()-1] = ((data[data.size()-1]>>(BIT_SHIFT_COUNT))+(data[data.size()-1]<<(32 - BIT_SHIFT_COUNT)));
+
+        // Decrypt hash
+        keyStreamAlgorithm (&data[0], &data[0]+1, &data[0], chunk.keyStream, DECRYPT);
+        chunk.hashBefore = data[0];
+
+        // Decrypt data & compute hash
+        chunk.hashAfter = keyStreamHashAlgorithm (&data[0]+1, &data[0]+data.size(), &data[0]+1, chunk.keyStream+1, DECRYPT);
+
+        // Removes unsignificant bits that were originally 0, but only if we hit end of file this round and the last block is partial.
+        // The hash already includes the whole last block, so swap the removed bits back out of it.
+        if (chunk.finalByteCount % 4 && data.size() > 1)
+        {
+            unsigned int lastBlock = data[data.size()-1];
+            data[data.size()-1] &= ~(0xFFFFFFFF<<(8*chunk.finalByteCount));
+            chunk.hashAfter ^= lastBlock ^ data[data.size()-1];
+        }
+    }
+}
+
+void rekeyChunk (Chunk & chunk)
+{
+    /*
+     Moves one encrypted chunk from the key it was encrypted with (chunk.keyStream) to another (chunk.rekeyStream), in place,
+     without decrypting it. Encryption is ror(data,16) xor stream, so xoring the encrypted data with both streams swaps one
+     for the other - the rotate is the same under either key, and stays as it was.
+
+     The checksum is checked from the same xors. The plain data's checksum is the xor of its blocks, and each plain block is
+     rol(encrypted xor oldStream,16) - so the checksum is rol of the xor of every (encrypted xor oldStream). hashBefore & hashAfter
+     come out exactly as processChunk() would leave them decrypting. The checksum block itself needs no change beyond the new
+     stream: the plain data, and so its checksum, are the same under either key.
+
+     Plain data is never written anywhere - each block only exists in a register, still rotated, on its way between keys.
+     The chunk is read the same as for decryption, and the whole of it - checksum included - is written back out.
+     */
+
+    unsigned int * data = chunk.data.data();
+    const unsigned int * oldStream = chunk.keyStream;
+    const unsigned int * newStream = chunk.rekeyStream;
+    unsigned long long size = chunk.data.size();
+
+    // The last block of the file was rotated back after it was encrypted (see processChunk()), so it's handled on its own below.
+    unsigned long long end = chunk.finalByteCount ? size - 1 : size;
+
+    unsigned int folded = 0;
+    for (unsigned long long i = 1; i < end; i++)
+    {
+        unsigned int block = data[i] ^ oldStream[i];
+        folded ^= block;
+        data[i] = block ^ newStream[i];
+    }
+    chunk.hashAfter = (folded<<(BIT_SHIFT_COUNT)) + (folded>>(32 - BIT_SHIFT_COUNT));
+
+    if (end > 0)
+    {
+        unsigned int block = data[0] ^ oldStream[0];
+        chunk.hashBefore = (block<<(BIT_SHIFT_COUNT)) + (block>>(32 - BIT_SHIFT_COUNT));
+        data[0] = block ^ newStream[0];
+    }
+
+    // Stored as the plain block xor the key stream rotated left - so it moves by the difference of the streams, rotated the same way.
+    if (chunk.finalByteCount)
+    {
+        unsigned long long last = size - 1;
+        unsigned int oldRotated = (oldStream[last]<<(BIT_SHIFT_COUNT)) + (oldStream[last]>>(32 - BIT_SHIFT_COUNT));
+        unsigned int newRotated = (newStream[last]<<(BIT_SHIFT_COUNT)) + (newStream[last]>>(32 - BIT_SHIFT_COUNT));
+        unsigned int block = data[last] ^ oldRotated;
+        data[last] = block ^ newRotated;
+
+        // Only the checksum is left in an empty last chunk. Otherwise bytes past the end of the data were 0, and aren't in the checksum.
+        if (last == 0)
+            chunk.hashBefore = block;
+        else
+        {
+            if (chunk.finalByteCount % 4)
+                block &= ~(0xFFFFFFFF<<(8*chunk.finalByteCount));
+            chunk.hashAfter ^= block;
+        }
+    }
+
+    // Everything read in goes back out. A last chunk's final block only holds finalByteCount bytes of the file.
+    chunk.writeOffset = 0;
+    chunk.writeSize = chunk.finalByteCount ? 4 * (size - 1) + chunk.finalByteCount : 4 * size;
+}
+
+void cryptBuffer (const unsigned char * input, unsigned long long length, unsigned char * output, const KeySchedule & schedule, unsigned long long keyOffset, OPERATION operation)
+{
+    /*
+     Encrypts or decrypts length bytes of input into output, which may be the same buffer.
+
+     Byte N of the input is encrypted with byte keyOffset+N of the key stream - the stream the file format would use for the
+     same position in its chunks, if chunks held no checksums. So a buffer can be encrypted in pieces, as long as each piece
+     starts at a multiple of 4 bytes: encrypting bytes [0, 4096) and then [4096, 8192) with keyOffset 4096 gives the same result as one call.
+
+     A partial last block is handled the same way the last block of a file is, so output is exactly length bytes.
+     Buffers don't need to be aligned, but unaligned ones are copied through a small staging buffer on the stack, a piece at a time.
+     */
+
+    if (keyOffset % 4)
+        throw (std::runtime_error("Key offset must be a multiple of 4 bytes."));
+
+    unsigned long long chunkWords = schedule.chunkSize() / 4;
+    unsigned long long position = keyOffset / 4;        // Block of the key stream the next block of data uses
+    unsigned long long words = length / 4;
+    bool aligned = ((uintptr_t)input % 4 == 0) && ((uintptr_t)output % 4 == 0);
+    unsigned int staging[STAGING_WORDS];
+
+    // Each chunk's key stream is its own piece of the schedule, so runs stop at chunk boundaries.
+    for (unsigned long long done = 0; done < words;)
+    {
+        unsigned long long within = position % chunkWords;
+        unsigned long long run = std::min (words - done, chunkWords - within);
+        const unsigned int * stream = schedule.stream(position / chunkWords) + within;
+
+        if (aligned)
+            keyStreamAlgorithm ((const unsigned int *)(input + 4*done), (const unsigned int *)(input + 4*done) + run, (unsigned int *)(output + 4*done), stream, operation);
+
+        else
+        {
+            run = std::min (run, (unsigned long long)STAGING_WORDS);
+            memcpy (staging, input + 4*done, run*4);
+            keyStreamAlgorithm (staging, staging + run, staging, stream, operation);
+            memcpy (output + 4*done, staging, run*4);
+        }
+
+        done += run;
+        position += run;
+    }
+    if (!aligned)
+        secureZero (staging, sizeof(staging));
+
+    if (length % 4)
+    {
+        unsigned int block = 0;
+        memcpy (&block, input + 4*words, length % 4);
+        const unsigned int * stream = schedule.stream(position / chunkWords) + position % chunkWords;
+
+        // Same rotate as the last block of a file, so the meaningful bytes stay in the bytes that are written out.
+        if (operation == DECRYPT)
+            block = (block>>(BIT_SHIFT_COUNT)) + (block<<(32 - BIT_SHIFT_COUNT));
+
+        keyStreamAlgorithm (&block, &block+1, &block, stream, operation);
+
+        if (operation == ENCRYPT)
+            block = (block<<(BIT_SHIFT_COUNT)) + (block>>(32 - BIT_SHIFT_COUNT));
+
+        memcpy (output + 4*words, &block, length % 4);
+        secureZero (&block, sizeof(block));
+    }
+}
+
+CryptoContext::CryptoContext (KeyScheduleCache & keys, OPERATION operation, unsigned int chunkSize, unsigned long long totalLength)
+: keys(keys), schedule(NULL), operation(operation), headerDone(false), chunkFill(0), chunkIndex(0), dataLength(0), finished(false)
+{
+    if (operation == ENCRYPT)
+    {
+        checkChunkSize (chunkSize);
+        header.chunkSize = chunkSize;
+        if (totalLength != UNKNOWN_LENGTH)
+            setOriginalLength (header, totalLength);
+
+        startChunks();
+    }
+}
+
+CryptoContext::~CryptoContext ()
+{
+    // chunkMemory zeroes itself.
+    if (!headerBytes.empty())
+        secureZero (&headerBytes[0], headerBytes.size());
+}
+
+void CryptoContext::startChunks ()
+{
+    // The whole chunk is allocated up front, and reused for every chunk after it.
+    schedule = &keys.schedule(header.chunkSize);
+    chunkMemory.allocate (header.chunkSize, 1);
+    chunk.data.attach (chunkMemory, 0);
+    chunk.data.resize ((operation == ENCRYPT) ? 1 : 0);
+}
+
+void CryptoContext::update (const unsigned char * input, unsigned long long length, std::vector<unsigned char> & output)
+{
+    if (finished)
+        throw (std::runtime_error("CryptoContext has already finished."));
+
+    if (!headerDone && operation == ENCRYPT)
+    {
+        unsigned int blocks[HEADER_BLOCKS];
+        encodeHeader (header, blocks);
+        output.insert (output.end(), (unsigned char *)blocks, (unsigned char *)blocks + HEADER_SIZE);
+        headerDone = true;
+    }
+
+    if (!headerDone)
+    {
+        // Decryption - collect the header before anything else, since it sets the chunk size.
+        unsigned long long headerRead = std::min (length, (unsigned long long)(HEADER_SIZE - headerBytes.size()));
+        headerBytes.insert (headerBytes.end(), input, input + headerRead);
+        input += headerRead;
+        length -= headerRead;
+
+        if (headerBytes.size() < HEADER_SIZE)
+            return;
+
+        unsigned int blocks[HEADER_BLOCKS];
+        memcpy (blocks, &headerBytes[0], HEADER_SIZE);
+        bool hasHeader = decodeHeader (blocks, header);
+        if (hasHeader && isCompressed (header))
+            throw (std::runtime_error("Compressed files can't be decrypted in memory - decrypt them with cryptoUtil instead."));
+
+        startChunks();
+        headerDone = true;
+
+        // Data from before headers existed - what was read as a header is the start of the first chunk.
+        if (!hasHeader)
+            fill (&headerBytes[0], HEADER_SIZE, output);
+
+        secureZero (&headerBytes[0], headerBytes.size());
+        headerBytes.clear();
+    }
+
+    fill (input, length, output);
+}
+
+void CryptoContext::fill (const unsigned char * input, unsigned long long length, std::vector<unsigned char> & output)
+{
+    // Encryption fills in after the block reserved for the checksum.
+    unsigned int readOffset = (operation == ENCRYPT) ? 1 : 0;
+    unsigned long long readSize = header.chunkSize - 4*readOffset;
+
+    while (length)
+    {
+        // The chunk is only processed once there's more data, because the last chunk of the data is processed differently.
+        if (chunkFill == readSize)
+            processFilledChunk (false, output);
+
+        unsigned long long count = std::min (length, readSize - chunkFill);
+        unsigned long long blocks = readOffset + (chunkFill + count + 3) / 4;
+        if (chunk.data.size() < blocks)
+            chunk.data.resize (blocks);
+
+        memcpy ((unsigned char *)&chunk.data[readOffset] + chunkFill, input, count);
+        chunkFill += count;
+        input += count;
+        length -= count;
+    }
+}
+
+void CryptoContext::processFilledChunk (bool finalChunk, std::vector<unsigned char> & output)
+{
+    chunk.keyStream = schedule->stream(chunkIndex);
+    finishChunk (chunk, operation, header.chunkSize, chunkFill, finalChunk);
+    processChunk (chunk, operation);
+
+    if (operation == DECRYPT && chunk.hashBefore != chunk.hashAfter)
+        checksums.badChunks.push_back (chunkIndex);
+
+    const unsigned char * written = (const unsigned char *)(&chunk.data[0] + chunk.writeOffset);
+    output.insert (output.end(), written, written + chunk.writeSize);
+
+    // Length of the plain data - what was read in when encrypting, what was written out when decrypting.
+    dataLength += (operation == ENCRYPT) ? chunkFill : chunk.writeSize;
+    checksums.dataLength += chunkFill;
+    chunkFill = 0;
+    chunkIndex++;
+}
+
+bool CryptoContext::finish (std::vector<unsigned char> & output)
+{
+    /*
+     Processes the last chunk, which is written out with the same partial last block handling as the last chunk of a file.
+
+     Encryption: throws if a length was given to the constructor, and the data didn't add up to it.
+     Decryption: throws if the data was too short to contain a checksum, the same as decrypting a file that short.
+     */
+
+    if (finished)
+        throw (std::runtime_error("CryptoContext has already finished."));
+
+    // Nothing (or, when decrypting, less than a header) was passed to update().
+    if (!headerDone)
+    {
+        update (NULL, 0, output);
+
+        if (!headerDone)
+        {
+            header = legacyHeader();
+            startChunks();
+            headerDone = true;
+            fill (headerBytes.empty() ? NULL : &headerBytes[0], headerBytes.size(), output);
+        }
+    }
+
+    finished = true;
+    processFilledChunk (true, output);
+    chunkMemory.release();
+
+    if (operation == ENCRYPT && header.originalLength != UNKNOWN_LENGTH && header.originalLength != dataLength)
+        throw (std::runtime_error("Data encrypted didn't match the length given to CryptoContext."));
+
+    if (operation == DECRYPT)
+        checksums.lengthMatches = (header.originalLength == UNKNOWN_LENGTH || header.originalLength == dataLength);
+
+    return checksums.passed();
+}
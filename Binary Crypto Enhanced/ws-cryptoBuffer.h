@@ -0,0 +1,130 @@
+/*
+    In-memory encryption - the cipher and the chunk format without any files, for linking into other programs (libwscrypto).
+
+    Two levels:
+        cryptBuffer()   The bare cipher. Encrypts/decrypts a buffer into another buffer of the same length, at any 4 byte
+                        aligned offset into the key stream. No header, no checksums.
+        CryptoContext   The same format cryptoUtil writes - header, chunks and checksums - fed a piece at a time with update(),
+                        and ended with finish(). Output is byte for byte what encryption()/decryption() produce for the same data,
+                        so either side can be a file and the other a buffer. Files encrypted with --compress aren't supported -
+                        update() throws on their header.
+
+    processChunk() is the per-chunk work both CryptoContext and the file loops in binaryEncryption.cpp run. rekeyChunk() is the file
+    loops' work when moving an encrypted file to a new key (cryptoUtil rekey).
+    Chunk data lives in blocks of a SecureArena (ws-secureArena.h) allocated once per job, so nothing is allocated per chunk
+    and plain data is zeroed, not just freed, when the job is done.
+
+    Written by William Showalter. williamshowalter@gmail.com.
+
+    Released under Creative Commons - creativecommons.org/licenses/by-nc-sa/3.0/
+    Attribution-NonCommercial-ShareAlike 3.0 Unported (CC BY-NC-SA 3.0)
+*/
+
+#ifndef WS_CRYPTOBUFFER_H
+#define WS_CRYPTOBUFFER_H
+
+#include <vector>       // STL Container std::vector
+
+#include "ws-cryptoLib.h"
+#include "ws-fileHeader.h"
+#include "ws-keySchedule.h"
+#include "ws-secureArena.h"
+
+// One chunk sized piece of the data, along with the key stream it is encrypted with.
+struct Chunk
+{
+    const unsigned int * keyStream;     // From the key schedule, at least as long as data
+    SecureBlock data;                   // A chunkSize block of the job's SecureArena. size() is the blocks of it in use.
+    unsigned int writeOffset;           // Blocks at the front of data that aren't written out - the checksum, when decrypting
+    unsigned long long writeSize;       // Bytes of data written out for this chunk
+
+    // Data is broken into 4 byte chunks (ints, register size), last 4 byte chunk might contain less than 4 bytes of data.
+    // finalByteCount contains the number of bytes that contain data in the last 4 byte chunk, and is 0 unless this is the last chunk of the file.
+    unsigned int finalByteCount;
+
+    unsigned int hashBefore;            // Decryption only - checksum stored in the chunk by encryption
+    unsigned int hashAfter;             // Decryption only - checksum of the decrypted data
+    unsigned long long digest;          // Encryption only, when asked for - chunkDigest() of the plain data (ws-chunkDigest.h)
+    unsigned int frameWord;             // Compressed files only - the frame word written in front of the chunk (ws-fileHeader.h)
+    const unsigned int * rekeyStream;   // Rekeying only - the new key's stream for the same chunk (see rekeyChunk())
+};
+
+// Outcome of a decryption, chunk by chunk.
+struct ChecksumReport
+{
+    unsigned long long dataLength;                  // Bytes of encrypted data read in (written out, for a range)
+    std::vector<unsigned long long> badChunks;      // Index of every chunk that didn't match its checksum, in file order
+    bool lengthMatches;                             // False if the header's original length disagrees - whole chunks lost off the end
+    bool stoppedEarly;                              // stopOnBadChunk stopped at the first bad chunk, so later chunks weren't checked
+
+    ChecksumReport () : dataLength(0), lengthMatches(true), stoppedEarly(false) {}
+
+    bool passed () const
+    {
+        return badChunks.empty() && lengthMatches;
+    }
+};
+
+// Per-chunk work, shared by the file loops and CryptoContext.
+void                            finishChunk (Chunk & chunk, OPERATION operation, unsigned int chunkSize, unsigned long long bytesRead, bool finalChunk);
+void                            processChunk (Chunk & chunk, OPERATION operation);
+void                            rekeyChunk (Chunk & chunk);
+
+// Bare cipher - output is the same length as input. keyOffset is in bytes, and must be a multiple of 4.
+void                            cryptBuffer (const unsigned char * input, unsigned long long length, unsigned char * output, const KeySchedule & schedule, unsigned long long keyOffset, OPERATION operation);
+
+inline void encryptBuffer (const unsigned char * input, unsigned long long length, unsigned char * output, const KeySchedule & schedule, unsigned long long keyOffset = 0)
+{
+    cryptBuffer (input, length, output, schedule, keyOffset, ENCRYPT);
+}
+
+inline void decryptBuffer (const unsigned char * input, unsigned long long length, unsigned char * output, const KeySchedule & schedule, unsigned long long keyOffset = 0)
+{
+    cryptBuffer (input, length, output, schedule, keyOffset, DECRYPT);
+}
+
+class CryptoContext
+{
+public:
+    // chunkSize & totalLength are only used when encrypting - decryption reads them from the header.
+    // A totalLength given up front is written into the header, and finish() throws if the data doesn't add up to it.
+    CryptoContext (KeyScheduleCache & keys, OPERATION operation, unsigned int chunkSize = LEGACY_CHUNK_SIZE, unsigned long long totalLength = UNKNOWN_LENGTH);
+    ~CryptoContext ();
+
+    // Takes in the next length bytes, and appends whatever output is ready to output.
+    // A chunk is only processed once the data after it starts arriving, since the last chunk of the data is handled differently.
+    void update (const unsigned char * input, unsigned long long length, std::vector<unsigned char> & output);
+
+    // Processes the last chunk and appends the rest of the output. Returns report().passed() - always true when encrypting.
+    bool finish (std::vector<unsigned char> & output);
+
+    // Decryption only - chunks that have failed their checksums so far. lengthMatches is only set by finish().
+    const ChecksumReport & report () const
+    {
+        return checksums;
+    }
+
+private:
+    CryptoContext (const CryptoContext &);          // Not copyable - holds key stream & data
+    CryptoContext & operator= (const CryptoContext &);
+
+    void startChunks ();
+    void processFilledChunk (bool finalChunk, std::vector<unsigned char> & output);
+    void fill (const unsigned char * input, unsigned long long length, std::vector<unsigned char> & output);
+
+    KeyScheduleCache &          keys;
+    const KeySchedule *         schedule;           // Set once the chunk size is known
+    OPERATION                   operation;
+    FileHeader                  header;
+    std::vector<unsigned char>  headerBytes;        // Decryption only - header collected until all HEADER_SIZE bytes are in
+    bool                        headerDone;
+    SecureArena                 chunkMemory;        // One chunk, allocated once the chunk size is known
+    Chunk                       chunk;              // Chunk being filled
+    unsigned long long          chunkFill;          // Bytes of data in chunk so far
+    unsigned long long          chunkIndex;
+    unsigned long long          dataLength;         // Bytes of plain data, in or out
+    ChecksumReport              checksums;
+    bool                        finished;
+};
+
+#endif
@@ -0,0 +1,568 @@
+/*
+    Daemon mode (cryptoUtil serve) - keeps keys loaded and serves encrypt/decrypt/verify requests over a Unix domain socket,
+    so a program making many small calls doesn't pay for starting a process and reading a key file on every one of them.
+
+    Keys are loaded once when the daemon starts, each under a key ID, and their schedule for the daemon's chunk size is built up front.
+    Connections are served by a fixed pool of worker threads (ws-threadPool.h), one connection per worker at a time, and a connection
+    can send any number of requests one after another - so a client should keep its connection open rather than connect per call.
+
+    Protocol - each request is one line of text, answered by one line (followed by data, for inline enc & dec):
+        enc|dec|verify KEYID LENGTH\n       Followed by LENGTH bytes of data, sent over the socket (inline).
+        enc|dec|verify KEYID fd\n           With descriptors passed along with the line (SCM_RIGHTS) - input & output for enc & dec,
+                                            just input for verify. The input is read to its end and the output written straight to
+                                            the output descriptor, in pieces, so big files never pass through the socket.
+    Replies:
+        OK LENGTH\n                         Inline enc & dec: followed by the LENGTH bytes of output.
+                                            verify & descriptor requests: LENGTH is the length of the plain data, and nothing follows.
+        FAILED LENGTH BADCHUNKS\n           Decryption where BADCHUNKS chunks failed their checksums (0 when only the length was wrong).
+                                            Otherwise the same as OK - the output still follows an inline dec.
+        ERROR message\n                     The request failed. A request that can't be parsed also closes the connection.
+
+    Output is the format cryptoUtil writes (CryptoContext, ws-cryptoBuffer.h), so data encrypted through the daemon decrypts with
+    cryptoUtil and back. Inline requests are limited to MAX_INLINE_LENGTH, since their output is held until it's all ready.
+
+    The socket is made readable & writable by its owner only - anyone who can connect to it can use the keys.
+    Stops on SIGINT or SIGTERM (or stop()), once the requests in progress are answered, and removes the socket.
+
+    Linux & Mac only.
+
+    Written by William Showalter. williamshowalter@gmail.com.
+
+    Released under Creative Commons - creativecommons.org/licenses/by-nc-sa/3.0/
+    Attribution-NonCommercial-ShareAlike 3.0 Unported (CC BY-NC-SA 3.0)
+*/
+
+#ifndef WS_CRYPTODAEMON_H
+#define WS_CRYPTODAEMON_H
+
+#ifndef _WIN32
+
+#include <atomic>       // Stop flag, set from a signal handler or another thread
+#include <cerrno>       // EINTR
+#include <csignal>      // SIGINT, SIGTERM, SIGPIPE
+#include <cstring>      // memcpy, strerror
+#include <deque>        // Descriptors received but not yet used
+#include <map>          // Keys by ID
+#include <memory>       // std::unique_ptr
+#include <mutex>        // Open connection list
+#include <set>          // Open connections, shut down on stop
+#include <sstream>      // Parsing request lines
+#include <stdexcept>    // Thrown when the socket can't be set up
+#include <string>       // Request lines, key IDs
+#include <thread>       // std::thread::hardware_concurrency
+#include <vector>       // Buffers
+
+#include <poll.h>       // Waiting for connections without missing a stop
+#include <sys/socket.h> // socket, recvmsg, SCM_RIGHTS
+#include <sys/stat.h>   // chmod, fstat
+#include <sys/un.h>     // sockaddr_un
+#include <unistd.h>     // read, write, close, unlink
+
+#include "ws-cryptoBuffer.h"
+#include "ws-keySchedule.h"
+#include "ws-secureArena.h"
+#include "ws-threadPool.h"
+
+const unsigned long long    MAX_INLINE_LENGTH   = 64 * 1024 * 1024;     // Largest inline request - bigger data is sent as descriptors
+const unsigned int          MAX_REQUEST_LINE    = 256;                  // Longest request line, key ID included
+const unsigned int          RECEIVE_BYTES       = 64 * 1024;            // Socket reads, and descriptor reads & writes, go this much at a time
+const unsigned int          MAX_DESCRIPTORS     = 2;                    // Passed with one request
+
+class CryptoDaemon
+{
+public:
+    // chunkSize is what encryption uses. workerCount is the number of connections served at once - 0 for one per core.
+    CryptoDaemon (std::string socketPath, unsigned int chunkSize, unsigned int workerCount)
+    : path(socketPath), chunkSize(chunkSize), workerCount(workerCount), listenFd(-1), stopping(false)
+    {
+        checkChunkSize (chunkSize);
+        if (this->workerCount == 0)
+            this->workerCount = std::thread::hardware_concurrency();
+        if (this->workerCount == 0)
+            this->workerCount = 1;
+    }
+
+    ~CryptoDaemon ()
+    {
+        if (listenFd >= 0)
+        {
+            close (listenFd);
+            unlink (path.c_str());
+        }
+    }
+
+    void addKey (std::string keyId, std::string keyfilename)
+    {
+        /*
+         Loads a key file under keyId, and builds its schedule for the daemon's chunk size so the first request doesn't wait for it.
+         Decrypting a file with another chunk size builds that schedule the first time it's needed, and keeps it.
+
+         Throws std::runtime_error if the key can't be read, or keyId is taken or has spaces in it.
+         */
+
+        if (keyId.empty() || keyId.size() > MAX_REQUEST_LINE / 2 || keyId.find_first_of(" \t\r\n") != std::string::npos)
+            throw (std::runtime_error("Key ID \"" + keyId + "\" must be a single word."));
+        if (keys.count(keyId))
+            throw (std::runtime_error("Key ID \"" + keyId + "\" is used for more than one key."));
+
+        std::unique_ptr<KeyScheduleCache> & cache = keys[keyId];
+        try {
+            cache.reset(new KeyScheduleCache(keyfilename));
+            cache->schedule(chunkSize);
+        }
+        catch (...) {
+            keys.erase(keyId);
+            throw;
+        }
+    }
+
+    unsigned int workers () const
+    {
+        return workerCount;
+    }
+
+    void serve ()
+    {
+        /*
+         Listens on the socket and serves connections until stop() is called or SIGINT/SIGTERM arrives.
+
+         Throws std::runtime_error if the socket can't be created - a socket left by a daemon that didn't stop cleanly is replaced,
+         but one another daemon is still listening on is not.
+         */
+
+        listen();
+
+        // A client that hangs up mid-reply would otherwise kill the whole daemon.
+        signal (SIGPIPE, SIG_IGN);
+        signalled() = 0;
+        struct sigaction action;
+        memset (&action, 0, sizeof(action));
+        action.sa_handler = onSignal;
+        sigaction (SIGINT, &action, NULL);
+        sigaction (SIGTERM, &action, NULL);
+
+        {
+            ThreadPool pool (workerCount);
+
+            while (!stopping && !signalled())
+            {
+                // Wakes up now and then to notice a stop, since the signal might be handled on another thread.
+                struct pollfd waiting;
+                waiting.fd = listenFd;
+                waiting.events = POLLIN;
+                if (poll (&waiting, 1, 200) <= 0)
+                    continue;
+
+                int connection = accept (listenFd, NULL, NULL);
+                if (connection < 0)
+                    continue;
+
+                {
+                    std::lock_guard<std::mutex> lock(connectionMutex);
+                    connections.insert(connection);
+                }
+                pool.submit([this, connection] { serveConnection(connection); });
+            }
+
+            // Connections waiting for their next request see the end of the stream - ones mid request finish it first.
+            {
+                std::lock_guard<std::mutex> lock(connectionMutex);
+                for (std::set<int>::iterator i = connections.begin(); i != connections.end(); ++i)
+                    shutdown (*i, SHUT_RD);
+            }
+            pool.wait();
+        }
+
+        close (listenFd);
+        unlink (path.c_str());
+        listenFd = -1;
+    }
+
+    // Safe to call from any thread.
+    void stop ()
+    {
+        stopping = true;
+    }
+
+private:
+    CryptoDaemon (const CryptoDaemon &);            // Not copyable - owns the socket & keys
+    CryptoDaemon & operator= (const CryptoDaemon &);
+
+    // Bytes & descriptors received on one connection, not yet used by a request.
+    struct Connection
+    {
+        int fd;
+        std::vector<unsigned char> buffer;
+        unsigned long long start;
+        unsigned long long end;
+        std::deque<int> descriptors;
+
+        explicit Connection (int fd) : fd(fd), buffer(RECEIVE_BYTES), start(0), end(0) {}
+
+        ~Connection ()
+        {
+            secureZero (&buffer[0], buffer.size());
+            for (unsigned int i = 0; i < descriptors.size(); i++)
+                close (descriptors[i]);
+            close (fd);
+        }
+    };
+
+    static volatile sig_atomic_t & signalled ()
+    {
+        static volatile sig_atomic_t flag = 0;
+        return flag;
+    }
+
+    static void onSignal (int)
+    {
+        signalled() = 1;
+    }
+
+    void listen ()
+    {
+        struct sockaddr_un address;
+        memset (&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(address.sun_path))
+            throw (std::runtime_error("Socket path must be between 1 and " + std::to_string(sizeof(address.sun_path) - 1) + " characters."));
+        memcpy (address.sun_path, path.c_str(), path.size());
+
+        listenFd = socket (AF_UNIX, SOCK_STREAM, 0);
+        if (listenFd < 0)
+            throw (std::runtime_error("Could not create socket."));
+
+        // A socket nobody answers on is left over from a daemon that was killed - replace it.
+        struct stat existing;
+        if (stat (path.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode))
+        {
+            int probe = socket (AF_UNIX, SOCK_STREAM, 0);
+            bool answered = (probe >= 0 && connect (probe, (struct sockaddr *)&address, sizeof(address)) == 0);
+            if (probe >= 0)
+                close (probe);
+            if (answered)
+                throw (std::runtime_error("Another daemon is already listening on " + path + "."));
+            unlink (path.c_str());
+        }
+
+        // Owner only, from the moment it exists.
+        mode_t oldMask = umask (0177);
+        int bound = bind (listenFd, (struct sockaddr *)&address, sizeof(address));
+        umask (oldMask);
+
+        if (bound != 0 || ::listen (listenFd, SOMAXCONN) != 0)
+        {
+            std::string reason = strerror(errno);
+            close (listenFd);
+            listenFd = -1;
+            throw (std::runtime_error("Could not listen on " + path + " - " + reason + "."));
+        }
+    }
+
+    void serveConnection (int fd)
+    {
+        Connection connection (fd);
+        try {
+            while (serveRequest (connection))
+                ;
+        }
+        catch (...) {
+            // Only a lost connection gets here - every request's own errors are sent back to the client.
+        }
+
+        // Off the list before the descriptor is closed (by ~Connection, after the lock is released), since its number can be reused right away.
+        std::lock_guard<std::mutex> lock(connectionMutex);
+        connections.erase(fd);
+    }
+
+    bool receive (Connection & connection)
+    {
+        /*
+         Reads whatever has arrived into the connection's buffer, along with any descriptors sent with it.
+         Returns false once the client has hung up.
+         */
+
+        if (connection.start == connection.end)
+            connection.start = connection.end = 0;
+        else if (connection.end == connection.buffer.size())
+        {
+            memmove (&connection.buffer[0], &connection.buffer[connection.start], connection.end - connection.start);
+            connection.end -= connection.start;
+            connection.start = 0;
+        }
+
+        struct iovec data;
+        data.iov_base = &connection.buffer[connection.end];
+        data.iov_len = connection.buffer.size() - connection.end;
+
+        union
+        {
+            struct cmsghdr header;
+            char space[CMSG_SPACE(MAX_DESCRIPTORS * sizeof(int))];
+        } control;
+
+        struct msghdr message;
+        memset (&message, 0, sizeof(message));
+        message.msg_iov = &data;
+        message.msg_iovlen = 1;
+        message.msg_control = control.space;
+        message.msg_controllen = sizeof(control.space);
+
+        ssize_t count;
+        do
+            count = recvmsg (connection.fd, &message, 0);
+        while (count < 0 && errno == EINTR);
+
+        for (struct cmsghdr * item = CMSG_FIRSTHDR(&message); item != NULL; item = CMSG_NXTHDR(&message, item))
+        {
+            if (item->cmsg_level == SOL_SOCKET && item->cmsg_type == SCM_RIGHTS)
+            {
+                unsigned int received = (item->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                for (unsigned int i = 0; i < received; i++)
+                {
+                    int descriptor;
+                    memcpy (&descriptor, CMSG_DATA(item) + i * sizeof(int), sizeof(int));
+                    connection.descriptors.push_back(descriptor);
+                }
+            }
+        }
+
+        if (count <= 0)
+            return false;
+
+        connection.end += count;
+        return true;
+    }
+
+    bool readLine (Connection & connection, std::string & line)
+    {
+        // False if the client hung up between requests, or sent a line too long to be a request.
+        while (true)
+        {
+            for (unsigned long long i = connection.start; i < connection.end; i++)
+            {
+                if (connection.buffer[i] == '\n')
+                {
+                    line.assign ((const char *)&connection.buffer[connection.start], i - connection.start);
+                    connection.start = i + 1;
+                    return true;
+                }
+            }
+
+            if (connection.end - connection.start > MAX_REQUEST_LINE || !receive (connection))
+                return false;
+        }
+    }
+
+    static void writeAll (int fd, const void * data, unsigned long long length)
+    {
+        const char * bytes = (const char *)data;
+        while (length)
+        {
+            ssize_t written = write (fd, bytes, length);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+                throw (std::runtime_error("Could not write output."));
+
+            bytes += written;
+            length -= written;
+        }
+    }
+
+    static void reply (Connection & connection, std::string line, const std::vector<unsigned char> * data = NULL)
+    {
+        line += "\n";
+        writeAll (connection.fd, line.data(), line.size());
+        if (data && !data->empty())
+            writeAll (connection.fd, &(*data)[0], data->size());
+    }
+
+    static void takeDescriptor (Connection & connection, int & descriptor)
+    {
+        if (connection.descriptors.empty())
+            throw (std::runtime_error("Request needs more descriptors than were sent with it."));
+        descriptor = connection.descriptors.front();
+        connection.descriptors.pop_front();
+    }
+
+    static std::string result (OPERATION operation, const CryptoContext & context, unsigned long long length)
+    {
+        std::ostringstream line;
+        if (operation == DECRYPT && !context.report().passed())
+            line << "FAILED " << length << " " << context.report().badChunks.size();
+        else
+            line << "OK " << length;
+        return line.str();
+    }
+
+    bool serveRequest (Connection & connection)
+    {
+        /*
+         Reads one request and sends its reply. Returns false when the connection should be closed - the client hung up,
+         or sent something that isn't a request, after which nothing else it sends can be trusted to line up.
+         */
+
+        std::string line;
+        if (!readLine (connection, line))
+            return false;
+        if (!line.empty() && line[line.size()-1] == '\r')
+            line.erase(line.size()-1);
+
+        std::istringstream words (line);
+        std::string command, keyId, size;
+        words >> command >> keyId >> size;
+
+        OPERATION operation = (command == "enc") ? ENCRYPT : DECRYPT;
+        bool verifyOnly = (command == "verify");
+        bool inlineData = (size != "fd");
+        unsigned long long length = 0;
+        std::istringstream number (size);
+
+        if ((command != "enc" && command != "dec" && !verifyOnly) || keyId.empty() || size.empty() || !words.eof()
+            || (inlineData && (size[0] == '-' || !(number >> length) || !number.eof())))
+        {
+            reply (connection, "ERROR Expected enc|dec|verify KEYID LENGTH|fd");
+            return false;
+        }
+
+        if (inlineData && length > MAX_INLINE_LENGTH)
+        {
+            reply (connection, "ERROR Inline data is limited to " + std::to_string(MAX_INLINE_LENGTH) + " bytes - send descriptors instead");
+            return false;
+        }
+
+        std::map<std::string, std::unique_ptr<KeyScheduleCache> >::iterator key = keys.find(keyId);
+        std::string error;
+
+        if (inlineData)
+        {
+            // Every byte of the data has to be read, even after an error, or the next request wouldn't start where it should.
+            std::vector<unsigned char> output;
+            std::unique_ptr<CryptoContext> context;
+            if (key == keys.end())
+                error = "Unknown key ID " + keyId;
+            else
+                context.reset(new CryptoContext(*key->second, operation, chunkSize, (operation == ENCRYPT) ? length : UNKNOWN_LENGTH));
+
+            unsigned long long remaining = length;
+            while (remaining)
+            {
+                if (connection.start == connection.end && !receive (connection))
+                    return false;
+
+                unsigned long long count = std::min (remaining, connection.end - connection.start);
+                if (error.empty())
+                {
+                    try {
+                        context->update (&connection.buffer[connection.start], count, output);
+                    }
+                    catch (std::exception & e) {
+                        error = e.what();
+                    }
+                }
+                secureZero (&connection.buffer[connection.start], count);
+                connection.start += count;
+                remaining -= count;
+            }
+
+            if (error.empty())
+            {
+                try {
+                    context->finish (output);
+                }
+                catch (std::exception & e) {
+                    error = e.what();
+                }
+            }
+
+            // verify decrypts the same as dec, but only says whether it passed.
+            if (!error.empty())
+                reply (connection, "ERROR " + error);
+            else
+                reply (connection, result (operation, *context, output.size()), verifyOnly ? NULL : &output);
+
+            if (!output.empty())
+                secureZero (&output[0], output.size());
+            return true;
+        }
+
+        // Descriptors - output goes straight to the output descriptor a piece at a time, so nothing is held but one piece.
+        int input = -1, output = -1;
+        try
+        {
+            takeDescriptor (connection, input);
+            if (!verifyOnly)
+                takeDescriptor (connection, output);
+
+            if (key == keys.end())
+                throw (std::runtime_error("Unknown key ID " + keyId));
+
+            // A whole regular file's length is known up front, and goes in the header like it does for cryptoUtil.
+            unsigned long long totalLength = UNKNOWN_LENGTH;
+            struct stat inputStats;
+            off_t position = lseek (input, 0, SEEK_CUR);
+            if (operation == ENCRYPT && fstat (input, &inputStats) == 0 && S_ISREG(inputStats.st_mode) && position >= 0 && position <= inputStats.st_size)
+                totalLength = inputStats.st_size - position;
+
+            CryptoContext context (*key->second, operation, chunkSize, totalLength);
+            SecureArena pieceMemory (RECEIVE_BYTES, 1);
+            unsigned char * piece = (unsigned char *)pieceMemory.commit (0, RECEIVE_BYTES);
+            std::vector<unsigned char> pieceOutput;
+            unsigned long long inputLength = 0, outputLength = 0;
+
+            while (true)
+            {
+                ssize_t count = read (input, piece, RECEIVE_BYTES);
+                if (count < 0 && errno == EINTR)
+                    continue;
+                if (count < 0)
+                    throw (std::runtime_error("Could not read from input descriptor."));
+
+                if (count == 0)
+                    context.finish (pieceOutput);
+                else
+                    context.update (piece, count, pieceOutput);
+                inputLength += count;
+
+                outputLength += pieceOutput.size();
+                if (output >= 0 && !pieceOutput.empty())
+                    writeAll (output, &pieceOutput[0], pieceOutput.size());
+                if (!pieceOutput.empty())
+                    secureZero (&pieceOutput[0], pieceOutput.size());
+                pieceOutput.clear();
+
+                if (count == 0)
+                    break;
+            }
+
+            reply (connection, result (operation, context, (operation == ENCRYPT) ? inputLength : outputLength));
+        }
+
+        catch (std::exception & e) {
+            error = e.what();
+        }
+
+        if (input >= 0)
+            close (input);
+        if (output >= 0)
+            close (output);
+
+        if (!error.empty())
+            reply (connection, "ERROR " + error);
+        return true;
+    }
+
+    std::string                                                 path;
+    unsigned int                                                chunkSize;
+    unsigned int                                                workerCount;
+    int                                                         listenFd;
+    std::atomic<bool>                                           stopping;
+    std::map<std::string, std::unique_ptr<KeyScheduleCache> >   keys;               // Only changed before serve(), so workers read it without a lock
+    std::set<int>                                               connections;        // Open connections, shut down when stopping
+    std::mutex                                                  connectionMutex;
+};
+
+#endif
+
+#endif
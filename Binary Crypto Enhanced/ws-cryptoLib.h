@@ -0,0 +1,58 @@
+/*
+    Shared declarations for the encryption & hashing kernels.
+
+    The 32bit build links the assembly versions in "ws-cryptoLibEnc.nasm" and "ws-cryptoLibHash.nasm".
+    The 64bit build links "ws-cryptoLib64.cpp" instead, which provides the same functions using SSE2/AVX2 vector
+    code when the processor supports it, and a portable scalar loop when it doesn't.
+
+    Written by William Showalter. williamshowalter@gmail.com.
+
+    Released under Creative Commons - creativecommons.org/licenses/by-nc-sa/3.0/
+    Attribution-NonCommercial-ShareAlike 3.0 Unported (CC BY-NC-SA 3.0)
+*/
+
+#ifndef WS_CRYPTOLIB_H
+#define WS_CRYPTOLIB_H
+
+#define WS_ROTATE_COUNT 16                            // Multiple of 8 (full byte increments). Must match ROTATE_COUNT in ws-cryptoLibEnc.nasm.
+const unsigned int BIT_SHIFT_COUNT = WS_ROTATE_COUNT;
+enum OPERATION {ENCRYPT = 0, DECRYPT = 1};
+
+// Defined by whichever kernels are linked in, and named for the rotate count they were built with (kernelsRotate16).
+// Reading it through kernelRotateCount() makes a build whose kernels use a different count than BIT_SHIFT_COUNT fail to link,
+// instead of writing files neither build can read. The 64bit kernels are templates instantiated with BIT_SHIFT_COUNT, so they always match.
+#define WS_KERNEL_ROTATE_SYMBOL(count) WS_KERNEL_ROTATE_PASTE(count)
+#define WS_KERNEL_ROTATE_PASTE(count) kernelsRotate##count
+extern "C" const unsigned int WS_KERNEL_ROTATE_SYMBOL(WS_ROTATE_COUNT);
+
+inline unsigned int kernelRotateCount ()
+{
+    return WS_KERNEL_ROTATE_SYMBOL(WS_ROTATE_COUNT);
+}
+
+// Encrypts/decrypts [data, dataEnd) in place, looping the key [key, keyEnd) when it is shorter than the data.
+extern "C" int encryptionAlgorithm(unsigned int *, unsigned int *, unsigned int *, unsigned int *, OPERATION);
+
+// Same as encryptionAlgorithm, but reads [data, dataEnd) and writes the result to output (which may equal data).
+// The first element uses key element keyPosition, and the key loops back to key (not keyPosition) after keyEnd.
+extern "C" int encryptionAlgorithmCopy(const unsigned int * data, const unsigned int * dataEnd, unsigned int * output,
+                                       const unsigned int * key, const unsigned int * keyEnd, const unsigned int * keyPosition, OPERATION);
+
+// Applies a combined key stream (built by KeySchedule, one word per data element, never wraps) to [data, dataEnd), writing to output.
+//      encrypt: output = ror(data,16) ^ stream         decrypt: output = rol(data ^ stream,16)
+extern "C" int keyStreamAlgorithm(const unsigned int * data, const unsigned int * dataEnd, unsigned int * output, const unsigned int * keyStream, OPERATION);
+
+// keyStreamAlgorithm and hashingAlgorithm in one pass. Returns the xor hash of the plain data -
+// the input when encrypting, the output when decrypting.
+extern "C" int keyStreamHashAlgorithm(const unsigned int * data, const unsigned int * dataEnd, unsigned int * output, const unsigned int * keyStream, OPERATION);
+
+// Returns the xor of every 32bit block in [data, dataEnd).
+extern "C" int hashingAlgorithm (unsigned int *, unsigned int *);
+
+// 64bit build only. Switches every kernel above to one version - "avx2", "sse2" or "scalar" - or back to the fastest with "auto",
+// so the benchmark can time each version on the same processor. Returns false, changing nothing, if the processor doesn't support it.
+// Not thread safe - only call it while nothing is being encrypted.
+extern "C" bool useKernels (const char * name);
+extern "C" const char * kernelsInUse ();
+
+#endif
@@ -0,0 +1,627 @@
+/*
+    64bit encryption & hashing kernels, replacing "ws-cryptoLibEnc.nasm" and "ws-cryptoLibHash.nasm" in the 64bit build.
+
+    Performs the same single pass cipher as the assembly version: every 32bit element of data is rotated by
+    ROTATE_COUNT bits and xor'd against a key stream word built from the key word by rotate/xor doubling.
+
+        encrypt:    data = ror(data,16) xor (ror(key,1) xor ror(key,2) xor ... xor ror(key,16))
+        decrypt:    data = rol(data,16) xor (rol(key,0) xor rol(key,1) xor ... xor rol(key,15))
+
+    Every kernel is a template on the number of rounds, instantiated once with BIT_SHIFT_COUNT from ws-cryptoLib.h - so the rotate count
+    can't drift from the one the rest of the program uses. The Rounds templates fold the rounds of the key stream at compile time,
+    by doubling: the xor of the key rotated 0..N-1 bits, xor'd with itself rotated N bits, is the xor of the key rotated 0..2N-1 bits.
+
+    Three versions of each kernel are compiled in:
+        AVX2   - 8 elements (256 bits) per step
+        SSE2   - 4 elements (128 bits) per step
+        Scalar - 1 element per step, portable C++ for processors with neither (or non-x86 machines)
+
+    The fastest version the processor supports is chosen once at startup using cpuid.
+
+    encryptionAlgorithm picks how to loop the key at runtime. A short key is combined into its key stream once, into a tile of whole copies
+    of it, and the data is run against the tile with the key stream kernel - so each key word's rounds are folded once, not once per data word.
+    A power of two key length fits a fixed size tile exactly, and finds its place in it with a mask.
+
+    Written by William Showalter. williamshowalter@gmail.com.
+
+    Released under Creative Commons - creativecommons.org/licenses/by-nc-sa/3.0/
+    Attribution-NonCommercial-ShareAlike 3.0 Unported (CC BY-NC-SA 3.0)
+
+    **NOTE**
+       I am not a crytologist/cryptanalyst and have not analysed this encryption algorithm for security.
+           Some implementation choices may very well lower security.
+
+    ** DO NOT expect actual security if you choose to encrypt actual data using this.
+*/
+
+#include <cstddef>      // std::size_t
+#include <string>       // Kernel version names
+
+#if defined(__x86_64__) || defined(_M_X64)
+#  define WS_CRYPTO_X86 1
+#  include <immintrin.h> // SSE2 & AVX2 intrinsics
+#endif
+
+#include "ws-cryptoLib.h"
+
+namespace
+{
+    const unsigned int ROTATE_COUNT = BIT_SHIFT_COUNT;  // Rounds every kernel is instantiated with
+    static_assert (ROTATE_COUNT > 0 && ROTATE_COUNT < 32 && ROTATE_COUNT % 8 == 0, "Rotate count must be a whole number of bytes, between 8 and 24");
+    const std::size_t KEY_TILE_WORDS = 256;             // Short keys are repeated into a tile of at least this many words so vector loops get long runs.
+                                                        // A power of two, so any power of two key length fills it exactly.
+
+    typedef void         (*CryptRun)(const unsigned int * data, unsigned int * output, const unsigned int * key, std::size_t count, OPERATION operation);
+    typedef void         (*StreamRun)(const unsigned int * data, unsigned int * output, const unsigned int * keyStream, std::size_t count, OPERATION operation);
+    typedef unsigned int (*StreamHashRun)(const unsigned int * data, unsigned int * output, const unsigned int * keyStream, std::size_t count, OPERATION operation);
+    typedef unsigned int (*HashRun) (const unsigned int * data, std::size_t count);
+
+    /************************* Scalar *************************/
+
+    inline unsigned int rotateRight (unsigned int value, unsigned int count)
+    {
+        return (value >> count) | (value << (32 - count));
+    }
+
+    inline unsigned int rotateLeft (unsigned int value, unsigned int count)
+    {
+        return (value << count) | (value >> (32 - count));
+    }
+
+    // Xor of the key rotated by 0 through ROUNDS-1 bits, right (encrypt) or left (decrypt). For 16 rounds that's 4 doublings.
+    template <unsigned int ROUNDS> struct RoundsScalar
+    {
+        static unsigned int right (unsigned int key)
+        {
+            unsigned int half = RoundsScalar<ROUNDS/2>::right(key);
+            unsigned int doubled = half ^ rotateRight(half, ROUNDS/2);
+            return (ROUNDS % 2) ? doubled ^ rotateRight(key, ROUNDS - 1) : doubled;
+        }
+
+        static unsigned int left (unsigned int key)
+        {
+            unsigned int half = RoundsScalar<ROUNDS/2>::left(key);
+            unsigned int doubled = half ^ rotateLeft(half, ROUNDS/2);
+            return (ROUNDS % 2) ? doubled ^ rotateLeft(key, ROUNDS - 1) : doubled;
+        }
+    };
+
+    template <> struct RoundsScalar<1>
+    {
+        static unsigned int right (unsigned int key)    { return key; }
+        static unsigned int left (unsigned int key)     { return key; }
+    };
+
+    template <unsigned int ROUNDS> void cryptScalar (const unsigned int * data, unsigned int * output, const unsigned int * key, std::size_t count, OPERATION operation)
+    {
+        if (operation == ENCRYPT)
+        {
+            for (std::size_t i = 0; i < count; i++)
+            {
+                unsigned int stream = rotateRight(RoundsScalar<ROUNDS>::right(key[i]), 1);    // rounds 1..ROUNDS
+                output[i] = rotateRight(data[i], ROUNDS) ^ stream;
+            }
+        }
+        else
+        {
+            for (std::size_t i = 0; i < count; i++)
+            {
+                unsigned int stream = RoundsScalar<ROUNDS>::left(key[i]);                      // rounds 0..ROUNDS-1
+                output[i] = rotateLeft(data[i], ROUNDS) ^ stream;
+            }
+        }
+    }
+
+    template <unsigned int ROUNDS> void streamScalar (const unsigned int * data, unsigned int * output, const unsigned int * keyStream, std::size_t count, OPERATION operation)
+    {
+        if (operation == ENCRYPT)
+        {
+            for (std::size_t i = 0; i < count; i++)
+                output[i] = rotateRight(data[i], ROUNDS) ^ keyStream[i];
+        }
+        else
+        {
+            for (std::size_t i = 0; i < count; i++)
+                output[i] = rotateLeft(data[i] ^ keyStream[i], ROUNDS);
+        }
+    }
+
+    template <unsigned int ROUNDS> unsigned int streamHashScalar (const unsigned int * data, unsigned int * output, const unsigned int * keyStream, std::size_t count, OPERATION operation)
+    {
+        unsigned int hash = 0;
+        if (operation == ENCRYPT)
+        {
+            for (std::size_t i = 0; i < count; i++)
+            {
+                unsigned int block = data[i];
+                hash ^= block;
+                output[i] = rotateRight(block, ROUNDS) ^ keyStream[i];
+            }
+        }
+        else
+        {
+            for (std::size_t i = 0; i < count; i++)
+            {
+                unsigned int block = rotateLeft(data[i] ^ keyStream[i], ROUNDS);
+                hash ^= block;
+                output[i] = block;
+            }
+        }
+        return hash;
+    }
+
+    unsigned int hashScalar (const unsigned int * data, std::size_t count)
+    {
+        unsigned int hash = 0;
+        for (std::size_t i = 0; i < count; i++)
+            hash ^= data[i];
+        return hash;
+    }
+
+#ifdef WS_CRYPTO_X86
+
+    /************************* SSE2 *************************/
+
+    template <int N> inline __m128i rotateRight128 (__m128i value)
+    {
+        return _mm_or_si128(_mm_srli_epi32(value, N), _mm_slli_epi32(value, 32 - N));
+    }
+
+    template <int N> inline __m128i rotateLeft128 (__m128i value)
+    {
+        return _mm_or_si128(_mm_slli_epi32(value, N), _mm_srli_epi32(value, 32 - N));
+    }
+
+    template <unsigned int ROUNDS> struct Rounds128
+    {
+        static __m128i right (__m128i key)
+        {
+            __m128i half = Rounds128<ROUNDS/2>::right(key);
+            __m128i doubled = _mm_xor_si128(half, rotateRight128<ROUNDS/2>(half));
+            return (ROUNDS % 2) ? _mm_xor_si128(doubled, rotateRight128<ROUNDS - 1>(key)) : doubled;
+        }
+
+        static __m128i left (__m128i key)
+        {
+            __m128i half = Rounds128<ROUNDS/2>::left(key);
+            __m128i doubled = _mm_xor_si128(half, rotateLeft128<ROUNDS/2>(half));
+            return (ROUNDS % 2) ? _mm_xor_si128(doubled, rotateLeft128<ROUNDS - 1>(key)) : doubled;
+        }
+    };
+
+    template <> struct Rounds128<1>
+    {
+        static __m128i right (__m128i key)              { return key; }
+        static __m128i left (__m128i key)               { return key; }
+    };
+
+    template <unsigned int ROUNDS> void cryptSSE2 (const unsigned int * data, unsigned int * output, const unsigned int * key, std::size_t count, OPERATION operation)
+    {
+        std::size_t i = 0;
+        if (operation == ENCRYPT)
+        {
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128i stream = rotateRight128<1>(Rounds128<ROUNDS>::right(_mm_loadu_si128((const __m128i *)(key + i))));
+
+                __m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+                block = _mm_xor_si128(rotateRight128<ROUNDS>(block), stream);
+                _mm_storeu_si128((__m128i *)(output + i), block);
+            }
+        }
+        else
+        {
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128i stream = Rounds128<ROUNDS>::left(_mm_loadu_si128((const __m128i *)(key + i)));
+
+                __m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+                block = _mm_xor_si128(rotateLeft128<ROUNDS>(block), stream);
+                _mm_storeu_si128((__m128i *)(output + i), block);
+            }
+        }
+
+        // Leftover elements that don't fill a vector
+        cryptScalar<ROUNDS>(data + i, output + i, key + i, count - i, operation);
+    }
+
+    template <unsigned int ROUNDS> void streamSSE2 (const unsigned int * data, unsigned int * output, const unsigned int * keyStream, std::size_t count, OPERATION operation)
+    {
+        std::size_t i = 0;
+        if (operation == ENCRYPT)
+        {
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+                block = _mm_xor_si128(rotateRight128<ROUNDS>(block), _mm_loadu_si128((const __m128i *)(keyStream + i)));
+                _mm_storeu_si128((__m128i *)(output + i), block);
+            }
+        }
+        else
+        {
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+                block = rotateLeft128<ROUNDS>(_mm_xor_si128(block, _mm_loadu_si128((const __m128i *)(keyStream + i))));
+                _mm_storeu_si128((__m128i *)(output + i), block);
+            }
+        }
+
+        streamScalar<ROUNDS>(data + i, output + i, keyStream + i, count - i, operation);
+    }
+
+    inline unsigned int foldLanes128 (__m128i hash)
+    {
+        hash = _mm_xor_si128(hash, _mm_shuffle_epi32(hash, _MM_SHUFFLE(1, 0, 3, 2)));
+        hash = _mm_xor_si128(hash, _mm_shuffle_epi32(hash, _MM_SHUFFLE(2, 3, 0, 1)));
+        return (unsigned int)_mm_cvtsi128_si32(hash);
+    }
+
+    template <unsigned int ROUNDS> unsigned int streamHashSSE2 (const unsigned int * data, unsigned int * output, const unsigned int * keyStream, std::size_t count, OPERATION operation)
+    {
+        __m128i hash = _mm_setzero_si128();
+        std::size_t i = 0;
+        if (operation == ENCRYPT)
+        {
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+                hash = _mm_xor_si128(hash, block);
+                block = _mm_xor_si128(rotateRight128<ROUNDS>(block), _mm_loadu_si128((const __m128i *)(keyStream + i)));
+                _mm_storeu_si128((__m128i *)(output + i), block);
+            }
+        }
+        else
+        {
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+                block = rotateLeft128<ROUNDS>(_mm_xor_si128(block, _mm_loadu_si128((const __m128i *)(keyStream + i))));
+                hash = _mm_xor_si128(hash, block);
+                _mm_storeu_si128((__m128i *)(output + i), block);
+            }
+        }
+
+        return foldLanes128(hash) ^ streamHashScalar<ROUNDS>(data + i, output + i, keyStream + i, count - i, operation);
+    }
+
+    unsigned int hashSSE2 (const unsigned int * data, std::size_t count)
+    {
+        __m128i hash = _mm_setzero_si128();
+        std::size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+            hash = _mm_xor_si128(hash, _mm_loadu_si128((const __m128i *)(data + i)));
+
+        // Fold the 4 lanes together
+        return foldLanes128(hash) ^ hashScalar(data + i, count - i);
+    }
+
+    /************************* AVX2 *************************/
+
+    template <int N> __attribute__((target("avx2"))) inline __m256i rotateRight256 (__m256i value)
+    {
+        return _mm256_or_si256(_mm256_srli_epi32(value, N), _mm256_slli_epi32(value, 32 - N));
+    }
+
+    template <int N> __attribute__((target("avx2"))) inline __m256i rotateLeft256 (__m256i value)
+    {
+        return _mm256_or_si256(_mm256_slli_epi32(value, N), _mm256_srli_epi32(value, 32 - N));
+    }
+
+    template <unsigned int ROUNDS> struct Rounds256
+    {
+        __attribute__((target("avx2"))) static __m256i right (__m256i key)
+        {
+            __m256i half = Rounds256<ROUNDS/2>::right(key);
+            __m256i doubled = _mm256_xor_si256(half, rotateRight256<ROUNDS/2>(half));
+            return (ROUNDS % 2) ? _mm256_xor_si256(doubled, rotateRight256<ROUNDS - 1>(key)) : doubled;
+        }
+
+        __attribute__((target("avx2"))) static __m256i left (__m256i key)
+        {
+            __m256i half = Rounds256<ROUNDS/2>::left(key);
+            __m256i doubled = _mm256_xor_si256(half, rotateLeft256<ROUNDS/2>(half));
+            return (ROUNDS % 2) ? _mm256_xor_si256(doubled, rotateLeft256<ROUNDS - 1>(key)) : doubled;
+        }
+    };
+
+    template <> struct Rounds256<1>
+    {
+        __attribute__((target("avx2"))) static __m256i right (__m256i key)  { return key; }
+        __attribute__((target("avx2"))) static __m256i left (__m256i key)   { return key; }
+    };
+
+    template <unsigned int ROUNDS> __attribute__((target("avx2"))) void cryptAVX2 (const unsigned int * data, unsigned int * output, const unsigned int * key, std::size_t count, OPERATION operation)
+    {
+        std::size_t i = 0;
+        if (operation == ENCRYPT)
+        {
+            for (; i + 8 <= count; i += 8)
+            {
+                __m256i stream = rotateRight256<1>(Rounds256<ROUNDS>::right(_mm256_loadu_si256((const __m256i *)(key + i))));
+
+                __m256i block = _mm256_loadu_si256((const __m256i *)(data + i));
+                block = _mm256_xor_si256(rotateRight256<ROUNDS>(block), stream);
+                _mm256_storeu_si256((__m256i *)(output + i), block);
+            }
+        }
+        else
+        {
+            for (; i + 8 <= count; i += 8)
+            {
+                __m256i stream = Rounds256<ROUNDS>::left(_mm256_loadu_si256((const __m256i *)(key + i)));
+
+                __m256i block = _mm256_loadu_si256((const __m256i *)(data + i));
+                block = _mm256_xor_si256(rotateLeft256<ROUNDS>(block), stream);
+                _mm256_storeu_si256((__m256i *)(output + i), block);
+            }
+        }
+
+        cryptSSE2<ROUNDS>(data + i, output + i, key + i, count - i, operation);
+    }
+
+    template <unsigned int ROUNDS> __attribute__((target("avx2"))) void streamAVX2 (const unsigned int * data, unsigned int * output, const unsigned int * keyStream, std::size_t count, OPERATION operation)
+    {
+        std::size_t i = 0;
+        if (operation == ENCRYPT)
+        {
+            for (; i + 8 <= count; i += 8)
+            {
+                __m256i block = _mm256_loadu_si256((const __m256i *)(data + i));
+                block = _mm256_xor_si256(rotateRight256<ROUNDS>(block), _mm256_loadu_si256((const __m256i *)(keyStream + i)));
+                _mm256_storeu_si256((__m256i *)(output + i), block);
+            }
+        }
+        else
+        {
+            for (; i + 8 <= count; i += 8)
+            {
+                __m256i block = _mm256_loadu_si256((const __m256i *)(data + i));
+                block = rotateLeft256<ROUNDS>(_mm256_xor_si256(block, _mm256_loadu_si256((const __m256i *)(keyStream + i))));
+                _mm256_storeu_si256((__m256i *)(output + i), block);
+            }
+        }
+
+        streamSSE2<ROUNDS>(data + i, output + i, keyStream + i, count - i, operation);
+    }
+
+    __attribute__((target("avx2"))) inline unsigned int foldLanes256 (__m256i hash)
+    {
+        // Fold the upper 128 bits onto the lower, then finish with the SSE2 reduction
+        return foldLanes128(_mm_xor_si128(_mm256_castsi256_si128(hash), _mm256_extracti128_si256(hash, 1)));
+    }
+
+    template <unsigned int ROUNDS> __attribute__((target("avx2"))) unsigned int streamHashAVX2 (const unsigned int * data, unsigned int * output, const unsigned int * keyStream, std::size_t count, OPERATION operation)
+    {
+        __m256i hash = _mm256_setzero_si256();
+        std::size_t i = 0;
+        if (operation == ENCRYPT)
+        {
+            for (; i + 8 <= count; i += 8)
+            {
+                __m256i block = _mm256_loadu_si256((const __m256i *)(data + i));
+                hash = _mm256_xor_si256(hash, block);
+                block = _mm256_xor_si256(rotateRight256<ROUNDS>(block), _mm256_loadu_si256((const __m256i *)(keyStream + i)));
+                _mm256_storeu_si256((__m256i *)(output + i), block);
+            }
+        }
+        else
+        {
+            for (; i + 8 <= count; i += 8)
+            {
+                __m256i block = _mm256_loadu_si256((const __m256i *)(data + i));
+                block = rotateLeft256<ROUNDS>(_mm256_xor_si256(block, _mm256_loadu_si256((const __m256i *)(keyStream + i))));
+                hash = _mm256_xor_si256(hash, block);
+                _mm256_storeu_si256((__m256i *)(output + i), block);
+            }
+        }
+
+        return foldLanes256(hash) ^ streamHashSSE2<ROUNDS>(data + i, output + i, keyStream + i, count - i, operation);
+    }
+
+    __attribute__((target("avx2"))) unsigned int hashAVX2 (const unsigned int * data, std::size_t count)
+    {
+        __m256i hash = _mm256_setzero_si256();
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+            hash = _mm256_xor_si256(hash, _mm256_loadu_si256((const __m256i *)(data + i)));
+
+        return foldLanes256(hash) ^ hashSSE2(data + i, count - i);
+    }
+
+#endif // WS_CRYPTO_X86
+
+    /************************* Dispatch *************************/
+
+    struct Kernels
+    {
+        const char *  name;
+        CryptRun      crypt;
+        StreamRun     stream;
+        StreamHashRun streamHash;
+        HashRun       hash;
+    };
+
+    // Every version instantiated with the one rotate count the file format uses.
+    const Kernels scalarKernels = {"scalar", cryptScalar<ROTATE_COUNT>, streamScalar<ROTATE_COUNT>, streamHashScalar<ROTATE_COUNT>, hashScalar};
+#ifdef WS_CRYPTO_X86
+    const Kernels sse2Kernels   = {"sse2", cryptSSE2<ROTATE_COUNT>, streamSSE2<ROTATE_COUNT>, streamHashSSE2<ROTATE_COUNT>, hashSSE2};
+    const Kernels avx2Kernels   = {"avx2", cryptAVX2<ROTATE_COUNT>, streamAVX2<ROTATE_COUNT>, streamHashAVX2<ROTATE_COUNT>, hashAVX2};
+#endif
+
+    // Returns false if the processor doesn't support the named version.
+    bool findKernels (const char * name, Kernels & found)
+    {
+        std::string version = name;
+        if (version == "scalar")
+        {
+            found = scalarKernels;
+            return true;
+        }
+#ifdef WS_CRYPTO_X86
+        __builtin_cpu_init();
+        if (version == "sse2" && __builtin_cpu_supports("sse2"))
+        {
+            found = sse2Kernels;
+            return true;
+        }
+        if (version == "avx2" && __builtin_cpu_supports("avx2"))
+        {
+            found = avx2Kernels;
+            return true;
+        }
+#endif
+        return false;
+    }
+
+    Kernels selectKernels ()
+    {
+        Kernels kernels = scalarKernels;
+        if (!findKernels("avx2", kernels))
+            findKernels("sse2", kernels);
+        return kernels;
+    }
+
+    // Chosen once, during static initialization. Only changed afterwards by useKernels(), for benchmarking.
+    Kernels kernels = selectKernels();
+}
+
+// Named for the rotate count - see ws-cryptoLib.h.
+extern "C" const unsigned int WS_KERNEL_ROTATE_SYMBOL(WS_ROTATE_COUNT) = ROTATE_COUNT;
+
+extern "C" bool useKernels (const char * name)
+{
+    /*
+     Switches every kernel to the named version, or back to the one chosen at startup for "auto".
+     Changes nothing and returns false if the processor doesn't support it.
+     */
+
+    if (std::string(name) == "auto")
+    {
+        kernels = selectKernels();
+        return true;
+    }
+
+    return findKernels(name, kernels);
+}
+
+extern "C" const char * kernelsInUse ()
+{
+    return kernels.name;
+}
+
+extern "C" int encryptionAlgorithm (unsigned int * data, unsigned int * dataEnd, unsigned int * key, unsigned int * keyEnd, OPERATION operation)
+{
+    /*
+     Encrypts or decrypts [data, dataEnd) in place. The key [key, keyEnd) is looped from its first element
+     whenever the data is longer than the key, the same as the assembly version.
+     */
+
+    return encryptionAlgorithmCopy(data, dataEnd, data, key, keyEnd, key, operation);
+}
+
+extern "C" int encryptionAlgorithmCopy (const unsigned int * data, const unsigned int * dataEnd, unsigned int * output,
+                                        const unsigned int * key, const unsigned int * keyEnd, const unsigned int * keyPosition, OPERATION operation)
+{
+    /*
+     Encrypts or decrypts [data, dataEnd) into output, which may be the same array as data.
+     The first element uses keyPosition, and the key loops back to its first element after keyEnd.
+     */
+
+    std::size_t count = dataEnd - data;
+    std::size_t keyLength = keyEnd - key;
+    std::size_t keyOffset = keyPosition - key;
+
+    if (count == 0 || keyLength == 0)
+        return 0;
+
+    // A long key - every key word is used once per pass, so combine each one as it's used, cutting runs at the end of the key.
+    // Data no longer than a tile wouldn't use a key word twice either, so a tile would only cost time.
+    if (keyLength >= KEY_TILE_WORDS || count <= 2 * KEY_TILE_WORDS)
+    {
+        while (count)
+        {
+            std::size_t run = keyLength - keyOffset;
+            if (count < run)
+                run = count;
+
+            kernels.crypt(data, output, key + keyOffset, run, operation);
+            data += run;
+            output += run;
+            count -= run;
+            keyOffset = 0;
+        }
+        return 0;
+    }
+
+    // A short key - combine its key stream once, into a tile of whole copies of the key, and run the data against that.
+    // Encrypting zeros gives the encryption key stream, and the same stream decrypts through keyStreamAlgorithm (as KeySchedule relies on).
+    unsigned int keyTile[2 * KEY_TILE_WORDS];
+    unsigned int streamTile[2 * KEY_TILE_WORDS];
+    std::size_t tileLength = 0;
+    while (tileLength < KEY_TILE_WORDS)
+    {
+        for (std::size_t i = 0; i < keyLength; i++)
+            keyTile[tileLength + i] = key[i];
+        tileLength += keyLength;
+    }
+    for (std::size_t i = 0; i < tileLength; i++)
+        streamTile[i] = 0;
+    kernels.crypt(streamTile, streamTile, keyTile, tileLength, ENCRYPT);
+
+    // Power of two key lengths fill exactly KEY_TILE_WORDS, so the position in the tile is a mask instead of a wraparound check.
+    bool powerOfTwo = (keyLength & (keyLength - 1)) == 0;
+    std::size_t position = keyOffset;
+    while (count)
+    {
+        std::size_t run = tileLength - position;
+        if (count < run)
+            run = count;
+
+        kernels.stream(data, output, streamTile + position, run, operation);
+        data += run;
+        output += run;
+        count -= run;
+
+        if (powerOfTwo)
+            position = (position + run) & (KEY_TILE_WORDS - 1);
+        else
+        {
+            position += run;
+            if (position == tileLength)
+                position = 0;
+        }
+    }
+
+    return 0;
+}
+
+extern "C" int keyStreamAlgorithm (const unsigned int * data, const unsigned int * dataEnd, unsigned int * output, const unsigned int * keyStream, OPERATION operation)
+{
+    /*
+     Applies a combined key stream to [data, dataEnd), writing to output (which may equal data).
+     The stream has one word per data element and never wraps.
+     */
+
+    kernels.stream(data, output, keyStream, dataEnd - data, operation);
+    return 0;
+}
+
+extern "C" int keyStreamHashAlgorithm (const unsigned int * data, const unsigned int * dataEnd, unsigned int * output, const unsigned int * keyStream, OPERATION operation)
+{
+    /*
+     keyStreamAlgorithm and hashingAlgorithm in one pass. Returns the xor hash of the plain data -
+     the input when encrypting, the output when decrypting.
+     */
+
+    return kernels.streamHash(data, output, keyStream, dataEnd - data, operation);
+}
+
+extern "C" int hashingAlgorithm (unsigned int * data, unsigned int * dataEnd)
+{
+    /*
+     Xor's all 32bit blocks in [data, dataEnd) together. Returns 0 for an empty range.
+     */
+
+    return kernels.hash(data, dataEnd - data);
+}
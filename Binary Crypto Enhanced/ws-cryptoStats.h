@@ -0,0 +1,143 @@
+/*
+    Optional instrumentation for encryption() & decryption() - how long each stage of the chunk loop takes, and how much it moved.
+
+    Pass a CryptoStats in CryptoOptions::stats and every run using those options adds to it. Stages:
+        KEY_READ    Reading the key file & building its key schedule
+        DATA_READ   Reading the input - the header, and every chunk
+        CIPHER      Encrypting/decrypting & checksumming a chunk. The checksum is computed in the same pass as the cipher (keyStreamHashAlgorithm),
+                    so there's no separate hash time. In memory mapped mode the input is only read from disk as the cipher touches it,
+                    so disk reads land here too. Compressing & decompressing (--compress) is counted here as well.
+        WRITE       Writing chunks out, and flushing at the end
+
+    Times are from std::chrono::steady_clock (monotonic, nanosecond resolution on Linux & Mac) and are summed over every thread,
+    so with several worker threads CIPHER can add up to more than the run took. If DATA_READ + WRITE outweighs CIPHER, the run was waiting on disk.
+
+    Everything is atomic, so one CryptoStats can be shared by every thread and every file of a batch. With stats left NULL,
+    the only cost is one pointer check per stage.
+
+    Written by William Showalter. williamshowalter@gmail.com.
+
+    Released under Creative Commons - creativecommons.org/licenses/by-nc-sa/3.0/
+    Attribution-NonCommercial-ShareAlike 3.0 Unported (CC BY-NC-SA 3.0)
+*/
+
+#ifndef WS_CRYPTOSTATS_H
+#define WS_CRYPTOSTATS_H
+
+#include <atomic>       // Counters shared between threads
+#include <chrono>       // std::chrono::steady_clock
+#include <ostream>      // JSON output
+
+class CryptoStats
+{
+public:
+    enum STAGE {KEY_READ = 0, DATA_READ = 1, CIPHER = 2, WRITE = 3, STAGE_COUNT = 4};
+
+    CryptoStats ()
+    : created(std::chrono::steady_clock::now()), files(0), chunks(0), bytesRead(0), bytesWritten(0), checksumFailures(0)
+    {
+        for (unsigned int i = 0; i < STAGE_COUNT; i++)
+        {
+            stageNanoseconds[i] = 0;
+            stageCount[i] = 0;
+            stageMaxNanoseconds[i] = 0;
+        }
+    }
+
+    void addTime (STAGE stage, unsigned long long nanoseconds)
+    {
+        stageNanoseconds[stage] += nanoseconds;
+        stageCount[stage]++;
+
+        unsigned long long longest = stageMaxNanoseconds[stage];
+        while (nanoseconds > longest && !stageMaxNanoseconds[stage].compare_exchange_weak(longest, nanoseconds))
+            ;
+    }
+
+    void addFile ()                                         { files++; }
+    void addChunks (unsigned long long count)               { chunks += count; }
+    void addBytesRead (unsigned long long count)            { bytesRead += count; }
+    void addBytesWritten (unsigned long long count)         { bytesWritten += count; }
+    void addChecksumFailures (unsigned long long count)     { checksumFailures += count; }
+
+    double seconds (STAGE stage) const                      { return stageNanoseconds[stage] * 1e-9; }
+    unsigned long long count (STAGE stage) const            { return stageCount[stage]; }
+    double maxSeconds (STAGE stage) const                   { return stageMaxNanoseconds[stage] * 1e-9; }
+    unsigned long long fileCount () const                   { return files; }
+    unsigned long long chunkCount () const                  { return chunks; }
+    unsigned long long bytesReadCount () const              { return bytesRead; }
+    unsigned long long bytesWrittenCount () const           { return bytesWritten; }
+    unsigned long long checksumFailureCount () const        { return checksumFailures; }
+
+    // Wall clock time since the CryptoStats was created.
+    double elapsedSeconds () const
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - created).count();
+    }
+
+    void writeJson (std::ostream & out) const
+    {
+        const char * names[STAGE_COUNT] = {"keyRead", "dataRead", "cipher", "write"};
+
+        out << "{\n"
+            << "  \"elapsedSeconds\": " << elapsedSeconds() << ",\n"
+            << "  \"files\": " << fileCount() << ",\n"
+            << "  \"chunks\": " << chunkCount() << ",\n"
+            << "  \"bytesRead\": " << bytesReadCount() << ",\n"
+            << "  \"bytesWritten\": " << bytesWrittenCount() << ",\n"
+            << "  \"checksumFailures\": " << checksumFailureCount() << ",\n"
+            << "  \"stages\": {\n";
+
+        for (unsigned int i = 0; i < STAGE_COUNT; i++)
+        {
+            STAGE stage = (STAGE)i;
+            out << "    \"" << names[i] << "\": {\"seconds\": " << seconds(stage) << ", \"count\": " << count(stage)
+                << ", \"meanSeconds\": " << (count(stage) ? seconds(stage) / count(stage) : 0) << ", \"maxSeconds\": " << maxSeconds(stage) << "}"
+                << ((i + 1 < STAGE_COUNT) ? ",\n" : "\n");
+        }
+
+        out << "  }\n}\n";
+    }
+
+private:
+    CryptoStats (const CryptoStats &);              // Not copyable - atomics
+    CryptoStats & operator= (const CryptoStats &);
+
+    std::chrono::steady_clock::time_point   created;
+    std::atomic<unsigned long long>         stageNanoseconds[STAGE_COUNT];
+    std::atomic<unsigned long long>         stageCount[STAGE_COUNT];
+    std::atomic<unsigned long long>         stageMaxNanoseconds[STAGE_COUNT];
+    std::atomic<unsigned long long>         files;
+    std::atomic<unsigned long long>         chunks;
+    std::atomic<unsigned long long>         bytesRead;
+    std::atomic<unsigned long long>         bytesWritten;
+    std::atomic<unsigned long long>         checksumFailures;
+};
+
+// Times one stage from construction to destruction, and adds it to stats. Does nothing if stats is NULL.
+class StageTimer
+{
+public:
+    StageTimer (CryptoStats * stats, CryptoStats::STAGE stage)
+    : stats(stats), stage(stage)
+    {
+        if (stats)
+            started = std::chrono::steady_clock::now();
+    }
+
+    ~StageTimer ()
+    {
+        if (stats)
+            stats->addTime(stage, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count());
+    }
+
+private:
+    StageTimer (const StageTimer &);                // Not copyable
+    StageTimer & operator= (const StageTimer &);
+
+    CryptoStats *                           stats;
+    CryptoStats::STAGE                      stage;
+    std::chrono::steady_clock::time_point   started;
+};
+
+#endif
@@ -0,0 +1,651 @@
+/*
+    Direct file I/O for bulk jobs (cryptoUtil --direct) - reads & writes that bypass the page cache, kept several slabs ahead of the
+    chunk loop, so sweeping terabytes through the utility doesn't push everything else on the machine out of memory.
+
+    DirectFileStream is an iostream, so it plugs into the chunk loops in place of the std::fstream they normally read & write:
+        Reading     DIRECT_SLAB_BYTES slabs of the file are read ahead, queueDepth of them in flight at once. As the loop uses one
+                    up it's handed straight back to the queue to read the next slab into.
+        Writing     Output fills a slab, which is queued to be written while the next one fills - again up to queueDepth at once.
+                    finish() writes the last, partial slab, padded out to DIRECT_ALIGNMENT, and truncates the padding off again.
+    Files are opened with O_DIRECT on Linux, so slabs go straight between the disk and the slab buffers, and F_NOCACHE on Mac.
+    O_DIRECT needs buffers, offsets & lengths aligned to the disk's blocks - slabs are page aligned blocks of a SecureArena, and
+    every transfer is whole DIRECT_ALIGNMENT blocks until the end of the file. A filesystem that refuses O_DIRECT (tmpfs, some
+    network filesystems) is read & written through the page cache instead, and each slab is dropped from it once it's done with.
+
+    Requests go through an IoQueue: io_uring on Linux when the kernel has it (5.6 or newer, set up with raw system calls - there's no
+    liburing to depend on), and otherwise queueDepth threads each running one pread/pwrite at a time. Either way a request that
+    comes back short or fails is finished off with plain pread/pwrite, so the two only differ in how many system calls they take.
+
+    A read or write error throws std::runtime_error out of the stream - the stream's exceptions are set to badbit, so an error
+    can't pass for the end of the file. Seeking isn't supported; decrypting a range always reads through the page cache.
+
+    Linux & Mac only.
+
+    Written by William Showalter. williamshowalter@gmail.com.
+
+    Released under Creative Commons - creativecommons.org/licenses/by-nc-sa/3.0/
+    Attribution-NonCommercial-ShareAlike 3.0 Unported (CC BY-NC-SA 3.0)
+*/
+
+#ifndef WS_DIRECTIO_H
+#define WS_DIRECTIO_H
+
+const unsigned int          DIRECT_ALIGNMENT    = 4096;                     // Offsets & lengths of direct transfers are multiples of this
+const unsigned int          DIRECT_SLAB_BYTES   = 1024 * 1024;              // One read or write request
+const unsigned int          MAX_QUEUE_DEPTH     = 256;
+
+#ifndef _WIN32
+
+#include <algorithm>    // std::min, std::max
+#include <cerrno>       // EINTR, EINVAL
+#include <condition_variable>   // Thread queue - waking workers & waiters
+#include <cstdint>      // uintptr_t
+#include <cstring>      // memset, memcpy
+#include <deque>        // Thread queue - requests waiting for a worker
+#include <iostream>     // std::iostream
+#include <memory>       // std::unique_ptr for the queue
+#include <mutex>        // Thread queue
+#include <stdexcept>    // Thrown on I/O errors
+#include <streambuf>    // std::streambuf
+#include <string>       // std::string file paths
+#include <thread>       // Thread queue workers
+#include <vector>       // STL Container std::vector
+
+#include <fcntl.h>      // open, O_DIRECT, posix_fadvise
+#include <unistd.h>     // pread, pwrite, ftruncate, close
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>       // Mapping the rings
+#include <sys/syscall.h>    // io_uring_setup, io_uring_enter
+#define WS_HAVE_IO_URING
+#endif
+#endif
+
+#include "ws-secureArena.h"
+
+inline long long transferAll (int fd, bool write, void * buffer, unsigned long long length, unsigned long long offset)
+{
+    /*
+     pread/pwrite that keeps going after a short transfer. Returns the bytes transferred, or -errno if nothing could be.
+     A read stops at the end of the file - and at a transfer that isn't whole blocks, which with O_DIRECT only happens there,
+     and mustn't be followed by a read from an unaligned offset.
+     */
+
+    unsigned char * bytes = (unsigned char *)buffer;
+    unsigned long long total = 0;
+    while (total < length)
+    {
+        ssize_t count = write ? pwrite (fd, bytes + total, length - total, offset + total)
+                              : pread (fd, bytes + total, length - total, offset + total);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count < 0)
+            return total ? (long long)total : -errno;
+        if (count == 0)
+            break;
+
+        total += count;
+        if (!write && count % DIRECT_ALIGNMENT)
+            break;
+    }
+    return total;
+}
+
+class IoQueue
+{
+public:
+    IoQueue (int fileDescriptor, unsigned int depth, bool allowUring)
+    : fd(fileDescriptor), requests(depth), ring(-1), stopping(false)
+    {
+        /*
+         Room for depth requests in flight, one per slot. Uses io_uring if allowUring and the kernel can set one up,
+         otherwise starts depth worker threads.
+         */
+
+#ifdef WS_HAVE_IO_URING
+        if (allowUring && setupRing (depth))
+            return;
+#else
+        (void)allowUring;
+#endif
+
+        for (unsigned int i = 0; i < depth; i++)
+            workers.push_back (std::thread(&IoQueue::work, this));
+    }
+
+    ~IoQueue ()
+    {
+        // Buffers can't be freed while the kernel or a worker is still using them, so everything in flight is finished first.
+        for (unsigned int slot = 0; slot < requests.size(); slot++)
+            if (requests[slot].pending)
+                wait (slot);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (unsigned int i = 0; i < workers.size(); i++)
+            workers[i].join();
+
+#ifdef WS_HAVE_IO_URING
+        if (ring >= 0)
+        {
+            munmap (sqes, sqesBytes);
+            if (cqMap != sqMap)
+                munmap (cqMap, cqMapBytes);
+            munmap (sqMap, sqMapBytes);
+            close (ring);
+        }
+#endif
+    }
+
+    bool usingUring () const
+    {
+        return ring >= 0;
+    }
+
+    void submit (unsigned int slot, bool write, void * buffer, unsigned long long length, unsigned long long offset)
+    {
+        // Starts reading/writing length bytes of buffer at offset in the file. slot mustn't already have a request in flight.
+        Request & request = requests[slot];
+        request.write = write;
+        request.buffer = buffer;
+        request.length = length;
+        request.offset = offset;
+        request.result = 0;
+        request.done = false;
+        request.pending = true;
+
+#ifdef WS_HAVE_IO_URING
+        if (ring >= 0)
+        {
+            unsigned int tail = *sqTail;
+            unsigned int index = tail & *sqMask;
+            struct io_uring_sqe & entry = sqes[index];
+            memset (&entry, 0, sizeof(entry));
+            entry.opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+            entry.fd = fd;
+            entry.addr = (unsigned long long)(uintptr_t)buffer;
+            entry.len = (unsigned int)length;
+            entry.off = offset;
+            entry.user_data = slot;
+            sqArray[index] = index;
+            __atomic_store_n (sqTail, tail + 1, __ATOMIC_RELEASE);
+
+            while (syscall (__NR_io_uring_enter, ring, 1, 0, 0, NULL, 0) < 0)
+            {
+                if (errno != EINTR && errno != EAGAIN)
+                {
+                    request.pending = false;
+                    throw (std::runtime_error("Could not queue file I/O."));
+                }
+            }
+            return;
+        }
+#endif
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queued.push_back (slot);
+        }
+        wake.notify_one();
+    }
+
+    long long wait (unsigned int slot)
+    {
+        /*
+         Waits for slot's request to finish, and returns the bytes transferred - less than asked for only at the end of the file -
+         or -errno if it failed.
+         */
+
+        Request & request = requests[slot];
+
+#ifdef WS_HAVE_IO_URING
+        if (ring >= 0)
+        {
+            while (!request.done)
+            {
+                reapCompletions();
+                if (request.done)
+                    break;
+                if (syscall (__NR_io_uring_enter, ring, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+                    throw (std::runtime_error("Could not wait for file I/O."));
+            }
+
+            // Short or failed (an old kernel without these opcodes, say) - finish it off with plain pread/pwrite.
+            long long result = request.result;
+            if (result < 0)
+                result = transferAll (fd, request.write, request.buffer, request.length, request.offset);
+            else if ((unsigned long long)result < request.length && (request.write || (result > 0 && result % DIRECT_ALIGNMENT == 0)))
+            {
+                long long rest = transferAll (fd, request.write, (unsigned char *)request.buffer + result, request.length - result, request.offset + result);
+                result = (rest < 0) ? rest : result + rest;
+            }
+            request.pending = false;
+            return result;
+        }
+#endif
+
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!request.done)
+            finished.wait (lock);
+        request.pending = false;
+        return request.result;
+    }
+
+private:
+    IoQueue (const IoQueue &);                  // Not copyable - owns the ring & threads
+    IoQueue & operator= (const IoQueue &);
+
+    struct Request
+    {
+        bool write;
+        void * buffer;
+        unsigned long long length;
+        unsigned long long offset;
+        long long result;
+        bool done;                              // Result is in
+        bool pending;                           // Submitted, and not waited for yet
+
+        Request () : write(false), buffer(NULL), length(0), offset(0), result(0), done(false), pending(false) {}
+    };
+
+    void work ()
+    {
+        // Thread queue worker - one blocking pread/pwrite at a time.
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            while (queued.empty() && !stopping)
+                wake.wait (lock);
+            if (queued.empty())
+                return;
+
+            Request & request = requests[queued.front()];
+            queued.pop_front();
+            lock.unlock();
+
+            long long result = transferAll (fd, request.write, request.buffer, request.length, request.offset);
+
+            lock.lock();
+            request.result = result;
+            request.done = true;
+            finished.notify_all();
+        }
+    }
+
+#ifdef WS_HAVE_IO_URING
+    bool setupRing (unsigned int depth)
+    {
+        // Sets up a ring of depth entries, mapping its queues. Returns false if the kernel doesn't have io_uring, or won't allow it.
+        struct io_uring_params params;
+        memset (&params, 0, sizeof(params));
+        int ringFd = (int)syscall (__NR_io_uring_setup, depth, &params);
+        if (ringFd < 0)
+            return false;
+
+        sqMapBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+        cqMapBytes = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (singleMap && cqMapBytes > sqMapBytes)
+            sqMapBytes = cqMapBytes;
+
+        sqMap = mmap (NULL, sqMapBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        if (sqMap == MAP_FAILED)
+        {
+            close (ringFd);
+            return false;
+        }
+
+        cqMap = singleMap ? sqMap : mmap (NULL, cqMapBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        sqesBytes = params.sq_entries * sizeof(struct io_uring_sqe);
+        void * sqeMap = (cqMap == MAP_FAILED) ? MAP_FAILED : mmap (NULL, sqesBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+        if (sqeMap == MAP_FAILED)
+        {
+            if (cqMap != MAP_FAILED && cqMap != sqMap)
+                munmap (cqMap, cqMapBytes);
+            munmap (sqMap, sqMapBytes);
+            close (ringFd);
+            return false;
+        }
+
+        unsigned char * sq = (unsigned char *)sqMap;
+        unsigned char * cq = (unsigned char *)cqMap;
+        sqTail = (unsigned int *)(sq + params.sq_off.tail);
+        sqMask = (unsigned int *)(sq + params.sq_off.ring_mask);
+        sqArray = (unsigned int *)(sq + params.sq_off.array);
+        cqHead = (unsigned int *)(cq + params.cq_off.head);
+        cqTail = (unsigned int *)(cq + params.cq_off.tail);
+        cqMask = (unsigned int *)(cq + params.cq_off.ring_mask);
+        cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+        sqes = (struct io_uring_sqe *)sqeMap;
+        ring = ringFd;
+        return true;
+    }
+
+    void reapCompletions ()
+    {
+        // Every request is its own slot's, and there are never more in flight than the ring holds, so completions can't be lost.
+        unsigned int head = *cqHead;
+        unsigned int tail = __atomic_load_n (cqTail, __ATOMIC_ACQUIRE);
+        while (head != tail)
+        {
+            const struct io_uring_cqe & completion = cqes[head & *cqMask];
+            Request & request = requests[completion.user_data];
+            request.result = completion.res;
+            request.done = true;
+            head++;
+        }
+        __atomic_store_n (cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    void *                      sqMap;
+    void *                      cqMap;
+    size_t                      sqMapBytes;
+    size_t                      cqMapBytes;
+    size_t                      sqesBytes;
+    struct io_uring_sqe *       sqes;
+    struct io_uring_cqe *       cqes;
+    unsigned int *              sqTail;
+    unsigned int *              sqMask;
+    unsigned int *              sqArray;
+    unsigned int *              cqHead;
+    unsigned int *              cqTail;
+    unsigned int *              cqMask;
+#endif
+
+    int                         fd;
+    std::vector<Request>        requests;
+    int                         ring;               // io_uring descriptor, or -1 for the thread queue
+    std::vector<std::thread>    workers;
+    std::mutex                  mutex;
+    std::condition_variable     wake;               // Workers - a request was queued, or it's time to stop
+    std::condition_variable     finished;           // Waiters - a request finished
+    std::deque<unsigned int>    queued;
+    bool                        stopping;
+};
+
+class DirectFileBuf : public std::streambuf
+{
+public:
+    DirectFileBuf ()
+    : fd(-1), writing(false), cached(false), depth(0), current(0), nextOffset(0), endOfFile(false), written(0)
+    {}
+
+    ~DirectFileBuf ()
+    {
+        // Without finish(), partly written output is abandoned - the queue still waits out anything in flight.
+        queue.reset();
+        if (fd >= 0)
+            ::close (fd);
+    }
+
+    void open (std::string filename, bool write, unsigned int queueDepth, bool allowUring)
+    {
+        /*
+         Opens filename for reading, or creates/truncates it for writing, with queueDepth slabs in flight.
+         Throws std::runtime_error if it can't be opened.
+         */
+
+        int flags = write ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDONLY;     // Read too, for rewrite()
+#ifdef O_DIRECT
+        fd = ::open (filename.c_str(), flags | O_DIRECT, 0666);
+        if (fd < 0 && errno == EINVAL)
+        {
+            fd = ::open (filename.c_str(), flags, 0666);
+            cached = true;
+        }
+#else
+        fd = ::open (filename.c_str(), flags, 0666);
+#ifdef F_NOCACHE
+        if (fd >= 0)
+            fcntl (fd, F_NOCACHE, 1);
+#endif
+#endif
+        if (fd < 0)
+            throw (std::runtime_error(write ? "Could not open output file. Check that directory path is valid."
+                                            : "Could not open data file. Check that directory path is valid."));
+
+        writing = write;
+        depth = std::max (1U, std::min (queueDepth, MAX_QUEUE_DEPTH));
+        slabs.allocate (DIRECT_SLAB_BYTES, depth);
+        queue.reset (new IoQueue(fd, depth, allowUring));
+        inFlight.assign (depth, false);
+        slabOffsets.assign (depth, 0);
+        slabLengths.assign (depth, 0);
+        current = 0;
+        nextOffset = 0;
+        endOfFile = false;
+        written = 0;
+
+        if (writing)
+        {
+            char * slab = (char *)slabs.commit (0, DIRECT_SLAB_BYTES);
+            setp (slab, slab + DIRECT_SLAB_BYTES);
+        }
+        else
+        {
+            // Read ahead from the start.
+            for (unsigned int slot = 0; slot < depth; slot++)
+                submitRead (slot);
+            setg (NULL, NULL, NULL);
+        }
+    }
+
+    bool is_open () const
+    {
+        return fd >= 0;
+    }
+
+    bool usingUring () const
+    {
+        return queue && queue->usingUring();
+    }
+
+    void finish ()
+    {
+        /*
+         Writing: writes the last slab and waits for every write to finish, then truncates the file to the length written.
+         Throws std::runtime_error if any write failed.
+         */
+
+        if (!writing || fd < 0)
+            return;
+
+        writeSlab();
+        for (unsigned int slot = 0; slot < depth; slot++)
+            waitWrite (slot);
+
+        if (ftruncate (fd, written) != 0)
+            throw (std::runtime_error("Could not write to output file."));
+    }
+
+    void rewrite (unsigned long long offset, const void * data, unsigned long long length)
+    {
+        /*
+         After finish() - writes length bytes over the file at offset, which have to lie within one DIRECT_ALIGNMENT block.
+         The block is read, patched & written back whole, since a direct write can't be smaller. For the header.
+         */
+
+        unsigned long long blockStart = offset / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT;
+        unsigned char * block = (unsigned char *)slabs.block (0);
+        memset (block, 0, DIRECT_ALIGNMENT);
+        if (transferAll (fd, false, block, DIRECT_ALIGNMENT, blockStart) < 0)
+            throw (std::runtime_error("Could not write to output file."));
+
+        memcpy (block + (offset - blockStart), data, length);
+        if (transferAll (fd, true, block, DIRECT_ALIGNMENT, blockStart) != (long long)DIRECT_ALIGNMENT || ftruncate (fd, written) != 0)
+            throw (std::runtime_error("Could not write to output file."));
+    }
+
+    void close ()
+    {
+        queue.reset();
+        slabs.release();
+        if (fd >= 0)
+            ::close (fd);
+        fd = -1;
+        setg (NULL, NULL, NULL);
+        setp (NULL, NULL);
+    }
+
+protected:
+    int_type underflow ()
+    {
+        if (gptr() < egptr())
+            return traits_type::to_int_type (*gptr());
+
+        // The slab just used up is free - read the slab queueDepth ahead into it, and move on to the next.
+        if (eback() != NULL)
+        {
+            if (endOfFile)
+                return traits_type::eof();
+            dropCached (current);
+            submitRead (current);
+            current = (current + 1) % depth;
+        }
+
+        long long count = queue->wait (current);
+        inFlight[current] = false;
+        if (count < 0)
+            throw (std::runtime_error("Could not read from data file."));
+        if (count < DIRECT_SLAB_BYTES)
+            endOfFile = true;
+
+        char * slab = (char *)slabs.block (current);
+        setg (slab, slab, slab + count);
+        if (count == 0)
+            return traits_type::eof();
+        return traits_type::to_int_type (*gptr());
+    }
+
+    int_type overflow (int_type c)
+    {
+        writeSlab();
+        if (!traits_type::eq_int_type (c, traits_type::eof()))
+        {
+            *pptr() = traits_type::to_char_type (c);
+            pbump (1);
+        }
+        return traits_type::not_eof (c);
+    }
+
+    int sync ()
+    {
+        // A partly filled slab can only be written at the end - finish() does that. This just makes sure nothing queued has failed.
+        if (writing && fd >= 0)
+            for (unsigned int slot = 0; slot < depth; slot++)
+                waitWrite (slot);
+        return 0;
+    }
+
+private:
+    DirectFileBuf (const DirectFileBuf &);      // Not copyable - owns the descriptor & slabs
+    DirectFileBuf & operator= (const DirectFileBuf &);
+
+    void submitRead (unsigned int slot)
+    {
+        void * slab = slabs.commit (slot, DIRECT_SLAB_BYTES);
+        slabOffsets[slot] = nextOffset;
+        queue->submit (slot, false, slab, DIRECT_SLAB_BYTES, nextOffset);
+        inFlight[slot] = true;
+        nextOffset += DIRECT_SLAB_BYTES;
+    }
+
+    void writeSlab ()
+    {
+        // Queues the slab being filled (padded with zeros to whole blocks, if it's the last), and starts filling the next one.
+        unsigned long long bytes = pptr() - pbase();
+        if (bytes == 0)
+            return;
+
+        unsigned long long padded = (bytes + DIRECT_ALIGNMENT - 1) / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT;
+        memset (pbase() + bytes, 0, padded - bytes);
+
+        slabOffsets[current] = written;
+        slabLengths[current] = padded;
+        queue->submit (current, true, pbase(), padded, written);
+        inFlight[current] = true;
+        written += bytes;
+
+        current = (current + 1) % depth;
+        waitWrite (current);
+        char * slab = (char *)slabs.commit (current, DIRECT_SLAB_BYTES);
+        setp (slab, slab + DIRECT_SLAB_BYTES);
+    }
+
+    void waitWrite (unsigned int slot)
+    {
+        if (!inFlight[slot])
+            return;
+
+        long long count = queue->wait (slot);
+        inFlight[slot] = false;
+        if (count < 0 || (unsigned long long)count != slabLengths[slot])
+            throw (std::runtime_error("Could not write to output file - the disk may be full."));
+        dropCached (slot);
+    }
+
+    void dropCached (unsigned int slot)
+    {
+        // Without O_DIRECT, a slab that's done with is dropped from the page cache instead - best effort.
+#ifdef POSIX_FADV_DONTNEED
+        if (cached)
+            posix_fadvise (fd, slabOffsets[slot], DIRECT_SLAB_BYTES, POSIX_FADV_DONTNEED);
+#else
+        (void)slot;
+#endif
+    }
+
+    int                                 fd;
+    bool                                writing;
+    bool                                cached;             // The filesystem refused O_DIRECT
+    unsigned int                        depth;
+    SecureArena                         slabs;              // Locked & zeroed - reading for encryption, or writing for decryption, they hold plain data
+    std::unique_ptr<IoQueue>            queue;
+    std::vector<bool>                   inFlight;
+    std::vector<unsigned long long>     slabOffsets;        // Where in the file each slab was read from or written to
+    std::vector<unsigned long long>     slabLengths;        // Writing - bytes queued from each slab, padding included
+    unsigned int                        current;            // Slab being read from or filled
+    unsigned long long                  nextOffset;         // Reading - where the next slab queued is read from
+    bool                                endOfFile;          // Reading - a slab came back short
+    unsigned long long                  written;            // Writing - bytes of output so far
+};
+
+// DirectFileBuf as a stream, for the chunk loops.
+class DirectFileStream : public std::iostream
+{
+public:
+    DirectFileStream () : std::iostream(NULL)
+    {
+        rdbuf (&buffer);
+        exceptions (std::ios::badbit);
+    }
+
+    void open (std::string filename, bool write, unsigned int queueDepth, bool allowUring)
+    {
+        buffer.open (filename, write, queueDepth, allowUring);
+        clear();
+    }
+
+    bool is_open () const                                       { return buffer.is_open(); }
+    bool usingUring () const                                    { return buffer.usingUring(); }
+    void rewrite (unsigned long long offset, const void * data, unsigned long long length) { buffer.rewrite (offset, data, length); }
+    void close ()                                               { buffer.close(); }
+
+    void finish ()
+    {
+        // flush() can't write the last slab - see DirectFileBuf::sync().
+        buffer.finish();
+    }
+
+private:
+    DirectFileBuf                       buffer;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,138 @@
+/*
+    Encrypted file header - written in front of the encrypted chunks, so every file records the settings it was encrypted with,
+    instead of depending on constants compiled into whichever build happens to read it back.
+
+    Layout - 8 blocks of 32 bits (HEADER_SIZE bytes), in the same byte order as the rest of the file:
+        0       magic           HEADER_MAGIC ("WSBE")
+        1       version         FORMAT_VERSION, or COMPRESSED_VERSION
+        2       chunkSize       Bytes per encrypted chunk, including the chunk's 4 byte checksum
+        3       rotateCount     BIT_SHIFT_COUNT the data was rotated by
+        4 - 5   originalLength  Bytes of plain data, low block first. UNKNOWN_LENGTH if it was encrypted from a pipe.
+        6       tailBytes       Bytes of data in the last 4 byte block (1 - 4), UNKNOWN_TAIL along with UNKNOWN_LENGTH
+        7       checksum        xor of blocks 0 - 6
+
+    The header isn't encrypted. Everything in it can already be worked out from the size of the encrypted file.
+
+    Files encrypted with --compress are COMPRESSED_VERSION, and each chunk's data is compressed (ws-lzCodec.h) before it's checksummed
+    & encrypted. Chunks are then different lengths, so each one is written as a frame:
+        frame word      Bytes of payload, with FRAME_STORED set if the data didn't compress & is stored as it was. Not encrypted.
+        chunk           Checksum, then the payload padded with zeros to whole blocks - encrypted as usual
+    Every frame but the last holds chunkSize-4 bytes of plain data, the same as an uncompressed chunk. The frame words give away how
+    well each chunk compressed, which says something about what's in it.
+
+    Files encrypted before the header existed start straight with their first chunk, and always used LEGACY_CHUNK_SIZE chunks.
+    decodeHeader() tells them apart by the magic number & checksum, so they still decrypt.
+
+    Written by William Showalter. williamshowalter@gmail.com.
+
+    Released under Creative Commons - creativecommons.org/licenses/by-nc-sa/3.0/
+    Attribution-NonCommercial-ShareAlike 3.0 Unported (CC BY-NC-SA 3.0)
+*/
+
+#ifndef WS_FILEHEADER_H
+#define WS_FILEHEADER_H
+
+#include <sstream>      // Error messages
+#include <stdexcept>    // Thrown for headers this build can't decrypt
+
+#include "ws-cryptoLib.h"
+
+const unsigned int          HEADER_BLOCKS       = 8;
+const unsigned int          HEADER_SIZE         = HEADER_BLOCKS * 4;
+const unsigned int          HEADER_MAGIC        = 0x45425357;               // "WSBE" as it reads in the file
+const unsigned int          FORMAT_VERSION      = 1;
+const unsigned int          COMPRESSED_VERSION  = 2;                        // FORMAT_VERSION, with the chunks compressed into frames
+const unsigned int          FRAME_STORED        = 0x80000000;               // Frame word flag - payload is the data as it was
+const unsigned int          FRAME_LENGTH_MASK   = 0x7FFFFFFF;
+const unsigned long long    UNKNOWN_LENGTH      = 0xFFFFFFFFFFFFFFFFULL;
+const unsigned int          UNKNOWN_TAIL        = 0xFFFFFFFF;
+const unsigned int          LEGACY_CHUNK_SIZE   = 1024 * 1024;              // Chunk size of files without a header. Must never change.
+const unsigned int          MIN_CHUNK_SIZE      = 8;                        // Checksum + at least one block of data
+const unsigned int          MAX_CHUNK_SIZE      = 1024 * 1024 * 1024;       // 1GB. Every worker thread holds a few chunks in memory.
+
+struct FileHeader
+{
+    unsigned int version;               // 0 for a file without a header
+    unsigned int chunkSize;
+    unsigned int rotateCount;
+    unsigned long long originalLength;
+    unsigned int tailBytes;
+
+    FileHeader ()
+    : version(FORMAT_VERSION), chunkSize(LEGACY_CHUNK_SIZE), rotateCount(BIT_SHIFT_COUNT), originalLength(UNKNOWN_LENGTH), tailBytes(UNKNOWN_TAIL)
+    {}
+};
+
+// Settings every file had before headers were added.
+inline FileHeader legacyHeader ()
+{
+    FileHeader header;
+    header.version = 0;
+    return header;
+}
+
+inline bool isCompressed (const FileHeader & header)
+{
+    return header.version == COMPRESSED_VERSION;
+}
+
+inline void checkChunkSize (unsigned long long chunkSize)
+{
+    // Chunks are processed as whole 4 byte blocks, with the first block holding the checksum.
+    if (chunkSize < MIN_CHUNK_SIZE || chunkSize > MAX_CHUNK_SIZE || chunkSize % 4)
+    {
+        std::ostringstream message;
+        message << "Chunk size must be a multiple of 4 between " << MIN_CHUNK_SIZE << " and " << MAX_CHUNK_SIZE << " bytes, not " << chunkSize << ".";
+        throw (std::runtime_error(message.str()));
+    }
+}
+
+inline void setOriginalLength (FileHeader & header, unsigned long long length)
+{
+    header.originalLength = length;
+    header.tailBytes = (length % 4) ? (unsigned int)(length % 4) : 4;
+}
+
+inline void encodeHeader (const FileHeader & header, unsigned int * blocks)
+{
+    blocks[0] = HEADER_MAGIC;
+    blocks[1] = header.version;
+    blocks[2] = header.chunkSize;
+    blocks[3] = header.rotateCount;
+    blocks[4] = (unsigned int)(header.originalLength);
+    blocks[5] = (unsigned int)(header.originalLength >> 32);
+    blocks[6] = header.tailBytes;
+    blocks[7] = hashingAlgorithm (blocks, blocks + HEADER_BLOCKS - 1);
+}
+
+inline bool decodeHeader (const unsigned int * blocks, FileHeader & header)
+{
+    /*
+     Returns false if blocks aren't a header - the file is from before headers, and header is set up for that.
+     Throws std::runtime_error if they are a header, but for a format this build can't decrypt.
+     */
+
+    unsigned int checksum = hashingAlgorithm ((unsigned int *)blocks, (unsigned int *)blocks + HEADER_BLOCKS - 1);
+    if (blocks[0] != HEADER_MAGIC || blocks[7] != checksum)
+    {
+        header = legacyHeader();
+        return false;
+    }
+
+    header.version = blocks[1];
+    header.chunkSize = blocks[2];
+    header.rotateCount = blocks[3];
+    header.originalLength = blocks[4] + ((unsigned long long)blocks[5] << 32);
+    header.tailBytes = blocks[6];
+
+    if (header.version == 0 || header.version > COMPRESSED_VERSION)
+        throw (std::runtime_error("Encrypted file was written by a newer version of this utility - its format isn't supported."));
+
+    if (header.rotateCount != BIT_SHIFT_COUNT)
+        throw (std::runtime_error("Encrypted file uses a rotate count this build doesn't support."));
+
+    checkChunkSize (header.chunkSize);
+    return true;
+}
+
+#endif
@@ -0,0 +1,293 @@
+/*
+    Journal for in-place encryption/decryption (cryptoUtil enc|dec --in-place), so a run that's interrupted part way - a crash,
+    a power cut, a kill - can be finished later, instead of leaving a file that's neither plain nor encrypted.
+
+    In-place mode rewrites the file a batch of chunks at a time. Each batch is read in and copied into the journal before
+    anything is written over it, so if the writes are cut short the batch can be redone from the copy. Encryption works from the
+    end of the file back to the front, and decryption from the front to the back, so a batch's output never lands on data that
+    hasn't been read yet - the journal only ever has to hold one batch, however big the file is.
+
+    The journal is a sidecar file next to the data (filename + JOURNAL_SUFFIX):
+        two RECORD_SIZE records     Which batch is being written, and everything needed to carry on without the original file -
+                                    operation, chunk size, the file's length before the run, and its header
+        two payload slots           A copy of one batch's input each
+    Batches alternate between the two, and a record is only written once its payload is synced to disk, so whatever a crash
+    cuts short, the newest record with a good checksum describes a batch whose copy is intact. Redoing a batch that was already
+    written writes the same bytes again, so redoing one too many is harmless.
+
+    Linux & Mac only - it needs pread/pwrite and fsync.
+
+    Written by William Showalter. williamshowalter@gmail.com.
+
+    Released under Creative Commons - creativecommons.org/licenses/by-nc-sa/3.0/
+    Attribution-NonCommercial-ShareAlike 3.0 Unported (CC BY-NC-SA 3.0)
+*/
+
+#ifndef WS_INPLACEJOURNAL_H
+#define WS_INPLACEJOURNAL_H
+
+#ifndef _WIN32
+
+#include <cerrno>       // EINTR, ENOENT
+#include <cstring>      // memcpy, memset
+#include <stdexcept>    // Thrown when the journal can't be written
+#include <string>       // std::string file paths
+
+#include <fcntl.h>      // open
+#include <sys/stat.h>   // File permissions
+#include <unistd.h>     // pread, pwrite, fsync, unlink
+
+#include "ws-cryptoLib.h"
+#include "ws-fileHeader.h"
+
+const char * const          JOURNAL_SUFFIX      = ".wsjournal";
+const unsigned long long    JOURNAL_MAGIC       = 0x4C4E524A45425357ULL;    // "WSBEJRNL" as it reads in the file
+const unsigned int          JOURNAL_VERSION     = 1;
+const unsigned int          RECORD_WORDS        = 16;
+const unsigned int          RECORD_SIZE         = 512;                      // One sector, so a record is never split across two
+const unsigned long long    IN_PLACE_BATCH_BYTES = 16 * 1024 * 1024;       // Input copied into the journal per batch - each payload slot's size, at least
+
+// Makes sure everything written to fd is on disk. Data only - the file's times don't matter here.
+inline void syncFile (int fd)
+{
+#ifdef __APPLE__
+    if (fsync (fd) != 0)
+#else
+    if (fdatasync (fd) != 0)
+#endif
+        throw (std::runtime_error("Could not flush the file to disk."));
+}
+
+// pwrite/pread that keep going after a short transfer. Throw std::runtime_error on failure, or on reading past the end of the file.
+inline void writeAt (int fd, const void * data, unsigned long long length, unsigned long long offset)
+{
+    const char * bytes = (const char *)data;
+    while (length)
+    {
+        ssize_t written = pwrite (fd, bytes, length, offset);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            throw (std::runtime_error("Could not write to file - the disk may be full."));
+
+        bytes += written;
+        offset += written;
+        length -= written;
+    }
+}
+
+inline void readAt (int fd, void * data, unsigned long long length, unsigned long long offset)
+{
+    char * bytes = (char *)data;
+    while (length)
+    {
+        ssize_t count = pread (fd, bytes, length, offset);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            throw (std::runtime_error("Could not read from file - it may have been changed or truncated."));
+
+        bytes += count;
+        offset += count;
+        length -= count;
+    }
+}
+
+// Where an in-place run is up to.
+struct JournalRecord
+{
+    OPERATION operation;
+    unsigned int chunkSize;
+    unsigned long long inputLength;             // Length of the file before the run started
+    unsigned long long slotBytes;               // Size of each payload slot - one batch of input
+    unsigned long long sequence;                // 0 for the record written before the file is touched, then one per batch
+    unsigned long long batchFirst;              // Chunks [batchFirst, batchFirst + batchCount) are being written. Empty for sequence 0.
+    unsigned long long batchCount;
+    unsigned long long payloadBytes;            // Bytes of input copied into the batch's slot
+    unsigned int fileHeader[HEADER_BLOCKS];     // Encryption: the header to write. Decryption: the file's header, which is soon written over.
+
+    JournalRecord ()
+    : operation(ENCRYPT), chunkSize(0), inputLength(0), slotBytes(0), sequence(0), batchFirst(0), batchCount(0), payloadBytes(0)
+    {
+        memset (fileHeader, 0, sizeof(fileHeader));
+    }
+};
+
+class InPlaceJournal
+{
+public:
+    explicit InPlaceJournal (std::string dataFilename)
+    : filename(dataFilename + JOURNAL_SUFFIX), fd(-1)
+    {}
+
+    ~InPlaceJournal ()
+    {
+        if (fd >= 0)
+            close (fd);
+    }
+
+    std::string path () const
+    {
+        return filename;
+    }
+
+    bool open (JournalRecord & latest)
+    {
+        /*
+         Opens the journal left by an interrupted run, and returns its newest good record.
+         Returns false if there's no journal, or if it has no good record - a run that stopped before touching the file.
+         */
+
+        fd = ::open (filename.c_str(), O_RDWR);
+        if (fd < 0)
+        {
+            if (errno != ENOENT)
+                throw (std::runtime_error("Could not open in-place journal " + filename + "."));
+            return false;
+        }
+
+        bool found = false;
+        for (unsigned int slot = 0; slot < 2; slot++)
+        {
+            JournalRecord record;
+            if (readRecord (slot, record) && (!found || record.sequence > latest.sequence))
+            {
+                latest = record;
+                found = true;
+            }
+        }
+
+        return found;
+    }
+
+    void create (const JournalRecord & first)
+    {
+        /*
+         Starts a new journal with first as its only record (sequence 0), and makes sure it's on disk - directory entry included -
+         before the caller touches the data file.
+         */
+
+        if (fd >= 0)
+            close (fd);
+
+        fd = ::open (filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        if (fd < 0)
+            throw (std::runtime_error("Could not create in-place journal " + filename + ". Check that the directory is writable."));
+
+        char empty[RECORD_SIZE] = {0};
+        writeAt (fd, empty, RECORD_SIZE, RECORD_SIZE);      // Slot 1 - no record yet
+        writeRecord (first);
+        syncDirectory();
+    }
+
+    // Where a batch's copy of its input goes.
+    unsigned long long payloadOffset (const JournalRecord & record) const
+    {
+        return 2ULL * RECORD_SIZE + (record.sequence % 2) * record.slotBytes;
+    }
+
+    int descriptor () const
+    {
+        return fd;
+    }
+
+    void commit (const JournalRecord & record)
+    {
+        // The payload for record is already written - sync it, and only then the record that points at it.
+        syncFile (fd);
+        writeRecord (record);
+    }
+
+    // Called once the data file is finished and synced.
+    void remove ()
+    {
+        if (fd >= 0)
+            close (fd);
+        fd = -1;
+
+        if (unlink (filename.c_str()) != 0 && errno != ENOENT)
+            throw (std::runtime_error("Could not remove in-place journal " + filename + "."));
+    }
+
+private:
+    InPlaceJournal (const InPlaceJournal &);        // Not copyable - owns the journal's descriptor
+    InPlaceJournal & operator= (const InPlaceJournal &);
+
+    static unsigned long long checksum (const unsigned long long * words, unsigned int count)
+    {
+        // FNV-1a. Only has to catch a torn or half written record, not tampering.
+        unsigned long long hash = 0xCBF29CE484222325ULL;
+        const unsigned char * bytes = (const unsigned char *)words;
+        for (unsigned int i = 0; i < count * 8; i++)
+        {
+            hash ^= bytes[i];
+            hash *= 0x100000001B3ULL;
+        }
+        return hash;
+    }
+
+    void writeRecord (const JournalRecord & record)
+    {
+        unsigned long long words[RECORD_SIZE / 8] = {0};
+        words[0] = JOURNAL_MAGIC;
+        words[1] = JOURNAL_VERSION;
+        words[2] = record.operation;
+        words[3] = record.chunkSize;
+        words[4] = record.inputLength;
+        words[5] = record.slotBytes;
+        words[6] = record.sequence;
+        words[7] = record.batchFirst;
+        words[8] = record.batchCount;
+        words[9] = record.payloadBytes;
+        memcpy (&words[10], record.fileHeader, HEADER_SIZE);
+        words[RECORD_WORDS - 1] = checksum (words, RECORD_WORDS - 1);
+
+        writeAt (fd, words, RECORD_SIZE, (record.sequence % 2) * RECORD_SIZE);
+        syncFile (fd);
+    }
+
+    bool readRecord (unsigned int slot, JournalRecord & record)
+    {
+        unsigned long long words[RECORD_SIZE / 8];
+        if (pread (fd, words, RECORD_SIZE, slot * RECORD_SIZE) != (ssize_t)RECORD_SIZE)
+            return false;
+
+        if (words[0] != JOURNAL_MAGIC || words[RECORD_WORDS - 1] != checksum (words, RECORD_WORDS - 1))
+            return false;
+
+        if (words[1] != JOURNAL_VERSION)
+            throw (std::runtime_error("In-place journal " + filename + " was written by a different version of this utility."));
+
+        record.operation = (words[2] == DECRYPT) ? DECRYPT : ENCRYPT;
+        record.chunkSize = (unsigned int)words[3];
+        record.inputLength = words[4];
+        record.slotBytes = words[5];
+        record.sequence = words[6];
+        record.batchFirst = words[7];
+        record.batchCount = words[8];
+        record.payloadBytes = words[9];
+        memcpy (record.fileHeader, &words[10], HEADER_SIZE);
+        return true;
+    }
+
+    void syncDirectory ()
+    {
+        // A new file's directory entry has to reach the disk too, or a crash can lose the whole journal.
+        std::string::size_type slash = filename.rfind('/');
+        std::string directory = (slash == std::string::npos) ? "." : filename.substr(0, slash + 1);
+
+        int directoryFd = ::open (directory.c_str(), O_RDONLY);
+        if (directoryFd >= 0)
+        {
+            fsync (directoryFd);
+            close (directoryFd);
+        }
+    }
+
+    std::string             filename;
+    int                     fd;
+};
+
+#endif
+
+#endif
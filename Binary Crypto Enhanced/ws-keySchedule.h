@@ -0,0 +1,186 @@
+/*
+    Key schedule - the key file loaded once and turned into the key stream the cipher actually applies.
+
+    The cipher xor's every data element with 16 rotated copies of its key word. KeySchedule does that combining once, up front,
+    for every word of the key, so the kernel (keyStreamAlgorithm) only has to do one rotate and one xor per element.
+
+    The key is still used the same way encryption() always has: the file is split into chunk sized pieces, chunk N of the data uses
+    piece N (looping back to the first piece after the last), and a piece shorter than a chunk is repeated within the chunk.
+    Each piece's stream is stored already repeated out to the full chunk length, so the kernel never has to wrap around the key.
+
+    One schedule can be used for any number of files, and from any number of threads, since it is never modified after loading.
+    The key and its streams are kept in locked memory (ws-secureArena.h), and zeroed when the schedule or cache is destroyed.
+
+    The stream depends on the chunk size, which each encrypted file records in its header. KeyScheduleCache holds a key
+    and builds the schedule for each chunk size the first time it is asked for, so files with different chunk sizes can share one key.
+
+    Written by William Showalter. williamshowalter@gmail.com.
+
+    Released under Creative Commons - creativecommons.org/licenses/by-nc-sa/3.0/
+    Attribution-NonCommercial-ShareAlike 3.0 Unported (CC BY-NC-SA 3.0)
+*/
+
+#ifndef WS_KEYSCHEDULE_H
+#define WS_KEYSCHEDULE_H
+
+#include <algorithm>    // std::copy, std::min
+#include <fstream>      // Reading the key file
+#include <map>          // KeyScheduleCache, schedules by chunk size
+#include <memory>       // std::unique_ptr
+#include <mutex>        // KeyScheduleCache is shared between threads
+#include <stdexcept>    // Thrown if the key file can't be opened
+#include <string>       // std::string file path
+#include <vector>       // STL Container std::vector
+
+#include "ws-cryptoLib.h"
+#include "ws-secureArena.h"
+
+class KeySchedule
+{
+public:
+    KeySchedule (std::string keyfilename, unsigned int chunkSize)
+    : chunkWords(chunkSize/4), pieceCount(0)
+    {
+        SecureArena key;
+        readKeyFile (keyfilename, key);
+        build (key.block(0), key.blockBytes()/4);
+    }
+
+    // Key already in memory, keyWords words long. The caller still owns (and wipes) key.
+    KeySchedule (const unsigned int * key, unsigned long long keyWords, unsigned int chunkSize)
+    : chunkWords(chunkSize/4), pieceCount(0)
+    {
+        build (key, keyWords);
+    }
+
+    // Same, from a vector.
+    KeySchedule (const std::vector<unsigned int> & key, unsigned int chunkSize)
+    : chunkWords(chunkSize/4), pieceCount(0)
+    {
+        build (&key[0], key.size());
+    }
+
+    // Key stream for the given chunk of the file - chunkSize/4 words long.
+    const unsigned int * stream (unsigned long long chunkIndex) const
+    {
+        return streams.block(0) + (chunkIndex % pieceCount) * chunkWords;
+    }
+
+    unsigned int chunkSize () const
+    {
+        return chunkWords * 4;
+    }
+
+    static void readKeyFile (std::string keyfilename, SecureArena & key)
+    {
+        /*
+         Reads the whole key file into a single block of key, dropping any bytes past the last whole 4 byte block.
+         It's read straight into the locked block - the key never passes through unlocked memory on the way.
+         Throws std::runtime_error if the key file can't be opened or is too short.
+         */
+
+        std::fstream keyfilestream;
+
+        // Open key file
+        keyfilestream.open (keyfilename.c_str(), std::ios::in | std::ios::binary);
+        if (!keyfilestream.is_open())
+            throw (std::runtime_error("Could not open key file. Check that directory path is valid."));
+
+        // Find length of key file
+        keyfilestream.seekg(0,std::ios::end);
+        unsigned long long keyLength = keyfilestream.tellg();
+        keyLength = (keyLength - keyLength%4); // Mod off the extra bits.
+        keyfilestream.clear();
+        keyfilestream.seekg(0, std::ios::beg);
+
+        if (keyLength == 0)
+            throw (std::runtime_error("Key file must contain at least 4 bytes."));
+
+        key.allocate (keyLength, 1);
+        keyfilestream.read((char*)key.commit(0, keyLength), keyLength);
+    }
+
+private:
+    KeySchedule (const KeySchedule &);              // Not copyable - it's key material, and can be large
+    KeySchedule & operator= (const KeySchedule &);
+
+    void build (const unsigned int * key, unsigned long long keyWords)
+    {
+        // Reading the kernels' rotate count is what makes a mismatched build fail to link (ws-cryptoLib.h) - this check is just belt and braces.
+        if (kernelRotateCount() != BIT_SHIFT_COUNT)
+            throw (std::runtime_error("Encryption kernels were built with a different rotate count."));
+
+        // The key is used in chunk sized pieces, each repeated out to a full chunk of key stream.
+        unsigned long long pieceWords = chunkWords;
+        pieceCount = (keyWords + pieceWords - 1) / pieceWords;
+        streams.allocate (pieceCount * chunkWords * 4, 1);
+        streams.commit (0, pieceCount * chunkWords * 4);
+
+        for (unsigned long long piece = 0; piece < pieceCount; piece++)
+        {
+            const unsigned int * pieceKey = &key[piece * pieceWords];
+            unsigned long long pieceLength = keyWords - piece * pieceWords;
+            if (pieceLength > pieceWords)
+                pieceLength = pieceWords;
+
+            // Encrypting zeros (fresh arena memory) leaves exactly the combined key stream. Each key word is combined once, and
+            // the rest of the chunk repeats the piece's stream the same way the cipher loops the key - copied, doubling each time,
+            // instead of folding the same rounds again for every repeat.
+            unsigned int * stream = streams.block(0) + piece * chunkWords;
+            encryptionAlgorithm (stream, stream + pieceLength, (unsigned int *)pieceKey, (unsigned int *)pieceKey + pieceLength, ENCRYPT);
+
+            for (unsigned long long filled = pieceLength; filled < chunkWords;)
+            {
+                unsigned long long copy = std::min (filled, chunkWords - filled);
+                std::copy (stream, stream + copy, stream + filled);
+                filled += copy;
+            }
+        }
+    }
+
+    SecureArena                 streams;            // One block, pieceCount streams of chunkWords words each
+    unsigned int                chunkWords;
+    unsigned long long          pieceCount;
+};
+
+class KeyScheduleCache
+{
+public:
+    // Reads the key file once. Throws std::runtime_error if it can't be read.
+    explicit KeyScheduleCache (std::string keyfilename)
+    {
+        KeySchedule::readKeyFile (keyfilename, key);
+    }
+
+    // Key already in memory. Bytes past the last whole 4 byte block are dropped, the same as a key file. The caller still owns (and wipes) keyData.
+    KeyScheduleCache (const unsigned char * keyData, unsigned long long keyLength)
+    {
+        if (keyLength < 4)
+            throw (std::runtime_error("Key must contain at least 4 bytes."));
+
+        key.allocate (keyLength - keyLength%4, 1);
+        std::copy (keyData, keyData + key.blockBytes(), (unsigned char *)key.commit(0, key.blockBytes()));
+    }
+
+    // Schedule for the given chunk size, built on first use. Safe to call from any number of threads.
+    const KeySchedule & schedule (unsigned int chunkSize)
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+
+        std::unique_ptr<KeySchedule> & cached = schedules[chunkSize];
+        if (!cached)
+            cached.reset(new KeySchedule(key.block(0), key.blockBytes()/4, chunkSize));
+
+        return *cached;
+    }
+
+private:
+    KeyScheduleCache (const KeyScheduleCache &);    // Not copyable
+    KeyScheduleCache & operator= (const KeyScheduleCache &);
+
+    SecureArena                                                 key;                // One block, zeroed when the cache is destroyed
+    std::map<unsigned int, std::unique_ptr<KeySchedule> >       schedules;
+    std::mutex                                                  cacheMutex;
+};
+
+#endif
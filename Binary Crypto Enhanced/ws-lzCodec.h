@@ -0,0 +1,220 @@
+/*
+    Fast built-in LZ compression for chunks encrypted with --compress - nothing to install or link, on any platform this builds on.
+
+    Output is in the LZ4 block format: a run of sequences, each a token byte (literal count in the high 4 bits, match length - 4 in
+    the low 4, 15 meaning more length bytes follow), the literals, then a 2 byte little endian offset back to the match. The last
+    sequence is literals only. So any LZ4 block decoder can read it too.
+
+    lzCompress() is a single pass greedy matcher - one hash table probe per position, skipping ahead faster the longer it goes
+    without a match - which is what keeps it fast on data that won't compress. Log files and text usually shrink 3 - 10x.
+    lzDecompress() checks every length & offset against both buffers, so damaged input fails cleanly instead of reading or writing
+    out of bounds. Chunks are checked against their checksum before they're decompressed anyway.
+
+    Written by William Showalter. williamshowalter@gmail.com.
+
+    Released under Creative Commons - creativecommons.org/licenses/by-nc-sa/3.0/
+    Attribution-NonCommercial-ShareAlike 3.0 Unported (CC BY-NC-SA 3.0)
+*/
+
+#ifndef WS_LZCODEC_H
+#define WS_LZCODEC_H
+
+#include <cstring>      // memcpy, memset
+
+const unsigned int          LZ_HASH_BITS        = 14;
+const unsigned int          LZ_HASH_SIZE        = 1 << LZ_HASH_BITS;   // Entries in the table lzCompress() is given
+const unsigned int          LZ_MIN_MATCH        = 4;
+const unsigned int          LZ_LAST_LITERALS    = 5;                    // The last bytes are always literals...
+const unsigned int          LZ_MATCH_LIMIT      = 12;                   // ...and no match starts this close to the end - as LZ4 requires
+const unsigned int          LZ_MAX_OFFSET       = 65535;
+const unsigned int          LZ_SKIP_TRIGGER     = 6;                    // Step grows by one every 2^LZ_SKIP_TRIGGER positions without a match
+
+inline unsigned int lzRead32 (const unsigned char * bytes)
+{
+    unsigned int value;
+    memcpy (&value, bytes, 4);
+    return value;
+}
+
+inline unsigned int lzHash (unsigned int sequence)
+{
+    return (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+inline unsigned char * lzWriteLength (unsigned char * output, unsigned long long length)
+{
+    // Length past the 15 held in the token, as 255s and a final byte under 255.
+    while (length >= 255)
+    {
+        *output++ = 255;
+        length -= 255;
+    }
+    *output++ = (unsigned char)length;
+    return output;
+}
+
+inline unsigned long long lzCompress (const unsigned char * input, unsigned long long length, unsigned char * output, unsigned long long capacity, unsigned int * table)
+{
+    /*
+     Compresses length bytes of input into output. table is scratch space of LZ_HASH_SIZE entries.
+     Returns the compressed length, or 0 if it wouldn't fit in capacity bytes - pass capacity under length to only keep output that's smaller.
+     Input can be at most 4GB.
+     */
+
+    const unsigned char * inputEnd = input + length;
+    const unsigned char * anchor = input;           // Start of the literals not yet written
+    unsigned char * out = output;
+    unsigned char * outputEnd = output + capacity;
+
+    if (length > LZ_MATCH_LIMIT)
+    {
+        const unsigned char * matchStartLimit = inputEnd - LZ_MATCH_LIMIT;
+        const unsigned char * matchEndLimit = inputEnd - LZ_LAST_LITERALS;
+        memset (table, 0, LZ_HASH_SIZE * sizeof(unsigned int));
+
+        const unsigned char * position = input;
+        unsigned int misses = 1 << LZ_SKIP_TRIGGER;
+
+        while (position < matchStartLimit)
+        {
+            unsigned int sequence = lzRead32 (position);
+            unsigned int hash = lzHash (sequence);
+            const unsigned char * candidate = input + table[hash];
+            table[hash] = (unsigned int)(position - input);
+
+            if (candidate >= position || position - candidate > LZ_MAX_OFFSET || lzRead32 (candidate) != sequence)
+            {
+                position += misses++ >> LZ_SKIP_TRIGGER;
+                continue;
+            }
+
+            // Grow the match back over literals that also match, then forwards as far as it goes.
+            while (position > anchor && candidate > input && position[-1] == candidate[-1])
+            {
+                position--;
+                candidate--;
+            }
+
+            const unsigned char * matchEnd = position + LZ_MIN_MATCH;
+            const unsigned char * reference = candidate + LZ_MIN_MATCH;
+            while (matchEnd < matchEndLimit && *matchEnd == *reference)
+            {
+                matchEnd++;
+                reference++;
+            }
+
+            unsigned long long literals = position - anchor;
+            unsigned long long matchLength = matchEnd - position - LZ_MIN_MATCH;
+            if ((unsigned long long)(outputEnd - out) < 1 + literals / 255 + 1 + literals + 2 + matchLength / 255 + 1)
+                return 0;
+
+            unsigned char * token = out++;
+            *token = (unsigned char)((literals >= 15 ? 15 : literals) << 4);
+            if (literals >= 15)
+                out = lzWriteLength (out, literals - 15);
+            memcpy (out, anchor, literals);
+            out += literals;
+
+            unsigned int offset = (unsigned int)(position - candidate);
+            *out++ = (unsigned char)(offset & 0xFF);
+            *out++ = (unsigned char)(offset >> 8);
+
+            *token |= (unsigned char)(matchLength >= 15 ? 15 : matchLength);
+            if (matchLength >= 15)
+                out = lzWriteLength (out, matchLength - 15);
+
+            position = matchEnd;
+            anchor = position;
+            misses = 1 << LZ_SKIP_TRIGGER;
+
+            // The position just before the next search often starts the next match.
+            if (position - 2 >= input && position < matchStartLimit)
+                table[lzHash (lzRead32 (position - 2))] = (unsigned int)(position - 2 - input);
+        }
+    }
+
+    // Whatever is left is literals.
+    unsigned long long literals = inputEnd - anchor;
+    if ((unsigned long long)(outputEnd - out) < 1 + literals / 255 + 1 + literals)
+        return 0;
+
+    *out++ = (unsigned char)((literals >= 15 ? 15 : literals) << 4);
+    if (literals >= 15)
+        out = lzWriteLength (out, literals - 15);
+    memcpy (out, anchor, literals);
+    out += literals;
+
+    return out - output;
+}
+
+inline bool lzReadLength (const unsigned char *& input, const unsigned char * inputEnd, unsigned long long & length)
+{
+    unsigned char byte;
+    do
+    {
+        if (input >= inputEnd)
+            return false;
+        byte = *input++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+inline bool lzDecompress (const unsigned char * input, unsigned long long length, unsigned char * output, unsigned long long capacity, unsigned long long & written)
+{
+    /*
+     Decompresses length bytes from lzCompress() into output. Sets written to the decompressed length.
+     Returns false if the input is damaged or would decompress to more than capacity bytes.
+     */
+
+    const unsigned char * inputEnd = input + length;
+    unsigned char * out = output;
+    unsigned char * outputEnd = output + capacity;
+
+    while (input < inputEnd)
+    {
+        unsigned int token = *input++;
+
+        unsigned long long literals = token >> 4;
+        if (literals == 15 && !lzReadLength (input, inputEnd, literals))
+            return false;
+        if (literals > (unsigned long long)(inputEnd - input) || literals > (unsigned long long)(outputEnd - out))
+            return false;
+
+        memcpy (out, input, literals);
+        out += literals;
+        input += literals;
+
+        // The last sequence is literals only.
+        if (input == inputEnd)
+            break;
+
+        if (inputEnd - input < 2)
+            return false;
+        unsigned long long offset = input[0] | (input[1] << 8);
+        input += 2;
+        if (offset == 0 || offset > (unsigned long long)(out - output))
+            return false;
+
+        unsigned long long matchLength = token & 15;
+        if (matchLength == 15 && !lzReadLength (input, inputEnd, matchLength))
+            return false;
+        matchLength += LZ_MIN_MATCH;
+        if (matchLength > (unsigned long long)(outputEnd - out))
+            return false;
+
+        // A match can overlap what it's copying - a short offset repeats a pattern - so that's copied a byte at a time.
+        const unsigned char * match = out - offset;
+        if (offset >= matchLength)
+            memcpy (out, match, matchLength);
+        else
+            for (unsigned long long i = 0; i < matchLength; i++)
+                out[i] = match[i];
+        out += matchLength;
+    }
+
+    written = out - output;
+    return true;
+}
+
+#endif
@@ -0,0 +1,345 @@
+/*
+    Locked, zeroizing memory for key material and chunk buffers.
+
+    SecureArena allocates a fixed number of equal sized blocks once, page aligned, and locks them into RAM (mlock/VirtualLock)
+    so key material and plain data are never written out to swap. Each block is padded to whole pages, so blocks never share a page.
+    Nothing is allocated after construction - the chunk loops recycle the same blocks for every chunk of the file.
+
+    Blocks are only reserved up front. commit() locks the front of a block as it's used, growing the locked part at least twofold
+    each time, so a 4KB file in 1MB chunks only locks (and later zeroes) a page or two of each block instead of the whole megabyte.
+
+    Fresh pages from the OS cost a page fault each, and locking & unmapping them costs more - a batch of small files or a stream of
+    small CryptoContexts would spend more time there than encrypting. So a released arena is zeroed but kept, still locked, as a spare
+    (up to MAX_SPARES of them, MAX_SPARE_BYTES in all), and handed to the next arena of the same shape.
+
+    Locking can fail when the process's locked memory limit (ulimit -l) is lower than the arena. The memory is still used, only unlocked,
+    since refusing to encrypt would be worse - locked() reports which it got. On Linux the blocks are also left out of core dumps.
+
+    secureZero() overwrites memory with zeros in a way the compiler can't optimize out, even when the memory is freed right after
+    (which is exactly when an ordinary memset or fill loop gets removed as a dead store). The arena zeroes every block before it's released.
+
+    SecureBlock is a view of one block, sized like a std::vector<unsigned int>: resize() moves the end of the data around inside the block,
+    committing more of it the first time it grows that far, but never reallocates, and throws if asked to grow past the block.
+
+    Written by William Showalter. williamshowalter@gmail.com.
+
+    Released under Creative Commons - creativecommons.org/licenses/by-nc-sa/3.0/
+    Attribution-NonCommercial-ShareAlike 3.0 Unported (CC BY-NC-SA 3.0)
+*/
+
+#ifndef WS_SECUREARENA_H
+#define WS_SECUREARENA_H
+
+#include <cstddef>      // size_t, NULL
+#include <cstring>      // memset
+#include <mutex>        // Spare arenas are shared by every thread
+#include <new>          // std::bad_alloc
+#include <vector>       // Committed bytes of each block
+#include <stdexcept>    // Thrown by SecureBlock::resize past its block
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX        // Keep windows.h's min/max macros away from std::min
+#endif
+#include <windows.h>    // VirtualAlloc, VirtualLock, SecureZeroMemory
+#else
+#include <sys/mman.h>   // mmap, mlock, madvise
+#include <unistd.h>     // sysconf, page size
+#endif
+
+inline void secureZero (void * memory, size_t bytes)
+{
+#if defined(_WIN32)
+    SecureZeroMemory (memory, bytes);
+#elif defined(__GNUC__) || defined(__clang__)
+    // Full speed memset, then an empty asm statement the compiler has to assume reads the memory - so the memset can't be dropped as a dead store.
+    memset (memory, 0, bytes);
+    __asm__ __volatile__ ("" : : "r"(memory) : "memory");
+#else
+    // Writes through a volatile pointer can't be dropped either, only slower.
+    volatile unsigned char * bytePointer = (volatile unsigned char *)memory;
+    for (size_t i = 0; i < bytes; i++)
+        bytePointer[i] = 0;
+#endif
+}
+
+class SecureArena
+{
+public:
+    static const unsigned int   MAX_SPARES = 8;                         // Released arenas kept for reuse
+    static const size_t         MAX_SPARE_BYTES = 64 * 1024 * 1024;     // Largest total size of them
+
+    // Empty until allocate() is called.
+    SecureArena ()
+    : base(NULL), bytesPerBlock(0), stride(0), blocks(0), totalBytes(0), lockFailed(false) {}
+
+    // Throws std::bad_alloc if the memory can't be reserved. Failing to lock it is not an error - see locked().
+    SecureArena (size_t blockBytes, unsigned int blockCount)
+    : base(NULL), bytesPerBlock(0), stride(0), blocks(0), totalBytes(0), lockFailed(false)
+    {
+        allocate (blockBytes, blockCount);
+    }
+
+    ~SecureArena ()
+    {
+        release();
+    }
+
+    void allocate (size_t blockBytes, unsigned int blockCount)
+    {
+        /*
+         Replaces whatever the arena held (zeroing it first) with blockCount blocks of blockBytes each.
+         Memory is a spare of the same shape if there is one, otherwise straight from the OS - zeroed and page aligned either way.
+         A new arena has nothing locked until commit(); a spare keeps what it had locked.
+         */
+
+        release();
+        if (blockBytes == 0 || blockCount == 0)
+            return;
+
+        size_t page = pageSize();
+        stride = (blockBytes + page - 1) / page * page;
+        if (stride < blockBytes || stride * blockCount / blockCount != stride)
+            throw std::bad_alloc();
+        totalBytes = stride * blockCount;
+        bytesPerBlock = blockBytes;
+        blocks = blockCount;
+
+        {
+            std::lock_guard<std::mutex> lock(spareMutex());
+            std::vector<Spare> & spareList = spares();
+            for (size_t i = 0; i < spareList.size(); i++)
+            {
+                if (spareList[i].totalBytes == totalBytes && spareList[i].committed.size() == blockCount)
+                {
+                    base = spareList[i].base;
+                    committed.swap (spareList[i].committed);
+                    lockFailed = spareList[i].lockFailed;
+                    spareList.erase (spareList.begin() + i);
+                    return;
+                }
+            }
+        }
+
+#ifdef _WIN32
+        base = (unsigned char *)VirtualAlloc (NULL, totalBytes, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if (base == NULL)
+            throw std::bad_alloc();
+#else
+        void * mapping = mmap (NULL, totalBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+        if (mapping == MAP_FAILED)
+            throw std::bad_alloc();
+        base = (unsigned char *)mapping;
+
+#ifdef MADV_DONTDUMP
+        madvise (base, totalBytes, MADV_DONTDUMP);
+#endif
+#endif
+
+        committed.assign (blockCount, 0);
+    }
+
+    // Zeroes the committed part of every block, then keeps the arena as a spare, or unlocks and frees it. Called by the destructor.
+    void release ()
+    {
+        if (base == NULL)
+            return;
+
+        for (unsigned int i = 0; i < blocks; i++)
+            secureZero (block(i), committed[i]);
+
+        if (!keepSpare())
+            unmap();
+
+        base = NULL;
+        bytesPerBlock = stride = totalBytes = 0;
+        blocks = 0;
+        committed.clear();
+        lockFailed = false;
+    }
+
+    unsigned int * block (unsigned int index) const
+    {
+        return (unsigned int *)(base + stride * index);
+    }
+
+    unsigned int * commit (unsigned int index, size_t bytes)
+    {
+        /*
+         Locks at least the first bytes of block index, and returns the block. Only makes a system call when the block grows past
+         what's already committed. Not thread safe - the chunk loops only resize chunks on the thread that reads them in.
+         */
+
+        if (bytes > committed[index])
+        {
+            size_t page = pageSize();
+            size_t grown = (bytes + page - 1) / page * page;
+            if (grown < 2 * committed[index])
+                grown = 2 * committed[index];
+            if (grown > stride)
+                grown = stride;
+
+            unsigned char * start = (unsigned char *)block(index) + committed[index];
+#ifdef _WIN32
+            if (!VirtualLock (start, grown - committed[index]))
+                lockFailed = true;
+#else
+            if (mlock (start, grown - committed[index]) != 0)
+                lockFailed = true;
+#endif
+            committed[index] = grown;
+        }
+
+        return block(index);
+    }
+
+    size_t blockBytes () const                  { return bytesPerBlock; }
+    unsigned int blockCount () const            { return blocks; }
+    size_t committedBytes (unsigned int index) const { return committed[index]; }
+
+    // False if the locked memory limit stopped any commit() from locking.
+    bool locked () const                        { return base != NULL && !lockFailed; }
+
+    static size_t pageSize ()
+    {
+#ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo (&info);
+        return info.dwPageSize;
+#else
+        long page = sysconf (_SC_PAGESIZE);
+        return (page > 0) ? (size_t)page : 4096;
+#endif
+    }
+
+private:
+    SecureArena (const SecureArena &);              // Not copyable - owns the mapping
+    SecureArena & operator= (const SecureArena &);
+
+    // A released arena, zeroed and waiting to be reused.
+    struct Spare
+    {
+        unsigned char *         base;
+        size_t                  totalBytes;
+        std::vector<size_t>     committed;
+        bool                    lockFailed;
+    };
+
+    static std::mutex & spareMutex ()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static std::vector<Spare> & spares ()
+    {
+        static std::vector<Spare> spareList;
+        return spareList;
+    }
+
+    bool keepSpare ()
+    {
+        std::lock_guard<std::mutex> lock(spareMutex());
+        std::vector<Spare> & spareList = spares();
+
+        size_t spareBytes = totalBytes;
+        for (size_t i = 0; i < spareList.size(); i++)
+            spareBytes += spareList[i].totalBytes;
+
+        if (spareList.size() >= MAX_SPARES || spareBytes > MAX_SPARE_BYTES)
+            return false;
+
+        Spare spare;
+        spare.base = base;
+        spare.totalBytes = totalBytes;
+        spare.committed.swap (committed);
+        spare.lockFailed = lockFailed;
+        spareList.push_back (spare);
+        return true;
+    }
+
+    void unmap ()
+    {
+        for (unsigned int i = 0; i < blocks; i++)
+        {
+            if (committed[i])
+            {
+#ifdef _WIN32
+                VirtualUnlock (block(i), committed[i]);
+#else
+                munlock (block(i), committed[i]);
+#endif
+            }
+        }
+
+#ifdef _WIN32
+        VirtualFree (base, 0, MEM_RELEASE);
+#else
+        munmap (base, totalBytes);
+#endif
+    }
+
+    unsigned char *         base;
+    size_t                  bytesPerBlock;          // As asked for
+    size_t                  stride;                 // Rounded up to whole pages
+    unsigned int            blocks;
+    size_t                  totalBytes;
+    std::vector<size_t>     committed;              // Bytes at the front of each block that are locked, and zeroed on release
+    bool                    lockFailed;
+};
+
+class SecureBlock
+{
+public:
+    SecureBlock () : arena(NULL), arenaBlock(0), words(NULL), count(0), capacity(0), committedWords(0) {}
+
+    // Views block index of owner, starting empty.
+    void attach (SecureArena & owner, unsigned int index)
+    {
+        arena = &owner;
+        arenaBlock = index;
+        words = arena->block(index);
+        capacity = arena->blockBytes() / 4;
+        count = 0;
+        committedWords = 0;
+    }
+
+    void resize (unsigned long long size)
+    {
+        reserve (size);
+        count = size;
+    }
+
+    // Commits at least size words of the block, without changing size().
+    void reserve (unsigned long long size)
+    {
+        if (size > capacity)
+            throw (std::runtime_error("Chunk is larger than the buffer it was given."));
+
+        if (size > committedWords)
+        {
+            arena->commit (arenaBlock, size * 4);
+            committedWords = arena->committedBytes(arenaBlock) / 4;
+            if (committedWords > capacity)
+                committedWords = capacity;
+        }
+    }
+
+    // Words that can be written without committing more of the block.
+    unsigned long long committed () const                       { return committedWords; }
+    unsigned long long size () const                            { return count; }
+    unsigned int * data ()                                      { return words; }
+    const unsigned int * data () const                          { return words; }
+    unsigned int & operator[] (unsigned long long index)        { return words[index]; }
+    const unsigned int & operator[] (unsigned long long index) const { return words[index]; }
+
+private:
+    SecureArena *           arena;
+    unsigned int            arenaBlock;
+    unsigned int *          words;
+    unsigned long long      count;
+    unsigned long long      capacity;
+    unsigned long long      committedWords;         // Known to be committed, so resize() only calls commit() on growth
+};
+
+#endif
@@ -0,0 +1,82 @@
+/*
+    What the chunk digest (ws-chunkDigest.h) and chunk CRC (ws-chunkCrc.h) sidecars have in common: both are only good for the encrypted
+    file as it was when they were written, so both record its length & modification time (SidecarStamp), and both are replaced whole,
+    never half written (writeSidecarFile()).
+
+    Written by William Showalter. williamshowalter@gmail.com.
+
+    Released under Creative Commons - creativecommons.org/licenses/by-nc-sa/3.0/
+    Attribution-NonCommercial-ShareAlike 3.0 Unported (CC BY-NC-SA 3.0)
+*/
+
+#ifndef WS_SIDECARFILE_H
+#define WS_SIDECARFILE_H
+
+#include <cstdio>       // std::rename, std::remove
+#include <fstream>      // Writing the sidecar
+#include <stdexcept>    // Thrown if the sidecar can't be written
+#include <string>       // std::string file paths
+
+#include <sys/stat.h>   // Encrypted file's length & modification time
+
+// The encrypted file a sidecar belongs to, as it was when the sidecar was written.
+struct SidecarStamp
+{
+    unsigned long long encryptedLength;
+    unsigned long long modifiedSeconds;
+    unsigned long long modifiedNanoseconds;
+
+    SidecarStamp () : encryptedLength(0), modifiedSeconds(0), modifiedNanoseconds(0) {}
+
+    // Records the encrypted file's length & modification time, from stat() once it's finished.
+    void stamp (const struct stat & encryptedStats)
+    {
+        encryptedLength = encryptedStats.st_size;
+        modifiedSeconds = encryptedStats.st_mtime;
+#if defined(__APPLE__)
+        modifiedNanoseconds = encryptedStats.st_mtimespec.tv_nsec;
+#elif defined(__linux__)
+        modifiedNanoseconds = encryptedStats.st_mtim.tv_nsec;
+#else
+        modifiedNanoseconds = 0;
+#endif
+    }
+
+    // True if the encrypted file is still as it was when the sidecar was written.
+    bool describes (const struct stat & encryptedStats) const
+    {
+        SidecarStamp current;
+        current.stamp (encryptedStats);
+        return current.encryptedLength == encryptedLength && current.modifiedSeconds == modifiedSeconds && current.modifiedNanoseconds == modifiedNanoseconds;
+    }
+};
+
+inline void writeSidecarFile (std::string filename, std::string description, const void * header, unsigned long long headerLength,
+                              const void * records, unsigned long long recordsLength, unsigned long long checksum)
+{
+    /*
+     Writes a sidecar - its header, its records and the checksum after them - to a temporary file and renames it into place,
+     so a crash leaves the old sidecar or the new one, never half of one. records may be NULL when recordsLength is 0.
+
+     Throws std::runtime_error, naming the sidecar by its description, if it can't be written.
+     */
+
+    std::string temporary = filename + ".tmp";
+    {
+        std::ofstream output (temporary.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        output.write ((const char *)header, headerLength);
+        if (recordsLength)
+            output.write ((const char *)records, recordsLength);
+        output.write ((const char *)&checksum, 8);
+        if (!output.flush())
+            throw (std::runtime_error("Could not write " + description + " " + filename + "."));
+    }
+
+#ifdef _WIN32
+    std::remove (filename.c_str());         // Windows won't rename over an existing file
+#endif
+    if (std::rename (temporary.c_str(), filename.c_str()) != 0)
+        throw (std::runtime_error("Could not write " + description + " " + filename + "."));
+}
+
+#endif
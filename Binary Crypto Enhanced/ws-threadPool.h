@@ -0,0 +1,369 @@
+/*
+    Fixed size pool of worker threads for running chunk encryption/decryption in parallel.
+
+    Tasks are queued with submit() and run by whichever worker is free. wait() blocks until every submitted
+    task has finished, and rethrows the first exception any task threw so errors still reach the menu.
+
+    WorkStealingPool runs tasks that spawn more tasks - a directory tree, where each directory queues its subdirectories & files.
+    Every worker has its own deque: tasks submitted from a worker go on its own deque, and it runs the newest first, so a walk goes
+    depth first and doesn't pile up the whole tree in memory. A worker with nothing left takes the oldest task off another's deque -
+    the oldest are nearest the top of the tree, the biggest pieces of work - so one worker stuck on a huge file never leaves the
+    work queued behind it waiting.
+
+    BoundedQueue passes chunks between the reader, compute and writer stages of pipelined mode.
+    push() blocks while the queue is full, pop() blocks while it is empty, and close() releases both.
+
+    Written by William Showalter. williamshowalter@gmail.com.
+
+    Released under Creative Commons - creativecommons.org/licenses/by-nc-sa/3.0/
+    Attribution-NonCommercial-ShareAlike 3.0 Unported (CC BY-NC-SA 3.0)
+*/
+
+#ifndef WS_THREADPOOL_H
+#define WS_THREADPOOL_H
+
+#include <atomic>               // Work stealing pool's task counts
+#include <condition_variable>   // Worker wakeup & wait() notification
+#include <deque>                // Task queue
+#include <exception>            // std::exception_ptr, passes task exceptions back to the caller
+#include <functional>           // std::function task type
+#include <memory>               // std::unique_ptr, per-worker deques
+#include <mutex>                // Queue lock
+#include <thread>               // Worker threads
+#include <vector>               // STL Container std::vector
+
+class ThreadPool
+{
+public:
+    explicit ThreadPool (unsigned int threadCount)
+    : pending(0), stopping(false)
+    {
+        if (threadCount == 0)
+            threadCount = 1;
+
+        for (unsigned int i = 0; i < threadCount; i++)
+            workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+    }
+
+    ~ThreadPool ()
+    {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            stopping = true;
+        }
+        taskReady.notify_all();
+
+        for (unsigned int i = 0; i < workers.size(); i++)
+            workers[i].join();
+    }
+
+    void submit (std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            tasks.push_back(task);
+            pending++;
+        }
+        taskReady.notify_one();
+    }
+
+    void wait ()
+    {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        allDone.wait(lock, [this] { return pending == 0; });
+
+        if (firstError)
+        {
+            std::exception_ptr error = firstError;
+            firstError = std::exception_ptr();
+            std::rethrow_exception(error);
+        }
+    }
+
+    unsigned int size () const
+    {
+        return workers.size();
+    }
+
+private:
+    ThreadPool (const ThreadPool &);                // Not copyable
+    ThreadPool & operator= (const ThreadPool &);
+
+    void workerLoop ()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                taskReady.wait(lock, [this] { return stopping || !tasks.empty(); });
+
+                if (tasks.empty())
+                    return;     // stopping, and nothing left to run
+
+                task = tasks.front();
+                tasks.pop_front();
+            }
+
+            try {
+                task();
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(queueMutex);
+                if (!firstError)
+                    firstError = std::current_exception();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(queueMutex);
+                if (--pending == 0)
+                    allDone.notify_all();
+            }
+        }
+    }
+
+    std::vector<std::thread>            workers;
+    std::deque<std::function<void()> >  tasks;
+    std::mutex                          queueMutex;
+    std::condition_variable             taskReady;
+    std::condition_variable             allDone;
+    unsigned int                        pending;    // Submitted tasks that haven't finished yet
+    bool                                stopping;
+    std::exception_ptr                  firstError;
+};
+
+class WorkStealingPool
+{
+public:
+    explicit WorkStealingPool (unsigned int threadCount)
+    : queued(0), pending(0), nextQueue(0), stopping(false)
+    {
+        if (threadCount == 0)
+            threadCount = 1;
+
+        for (unsigned int i = 0; i < threadCount; i++)
+            queues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+        for (unsigned int i = 0; i < threadCount; i++)
+            workers.push_back(std::thread(&WorkStealingPool::workerLoop, this, i));
+    }
+
+    ~WorkStealingPool ()
+    {
+        {
+            std::lock_guard<std::mutex> lock(idleMutex);
+            stopping = true;
+        }
+        taskReady.notify_all();
+
+        for (unsigned int i = 0; i < workers.size(); i++)
+            workers[i].join();
+    }
+
+    // From one of this pool's workers, onto its own deque. From any other thread, onto each worker's deque in turn.
+    void submit (std::function<void()> task)
+    {
+        unsigned int index = (currentPool() == this) ? currentWorker() : nextQueue++ % queues.size();
+        {
+            // Counted under idleMutex, so a worker deciding to sleep can't miss it - and before it's on a deque, so another worker
+            // can't take it, run it and count it done first, which could take pending to 0 while the task submitting it is still running.
+            std::lock_guard<std::mutex> lock(idleMutex);
+            queued++;
+            pending++;
+        }
+        {
+            std::lock_guard<std::mutex> lock(queues[index]->mutex);
+            queues[index]->tasks.push_back(task);
+        }
+        taskReady.notify_one();
+    }
+
+    // Waits until every task has finished - including tasks submitted by tasks. Not for use from inside a task.
+    void wait ()
+    {
+        std::unique_lock<std::mutex> lock(idleMutex);
+        allDone.wait(lock, [this] { return pending == 0; });
+
+        if (firstError)
+        {
+            std::exception_ptr error = firstError;
+            firstError = std::exception_ptr();
+            std::rethrow_exception(error);
+        }
+    }
+
+    unsigned int size () const
+    {
+        return workers.size();
+    }
+
+private:
+    WorkStealingPool (const WorkStealingPool &);    // Not copyable
+    WorkStealingPool & operator= (const WorkStealingPool &);
+
+    struct WorkerQueue
+    {
+        std::mutex                          mutex;
+        std::deque<std::function<void()> >  tasks;
+    };
+
+    // Which pool & worker the calling thread is - so submit() from inside a task stays on the worker's own deque.
+    static const WorkStealingPool *& currentPool ()
+    {
+        static thread_local const WorkStealingPool * pool = NULL;
+        return pool;
+    }
+
+    static unsigned int & currentWorker ()
+    {
+        static thread_local unsigned int worker = 0;
+        return worker;
+    }
+
+    bool takeTask (unsigned int index, std::function<void()> & task)
+    {
+        // Newest task off our own deque, otherwise the oldest off the next worker's that has any.
+        for (unsigned int i = 0; i < queues.size(); i++)
+        {
+            WorkerQueue & queue = *queues[(index + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty())
+                continue;
+
+            if (i == 0)
+            {
+                task = queue.tasks.back();
+                queue.tasks.pop_back();
+            }
+            else
+            {
+                task = queue.tasks.front();
+                queue.tasks.pop_front();
+            }
+            queued--;
+            return true;
+        }
+        return false;
+    }
+
+    void workerLoop (unsigned int index)
+    {
+        currentPool() = this;
+        currentWorker() = index;
+
+        while (true)
+        {
+            std::function<void()> task;
+            if (!takeTask (index, task))
+            {
+                std::unique_lock<std::mutex> lock(idleMutex);
+                taskReady.wait(lock, [this] { return stopping || queued > 0; });
+
+                if (queued == 0)
+                    return;     // stopping, and nothing left to run
+                continue;       // (a task counted by submit() may not be on its deque yet - look again)
+            }
+
+            try {
+                task();
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(idleMutex);
+                if (!firstError)
+                    firstError = std::current_exception();
+            }
+
+            // Let go of whatever the task held before the last one is counted done.
+            task = std::function<void()>();
+
+            {
+                std::lock_guard<std::mutex> lock(idleMutex);
+                if (--pending == 0)
+                    allDone.notify_all();
+            }
+        }
+    }
+
+    std::vector<std::thread>                    workers;
+    std::vector<std::unique_ptr<WorkerQueue> >  queues;     // One per worker
+    std::atomic<unsigned long long>             queued;     // Tasks sitting in a deque
+    unsigned long long                          pending;    // Submitted tasks that haven't finished yet. Guarded by idleMutex.
+    std::atomic<unsigned int>                   nextQueue;  // Round robin for tasks submitted from outside
+    std::mutex                                  idleMutex;
+    std::condition_variable                     taskReady;
+    std::condition_variable                     allDone;
+    bool                                        stopping;
+    std::exception_ptr                          firstError;
+};
+
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue (unsigned int capacity)
+    : capacity(capacity ? capacity : 1), closed(false)
+    {}
+
+    // Returns false without queueing the item if the queue has been closed.
+    bool push (const T & item)
+    {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        notFull.wait(lock, [this] { return closed || items.size() < capacity; });
+
+        if (closed)
+            return false;
+
+        items.push_back(item);
+        notEmpty.notify_one();
+        return true;
+    }
+
+    // Returns false once the queue is closed and everything in it has been popped.
+    bool pop (T & item)
+    {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+
+        if (items.empty())
+            return false;
+
+        item = items.front();
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    // Same as pop(), but returns false right away instead of waiting when the queue is empty.
+    bool tryPop (T & item)
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+
+        if (items.empty())
+            return false;
+
+        item = items.front();
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close ()
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+private:
+    BoundedQueue (const BoundedQueue &);            // Not copyable
+    BoundedQueue & operator= (const BoundedQueue &);
+
+    std::deque<T>           items;
+    unsigned int            capacity;
+    bool                    closed;
+    std::mutex              queueMutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+};
+
+#endif